@@ -29,9 +29,12 @@
 #include <time.h>
 #include <math.h>
 #include <string>
+#include <chrono>
 
 #include "Scene.h"
 #include "TiledRenderer.h"
+#include "CpuRenderer.h"
+#include "CacheModel.h"
 #include "Camera.h"
 #include "imgui.h"
 #include "imgui_internal.h"
@@ -39,12 +42,14 @@
 #include "imgui_impl_opengl3.h"
 
 #include "Loader.h"
+#include "ObjLoader.h"
 #include "boyTestScene.h"
 #include "ajaxTestScene.h"
 #include "cornellTestScene.h"
 #include "ImGuizmo.h"
 #include "tinydir.h"
 
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image.h"
@@ -64,11 +69,13 @@ int sampleSceneIndex = 0;
 int selectedInstance = 0;
 double lastTime = SDL_GetTicks();
 bool done = false;
+bool useCpuRenderer = false;
 
 std::string shadersDir = "../src/shaders/";
 std::string assetsDir = "../assets/";
 
 RenderOptions renderOptions;
+int numThreads = -1; // --threads, replaces the threads of every scene file loaded
 ImVec2 viewportPanelSize;
 bool viewportFocused = false;
 bool viewportHovered = false;
@@ -143,7 +150,7 @@ void LoadScene(std::string sceneName)
 {
     delete scene;
     scene = new Scene();
-    LoadSceneFromFile(sceneName, scene, renderOptions);
+    LoadSceneFromFile(sceneName, scene, renderOptions, numThreads);
     selectedInstance = 0;
     scene->renderOptions = renderOptions;
 }
@@ -151,7 +158,10 @@ void LoadScene(std::string sceneName)
 bool InitRenderer()
 {
     delete renderer;
-    renderer = new TiledRenderer(scene, shadersDir);
+    if (useCpuRenderer)
+        renderer = new CpuRenderer(scene, shadersDir);
+    else
+        renderer = new TiledRenderer(scene, shadersDir);
     renderer->Init();
     return true;
 }
@@ -545,21 +555,22 @@ void MainLoop(void* arg)
         {
             bool objectPropChanged = false;
 
-            std::vector<std::string> listboxItems;
-            for (int i = 0; i < scene->meshInstances.size(); i++)
-            {
-                listboxItems.push_back(scene->meshInstances[i].name);
-            }
-
-            // Object Selection
+            // Object Selection, only the visible rows of large instance arrays are submitted
             if (ImGui::BeginListBox("Instances"))
             {
-                for (int i = 0; i < scene->meshInstances.size(); i++)
+                ImGuiListClipper clipper;
+                clipper.Begin((int)scene->meshInstances.size());
+                while (clipper.Step())
                 {
-                    bool is_selected = selectedInstance == i;
-                    if (ImGui::Selectable(listboxItems[i].c_str(), is_selected))
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
                     {
-                        selectedInstance = i;
+                        bool is_selected = selectedInstance == i;
+                        ImGui::PushID(i);
+                        if (ImGui::Selectable(scene->GetInstanceName(i).c_str(), is_selected))
+                        {
+                            selectedInstance = i;
+                        }
+                        ImGui::PopID();
                     }
                 }
                 ImGui::EndListBox();
@@ -615,6 +626,7 @@ void MainLoop(void* arg)
             {
                 scene->RebuildInstances();
             }
+            ImGui::Text("Last edit: %.2f ms (TLAS %s)", scene->instanceUpdateTime * 1000.0f, scene->instancesRefitted ? "refit" : "rebuild");
             ImGui::End();
         }
 
@@ -642,11 +654,312 @@ void MainLoop(void* arg)
     SDL_GL_SwapWindow(loopdata.mWindow);
 }
 
+static double SecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Renders the loaded scene with the CPU renderer until maxSpp samples or maxSeconds of render time
+// (whichever comes first, a value <= 0 disables the limit) and writes the result to outputFile.
+// With a statsFile the average node visits, triangle tests and rays per sample of every pixel are
+// written to it as a Radiance HDR image
+int RenderHeadless(const std::string& outputFile, const std::string& statsFile, int maxSpp, float maxSeconds, bool denoise, double loadTime)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    CpuRenderer* cpuRenderer = new CpuRenderer(scene, shadersDir);
+    renderer = cpuRenderer;
+    renderer->Init();
+    double initTime = SecondsSince(start);
+
+    // Nothing moves without the UI, so samples keep accumulating
+    scene->camera->isMoving = false;
+
+    start = std::chrono::steady_clock::now();
+    while ((maxSpp <= 0 || renderer->GetSampleCount() < maxSpp) && (maxSeconds <= 0.0f || SecondsSince(start) < maxSeconds))
+        renderer->Render();
+    double renderTime = SecondsSince(start);
+
+    double denoiseTime = 0.0;
+    if (denoise)
+    {
+        start = std::chrono::steady_clock::now();
+        cpuRenderer->DenoiseOutput();
+        denoiseTime = SecondsSince(start);
+    }
+
+    start = std::chrono::steady_clock::now();
+    unsigned char* data = nullptr;
+    int w, h;
+    renderer->GetOutputBuffer(&data, w, h);
+
+    std::string ext = outputFile.substr(outputFile.find_last_of('.') + 1);
+    int ok;
+    stbi_flip_vertically_on_write(true);
+    if (ext == "jpg" || ext == "jpeg")
+        ok = stbi_write_jpg(outputFile.c_str(), w, h, 3, data, 95);
+    else if (ext == "bmp")
+        ok = stbi_write_bmp(outputFile.c_str(), w, h, 3, data);
+    else if (ext == "tga")
+        ok = stbi_write_tga(outputFile.c_str(), w, h, 3, data);
+    else
+        ok = stbi_write_png(outputFile.c_str(), w, h, 3, data, w * 3);
+    delete[] data;
+
+    if (!ok)
+    {
+        printf("Error: Unable to write %s\n", outputFile.c_str());
+        return 1;
+    }
+
+    if (!statsFile.empty())
+    {
+        std::vector<Vec3> stats = cpuRenderer->GetTraversalStatsBuffer();
+        float invSamples = 1.0f / std::max(renderer->GetSampleCount(), 1);
+        for (int i = 0; i < stats.size(); i++)
+            stats[i] = stats[i] * invSamples;
+
+        if (stats.empty() || !stbi_write_hdr(statsFile.c_str(), w, h, 3, &stats[0].x))
+        {
+            printf("Error: Unable to write %s\n", statsFile.c_str());
+            return 1;
+        }
+        printf("Traversal stats saved: %s\n", statsFile.c_str());
+    }
+    double writeTime = SecondsSince(start);
+
+    int samples = renderer->GetSampleCount();
+    printf("Frame saved: %s (%dx%d, %d spp)\n", outputFile.c_str(), w, h, samples);
+    printf("Scene load  : %.3f s\n", loadTime);
+    printf("Init        : %.3f s\n", initTime);
+    printf("Render      : %.3f s (%.3f s/spp)\n", renderTime, samples > 0 ? renderTime / samples : 0.0);
+    if (denoise)
+        printf("Denoise     : %.3f s\n", denoiseTime);
+    printf("Write       : %.3f s\n", writeTime);
+
+    TraceStats traceStats = cpuRenderer->GetTraceStats();
+    if (traceStats.rays > 0)
+    {
+        printf("Rays        : %llu (%.2f Mrays/s, BVH%d)\n", (unsigned long long)traceStats.rays,
+            renderTime > 0.0 ? traceStats.rays / renderTime * 1e-6 : 0.0, cpuRenderer->GetTracer()->GetBvhWidth());
+        printf("Per ray     : %.2f node visits, %.2f triangle tests, %.1f node bytes\n",
+            double(traceStats.nodeVisits) / traceStats.rays, double(traceStats.triTests) / traceStats.rays,
+            double(traceStats.nodeBytes) / traceStats.rays);
+    }
+    cpuRenderer->GetTileScheduler().PrintStats();
+
+    return 0;
+}
+
+// Rebuilds the BVH of every mesh in the loaded scene on a single thread and on the build thread pool,
+// printing the fastest of repeats builds for each. scalarBins bins SAH candidates without SSE, to compare
+// against a run with the default binning
+int BenchmarkBvhBuild(int repeats, bool scalarBins)
+{
+    ThreadPool pool(scene->renderOptions.numThreads);
+    double totalSerial = 0.0, totalParallel = 0.0;
+
+    printf("SAH binning : %s\n", scalarBins ? "scalar" : "default (SSE where available)");
+    printf("%-32s %10s %12s %12s %8s\n", "Mesh", "Triangles", "1 thread", "Pool", "Mtris/s");
+    for (Mesh* mesh : scene->meshes)
+    {
+        double serialTime = 1e30, parallelTime = 1e30;
+        mesh->bvh->SetScalarBinning(scalarBins);
+        for (int i = 0; i < repeats; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            mesh->BuildBVH(nullptr);
+            serialTime = std::min(serialTime, SecondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            mesh->BuildBVH(&pool);
+            parallelTime = std::min(parallelTime, SecondsSince(start));
+        }
+
+        int numTris = mesh->NumTriangles();
+        printf("%-32s %10d %10.1fms %10.1fms %8.2f\n", mesh->name.c_str(), numTris, serialTime * 1e3, parallelTime * 1e3,
+            parallelTime > 0.0 ? numTris / parallelTime * 1e-6 : 0.0);
+
+        totalSerial += serialTime;
+        totalParallel += parallelTime;
+    }
+    printf("%-32s %10s %10.1fms %10.1fms (%d threads)\n", "Total", "", totalSerial * 1e3, totalParallel * 1e3, pool.GetNumThreads());
+
+    return 0;
+}
+
+// Traces the primary rays of the loaded scene and one diffuse bounce from each of their hits through the 4 and
+// 8-wide BVH, with the nodes in depth first order and in treelets. Prints the fastest of repeats passes and,
+// per ray, the node visits and the node reads missing in the L1, L2 and TLB of a MemoryModel
+int BenchmarkBvhLayout(int repeats)
+{
+    // The same rays for every layout, a fixed camera ray per pixel and a fixed bounce direction
+    const iVec2& resolution = scene->renderOptions.resolution;
+    const Camera* camera = scene->camera;
+    float scale = tanf(camera->fov * 0.5f);
+    float aspect = float(resolution.y) / float(resolution.x);
+
+    std::vector<Ray> rays;
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x < resolution.x; x++)
+        {
+            float dx = ((x + 0.5f) / resolution.x * 2.0f - 1.0f) * scale;
+            float dy = ((y + 0.5f) / resolution.y * 2.0f - 1.0f) * scale * aspect;
+            rays.push_back(Ray(camera->position, Vec3::Normalize(camera->right * dx + camera->up * dy + camera->forward)));
+        }
+    }
+
+    {
+        CpuTracer tracer(scene, 4);
+        size_t numPrimary = rays.size();
+        for (size_t i = 0; i < numPrimary; i++)
+        {
+            State state;
+            LightSampleRec lightSampleRec;
+            if (!tracer.ClosestHit(rays[i], state, lightSampleRec) || state.isEmitter)
+                continue;
+
+            Rng rng;
+            rng.Init((int)(i % resolution.x), (int)(i / resolution.x), 0);
+            float z = 1.0f - 2.0f * rng.Next();
+            float phi = 2.0f * PI * rng.Next();
+            float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+            Vec3 dir = Vec3::Normalize(state.ffnormal + Vec3(r * cosf(phi), r * sinf(phi), z));
+            rays.push_back(Ray(state.fhp + state.ffnormal * 0.001f, dir));
+        }
+    }
+
+    bool treeletBvh = scene->renderOptions.treeletBvh;
+    printf("%zu rays (%dx%d primary and their hits bounced once)\n", rays.size(), resolution.x, resolution.y);
+    printf("%-6s %-12s %10s %10s %10s %10s %10s\n", "BVH", "Layout", "Mrays/s", "Visits", "L1 miss", "L2 miss", "TLB miss");
+    for (int width = 4; width <= 8; width *= 2)
+    {
+        for (int treelets = 0; treelets < 2; treelets++)
+        {
+            scene->renderOptions.treeletBvh = treelets != 0;
+            CpuTracer tracer(scene, width);
+
+            double traceTime = 1e30;
+            for (int i = 0; i < repeats; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                for (const Ray& ray : rays)
+                {
+                    State state;
+                    LightSampleRec lightSampleRec;
+                    tracer.ClosestHit(ray, state, lightSampleRec);
+                }
+                traceTime = std::min(traceTime, SecondsSince(start));
+            }
+
+            // A separate pass, the model is slower than the traversal
+            MemoryModel memory;
+            TraceStats stats;
+            stats.nodeMemory = &memory;
+            for (const Ray& ray : rays)
+            {
+                State state;
+                LightSampleRec lightSampleRec;
+                tracer.ClosestHit(ray, state, lightSampleRec, &stats);
+            }
+
+            double invRays = 1.0 / std::max<uint64_t>(stats.rays, 1);
+            printf("BVH%-3d %-12s %10.2f %10.2f %10.3f %10.3f %10.3f\n", width, treelets ? "treelets" : "depth first",
+                traceTime > 0.0 ? rays.size() / traceTime * 1e-6 : 0.0, stats.nodeVisits * invRays,
+                memory.l1.misses * invRays, memory.l2.misses * invRays, memory.tlb.misses * invRays);
+        }
+    }
+    scene->renderOptions.treeletBvh = treeletBvh;
+
+    return 0;
+}
+
+// Loads every OBJ file with tinyobj, with LoadObj() on a single thread and with LoadObj() on the pool,
+// printing the fastest of repeats loads for each
+int BenchmarkObjLoad(const std::vector<std::string>& files, int repeats, int numThreads)
+{
+    ThreadPool pool(numThreads);
+    double totalTinyObj = 0.0, totalSerial = 0.0, totalParallel = 0.0, totalMB = 0.0;
+
+    printf("%-32s %10s %8s %12s %12s %12s %8s\n", "File", "Triangles", "MB", "tinyobj", "1 thread", "Pool", "MB/s");
+    for (const std::string& file : files)
+    {
+        double tinyObjTime = 1e30, serialTime = 1e30, parallelTime = 1e30;
+        std::vector<Vec4> verticesUVX, normalsUVY, refVerticesUVX, refNormalsUVY;
+        std::vector<int> indices, refIndices;
+        for (int i = 0; i < repeats; ++i)
+        {
+            refVerticesUVX.clear(), refNormalsUVY.clear(), refIndices.clear();
+            auto start = std::chrono::steady_clock::now();
+            if (!LoadObjTinyObj(file, refVerticesUVX, refNormalsUVY, refIndices))
+            {
+                printf("tinyobj couldn't load %s\n", file.c_str());
+                return 1;
+            }
+            tinyObjTime = std::min(tinyObjTime, SecondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            if (!LoadObj(file, verticesUVX, normalsUVY, indices))
+                return 1;
+            serialTime = std::min(serialTime, SecondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            LoadObj(file, verticesUVX, normalsUVY, indices, &pool);
+            parallelTime = std::min(parallelTime, SecondsSince(start));
+        }
+
+        // tinyobj rounds decimals less accurately, so only the mesh layout has to match exactly
+        float maxError = 0.0f;
+        bool same = indices == refIndices && verticesUVX.size() == refVerticesUVX.size();
+        for (size_t i = 0; same && i < verticesUVX.size(); i++)
+            for (int c = 0; c < 4; c++)
+                maxError = std::max(maxError, std::max(fabsf(verticesUVX[i][c] - refVerticesUVX[i][c]), fabsf(normalsUVY[i][c] - refNormalsUVY[i][c])));
+
+        FILE* f = fopen(file.c_str(), "rb");
+        if (!f)
+        {
+            printf("Couldn't open %s\n", file.c_str());
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        double mb = ftell(f) / (1024.0 * 1024.0);
+        fclose(f);
+
+        printf("%-32s %10zu %8.1f %10.1fms %10.1fms %10.1fms %8.1f", file.c_str(), indices.size() / 3, mb, tinyObjTime * 1e3,
+            serialTime * 1e3, parallelTime * 1e3, parallelTime > 0.0 ? mb / parallelTime : 0.0);
+        if (same)
+            printf("  max diff %g\n", maxError);
+        else
+            printf("  differs from tinyobj\n");
+
+        totalTinyObj += tinyObjTime;
+        totalSerial += serialTime;
+        totalParallel += parallelTime;
+        totalMB += mb;
+    }
+    printf("%-32s %10s %8.1f %10.1fms %10.1fms %10.1fms (%d threads)\n", "Total", "", totalMB, totalTinyObj * 1e3,
+        totalSerial * 1e3, totalParallel * 1e3, pool.GetNumThreads());
+
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     srand((unsigned int)time(0));
 
     std::string sceneFile;
+    std::string outputFile = "output.png";
+    std::string statsFile;
+    bool headless = false;
+    bool denoise = false;
+    int maxSpp = 0;
+    float maxSeconds = 0.0f;
+    int bvhBenchRepeats = 0;
+    bool scalarBins = false;
+    int layoutBenchRepeats = 0;
+    int objBenchRepeats = 0;
+    std::string bundleFile;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -655,6 +968,62 @@ int main(int argc, char** argv)
         {
             sceneFile = argv[++i];
         }
+        else if (arg == "--cpu")
+        {
+            useCpuRenderer = true;
+        }
+        else if (arg == "--headless")
+        {
+            headless = true;
+        }
+        else if (arg == "-o" || arg == "--output")
+        {
+            outputFile = argv[++i];
+        }
+        else if (arg == "--stats-aov")
+        {
+            statsFile = argv[++i];
+        }
+        else if (arg == "--spp")
+        {
+            maxSpp = atoi(argv[++i]);
+        }
+        else if (arg == "--time")
+        {
+            maxSeconds = (float)atof(argv[++i]);
+        }
+        else if (arg == "--denoise")
+        {
+            denoise = true;
+        }
+        else if (arg == "--threads")
+        {
+            numThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--bvh-cache")
+        {
+            renderOptions.bvhCacheDirectory = argv[++i];
+        }
+        else if (arg == "--save-bundle")
+        {
+            bundleFile = argv[++i];
+        }
+        else if (arg == "--bench-bvh")
+        {
+            bvhBenchRepeats = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-layout")
+        {
+            layoutBenchRepeats = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--scalar-bins")
+        {
+            scalarBins = true;
+        }
+        else if (arg == "--bench-obj")
+        {
+            objBenchRepeats = std::max(1, atoi(argv[++i]));
+        }
         else if (arg[0] == '-')
         {
             printf("Unknown option %s \n'", arg.c_str());
@@ -662,22 +1031,87 @@ int main(int argc, char** argv)
         }
     }
 
+    // A single OBJ file is benchmarked without loading it as a scene
+    const std::string objExt = ".obj";
+    if (objBenchRepeats > 0 && sceneFile.size() > objExt.size() &&
+        sceneFile.compare(sceneFile.size() - objExt.size(), objExt.size(), objExt) == 0)
+        return BenchmarkObjLoad({ sceneFile }, objBenchRepeats, std::max(numThreads, 0));
+
+    auto loadStart = std::chrono::steady_clock::now();
+
+    // Options that run without a window and need a scene file
+    const char* batchOption = headless ? "--headless" : bvhBenchRepeats > 0 ? "--bench-bvh" :
+        layoutBenchRepeats > 0 ? "--bench-layout" : objBenchRepeats > 0 ? "--bench-obj" :
+        !bundleFile.empty() ? "--save-bundle" : nullptr;
+
     if (!sceneFile.empty())
     {
         scene = new Scene();
 
-        if (!LoadSceneFromFile(sceneFile, scene, renderOptions))
-            exit(0);
+        if (!LoadSceneFromFile(sceneFile, scene, renderOptions, numThreads))
+            exit(batchOption ? 1 : 0);
 
         scene->renderOptions = renderOptions;
         std::cout << "Scene Loaded\n\n";
     }
+    else if (batchOption)
+    {
+        printf("Error: %s requires a scene file (-s)\n", batchOption);
+        return 1;
+    }
     else
     {
         GetSceneFiles();
         LoadScene(sceneFiles[0]);
     }
 
+    if (!statsFile.empty())
+        scene->renderOptions.enableTraversalStats = renderOptions.enableTraversalStats = true;
+
+    // Bundles are written once, e.g. before a render farm job, and then loaded with -s file.bundle
+    if (!bundleFile.empty())
+    {
+        int ret = scene->SaveBundle(bundleFile) ? 0 : 1;
+        delete scene;
+        return ret;
+    }
+
+    if (bvhBenchRepeats > 0)
+    {
+        int ret = BenchmarkBvhBuild(bvhBenchRepeats, scalarBins);
+        delete scene;
+        return ret;
+    }
+
+    if (layoutBenchRepeats > 0)
+    {
+        int ret = BenchmarkBvhLayout(layoutBenchRepeats);
+        delete scene;
+        return ret;
+    }
+
+    if (objBenchRepeats > 0)
+    {
+        std::vector<std::string> files;
+        for (Mesh* mesh : scene->meshes)
+            files.push_back(mesh->name);
+        int ret = BenchmarkObjLoad(files, objBenchRepeats, scene->renderOptions.numThreads);
+        delete scene;
+        return ret;
+    }
+
+    if (headless)
+    {
+        // Without any limit render a fixed number of samples
+        if (maxSpp <= 0 && maxSeconds <= 0.0f)
+            maxSpp = 64;
+
+        int ret = RenderHeadless(outputFile, statsFile, maxSpp, maxSeconds, denoise, SecondsSince(loadStart));
+        delete renderer;
+        delete scene;
+        return ret;
+    }
+
     // Setup SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
     {
@@ -0,0 +1,224 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "BvhCache.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace GLSLPT
+{
+    // Bump whenever the OBJ loader or a BVH builder changes what it produces, older entries are then ignored
+    static const uint32_t kCacheVersion = 3;
+    static const char kCacheMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'B', 'C' };
+
+    // An entry is this header followed by the vertices, normals, triangle indices, packed nodes and packed indices
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        int32_t bvhBuilder;
+        uint64_t sourceHash;
+        int32_t maxLeafSize;
+        float leafCost;
+        int32_t numVertices;
+        int32_t numTriangles;
+        int32_t numNodes;
+        int32_t numIndices;
+    };
+
+    static_assert(sizeof(CacheHeader) == 48, "Entry data after the header stays 16 byte aligned");
+
+    static size_t EntrySize(const CacheHeader& header)
+    {
+        return sizeof(CacheHeader) + 2 * sizeof(Vec4) * (size_t)header.numVertices + 3 * sizeof(int) * (size_t)header.numTriangles +
+            sizeof(RadeonRays::Bvh::PackedNode) * (size_t)header.numNodes + sizeof(int) * (size_t)header.numIndices;
+    }
+
+    // Maps an entry and checks that it is complete and belongs to hash
+    static const CacheHeader* OpenEntry(MappedFile& file, const std::string& path, uint64_t hash)
+    {
+        if (!file.Open(path) || file.Size() < sizeof(CacheHeader))
+            return nullptr;
+
+        const CacheHeader* header = (const CacheHeader*)file.Data();
+        if (memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || header->version != kCacheVersion ||
+            header->sourceHash != hash || header->numVertices < 0 || header->numTriangles < 0 || header->numNodes < 0 || header->numIndices < 0 ||
+            file.Size() != EntrySize(*header))
+            return nullptr;
+
+        return header;
+    }
+
+    bool BvhCache::HashFile(const std::string& filename, uint64_t& hash)
+    {
+        MappedFile file;
+        if (!file.Open(filename))
+            return false;
+
+        // 64 bit words mixed into the hash with multiply and shift rounds, then the tail and the length
+        const char* data = file.Data();
+        size_t size = file.Size();
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            word *= 0xff51afd7ed558ccdull;
+            word ^= word >> 33;
+            h = (h ^ word) * 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 29;
+        }
+
+        for (; i < size; i++)
+            h = (h ^ (unsigned char)data[i]) * 0x100000001b3ull;
+
+        h = (h ^ size) * 0xc4ceb9fe1a85ec53ull;
+        hash = h ^ (h >> 32);
+        return true;
+    }
+
+    std::string BvhCache::EntryPath(const Mesh* mesh) const
+    {
+        // The BVH settings are mixed into the name as well, so scenes building the same file with different
+        // settings keep their own entries instead of replacing each other's
+        float leafCost = mesh->bvh->GetLeafCost();
+        uint32_t leafCostBits;
+        memcpy(&leafCostBits, &leafCost, sizeof(leafCostBits));
+        const uint64_t settings[3] = { (uint64_t)mesh->GetBvhBuilder(), (uint64_t)mesh->bvh->GetMaxLeafSize(), leafCostBits };
+
+        uint64_t h = mesh->sourceHash;
+        for (uint64_t word : settings)
+        {
+            h = (h ^ word * 0xff51afd7ed558ccdull) * 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 29;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)h);
+        return directory + "/" + name;
+    }
+
+    bool BvhCache::LoadVertices(Mesh* mesh) const
+    {
+        MappedFile file;
+        const CacheHeader* header = OpenEntry(file, EntryPath(mesh), mesh->sourceHash);
+        if (header == nullptr)
+            return false;
+
+        const Vec4* vertices = (const Vec4*)(header + 1);
+        const Vec4* normals = vertices + header->numVertices;
+        const int* indices = (const int*)(normals + header->numVertices);
+        for (int i = 0; i < 3 * header->numTriangles; i++)
+            if (indices[i] < 0 || indices[i] >= header->numVertices)
+                return false;
+
+        mesh->verticesUVX.assign(vertices, vertices + header->numVertices);
+        mesh->normalsUVY.assign(normals, normals + header->numVertices);
+        mesh->indices.assign(indices, indices + 3 * header->numTriangles);
+        return true;
+    }
+
+    bool BvhCache::LoadBVH(Mesh* mesh) const
+    {
+        MappedFile file;
+        const CacheHeader* header = OpenEntry(file, EntryPath(mesh), mesh->sourceHash);
+        if (header == nullptr || header->numNodes == 0 || header->numVertices != (int)mesh->verticesUVX.size() ||
+            header->numTriangles != mesh->NumTriangles() ||
+            header->bvhBuilder != mesh->GetBvhBuilder() || header->maxLeafSize != mesh->bvh->GetMaxLeafSize() ||
+            header->leafCost != mesh->bvh->GetLeafCost())
+            return false;
+
+        const Vec4* normals = (const Vec4*)(header + 1) + header->numVertices;
+        const int* triangles = (const int*)(normals + header->numVertices);
+        const RadeonRays::Bvh::PackedNode* nodes = (const RadeonRays::Bvh::PackedNode*)(triangles + 3 * header->numTriangles);
+        const int* indices = (const int*)(nodes + header->numNodes);
+        return mesh->bvh->Unpack(nodes, header->numNodes, indices, header->numIndices, header->numTriangles);
+    }
+
+    bool BvhCache::Store(const Mesh* mesh) const
+    {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+
+        std::vector<RadeonRays::Bvh::PackedNode> nodes;
+        mesh->bvh->Pack(nodes);
+
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+        header.version = kCacheVersion;
+        header.bvhBuilder = mesh->GetBvhBuilder();
+        header.sourceHash = mesh->sourceHash;
+        header.maxLeafSize = mesh->bvh->GetMaxLeafSize();
+        header.leafCost = mesh->bvh->GetLeafCost();
+        header.numVertices = (int)mesh->verticesUVX.size();
+        header.numTriangles = mesh->NumTriangles();
+        header.numNodes = (int)nodes.size();
+        header.numIndices = (int)mesh->bvh->GetNumIndices();
+
+        // Written next to the entry and renamed, so readers never see a partial entry. Meshes with the same
+        // contents may be stored at the same time, hence a temporary name per mesh
+        std::string path = EntryPath(mesh);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%p.tmp", (const void*)mesh);
+        std::string tmpPath = path + suffix;
+
+        FILE* file = fopen(tmpPath.c_str(), "wb");
+        if (!file)
+            return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(mesh->verticesUVX.data(), sizeof(Vec4), mesh->verticesUVX.size(), file) == mesh->verticesUVX.size();
+        ok = ok && fwrite(mesh->normalsUVY.data(), sizeof(Vec4), mesh->normalsUVY.size(), file) == mesh->normalsUVY.size();
+        ok = ok && fwrite(mesh->indices.data(), sizeof(int), mesh->indices.size(), file) == mesh->indices.size();
+        ok = ok && fwrite(nodes.data(), sizeof(nodes[0]), nodes.size(), file) == nodes.size();
+        ok = ok && fwrite(mesh->bvh->GetIndices(), sizeof(int), header.numIndices, file) == (size_t)header.numIndices;
+        ok = fclose(file) == 0 && ok;
+
+        // rename() does not replace an existing file everywhere
+        if (ok)
+        {
+            remove(path.c_str());
+            ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+        }
+        if (!ok)
+            remove(tmpPath.c_str());
+        return ok;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace GLSLPT
+{
+    class Mesh;
+
+    // On-disk cache of loaded meshes and their BLASes, so unchanged assets skip OBJ parsing and the BVH build.
+    // An entry is named after a hash of the source file contents and the mesh's builder and leaf settings. It holds
+    // the welded vertices, normals and triangle indices and the BVH built from them with those settings
+    class BvhCache
+    {
+    public:
+        explicit BvhCache(const std::string& directory) : directory(directory) {}
+
+        // Content hash of a source file, returns false if it cannot be read
+        static bool HashFile(const std::string& filename, uint64_t& hash);
+
+        // Fills the vertices, normals and indices of a mesh from the entry for its sourceHash and BVH settings.
+        // Returns false on a miss
+        bool LoadVertices(Mesh* mesh) const;
+        // Restores the BVH of a mesh if its entry was built with the mesh's current BVH settings
+        bool LoadBVH(Mesh* mesh) const;
+        // Writes the vertices, indices and built BVH of a mesh, replacing its entry for the same settings
+        bool Store(const Mesh* mesh) const;
+
+    private:
+        std::string EntryPath(const Mesh* mesh) const;
+
+        std::string directory;
+    };
+}
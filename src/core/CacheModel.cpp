@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "CacheModel.h"
+
+#include <algorithm>
+
+namespace GLSLPT
+{
+    CacheModel::CacheModel(size_t size, int ways, size_t lineSize)
+        : ways(ways)
+        , numSets(std::max<uint64_t>(size / lineSize / ways, 1))
+        , lineShift(0)
+    {
+        while (((size_t)1 << lineShift) < lineSize)
+            lineShift++;
+
+        tags.assign(numSets * ways, ~0ull);
+    }
+
+    void CacheModel::Reset()
+    {
+        std::fill(tags.begin(), tags.end(), ~0ull);
+        reads = 0;
+        misses = 0;
+    }
+
+    bool CacheModel::Access(uint64_t line)
+    {
+        uint64_t* set = &tags[(line % numSets) * ways];
+        reads++;
+
+        // Move the line to the front, an absent one pushes out the least recently used at the back
+        int way = 0;
+        while (way < ways - 1 && set[way] != line)
+            way++;
+
+        bool hit = set[way] == line;
+        std::move_backward(set, set + way, set + way + 1);
+        set[0] = line;
+
+        if (!hit)
+            misses++;
+        return hit;
+    }
+
+    int CacheModel::Read(const void* p, size_t bytes)
+    {
+        uint64_t first = (uint64_t)p >> lineShift;
+        uint64_t last = ((uint64_t)p + bytes - 1) >> lineShift;
+
+        int missed = 0;
+        for (uint64_t line = first; line <= last; line++)
+        {
+            if (!Access(line))
+                missed++;
+        }
+        return missed;
+    }
+}
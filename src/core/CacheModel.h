@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace GLSLPT
+{
+    // Set associative cache with LRU replacement, fed with the addresses a traversal reads instead of real
+    // memory. Counts how many of the lines read would have missed. With a line size of a page it models a TLB
+    class CacheModel
+    {
+    public:
+        CacheModel(size_t size, int ways, size_t lineSize);
+
+        // Reads every line of [p, p + bytes), returns how many of them missed
+        int Read(const void* p, size_t bytes);
+        void Reset();
+
+        uint64_t reads = 0;
+        uint64_t misses = 0;
+
+    private:
+        bool Access(uint64_t line);
+
+        std::vector<uint64_t> tags; // ways per set, most recently used first, ~0 is empty
+        int ways;
+        uint64_t numSets;
+        int lineShift;
+    };
+
+    // The data cache levels and the TLB of a typical desktop core, for comparing how node layouts use them
+    struct MemoryModel
+    {
+        MemoryModel()
+            : l1(32 * 1024, 8, 64)
+            , l2(1024 * 1024, 16, 64)
+            , tlb(64 * 4096, 4, 4096)
+        {
+        }
+
+        void Read(const void* p, size_t bytes)
+        {
+            tlb.Read(p, bytes);
+
+            // Only lines missing in L1 are read from L2
+            const uint64_t lineSize = 64;
+            uint64_t first = (uint64_t)p / lineSize;
+            uint64_t last = ((uint64_t)p + bytes - 1) / lineSize;
+            for (uint64_t line = first; line <= last; line++)
+            {
+                if (l1.Read((const void*)(line * lineSize), 1) != 0)
+                    l2.Read((const void*)(line * lineSize), 1);
+            }
+        }
+
+        void Reset()
+        {
+            l1.Reset();
+            l2.Reset();
+            tlb.Reset();
+        }
+
+        CacheModel l1;
+        CacheModel l2;
+        CacheModel tlb;
+    };
+}
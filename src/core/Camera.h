@@ -42,6 +42,8 @@ namespace GLSLPT
         void SetRadius(float dr);
         void ComputeViewProjectionMatrix(float* view, float* projection, float ratio);
         void SetFov(float val);
+        // Point the camera orbits around
+        Vec3 GetPivot() const { return pivot; }
 
         Vec3 position;
         Vec3 up;
@@ -0,0 +1,508 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* References:
+ * [1] https://media.disneyanimation.com/uploads/production/publication_asset/48/asset/s2012_pbs_disney_brdf_notes_v3.pdf
+ * [2] https://blog.selfshadow.com/publications/s2015-shading-course/burley/s2015_pbs_disney_bsdf_notes.pdf
+ * [3] https://github.com/wdas/brdf/blob/main/src/brdfs/disney.brdf
+ * [4] https://github.com/mmacklin/tinsel/blob/master/src/disney.h
+ */
+
+#include "CpuDisney.h"
+#include "Scene.h"
+
+namespace GLSLPT
+{
+    static const float kTwoPi = 6.28318530717958648f;
+    static const float kInvPi = 1.0f / PI;
+    static const float kInfinity = 1000000.0f;
+
+    static inline float Mix(float a, float b, float t) { return a * (1.0f - t) + b * t; }
+    static inline Vec3 Mix(const Vec3& a, const Vec3& b, float t) { return a * (1.0f - t) + b * t; }
+
+    static inline Vec3 Reflect(const Vec3& I, const Vec3& N)
+    {
+        return I - N * (2.0f * Vec3::Dot(N, I));
+    }
+
+    static inline Vec3 Refract(const Vec3& I, const Vec3& N, float eta)
+    {
+        float NDotI = Vec3::Dot(N, I);
+        float k = 1.0f - eta * eta * (1.0f - NDotI * NDotI);
+        if (k < 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+        return I * eta - N * (eta * NDotI + sqrtf(k));
+    }
+
+    //----------------------------------------------------------------------
+    static Vec3 ImportanceSampleGTR1(float rgh, float r1, float r2)
+    //----------------------------------------------------------------------
+    {
+        float a = std::max(0.001f, rgh);
+        float a2 = a * a;
+
+        float phi = r1 * kTwoPi;
+
+        float cosTheta = sqrtf((1.0f - powf(a2, 1.0f - r1)) / (1.0f - a2));
+        float sinTheta = Math::Clamp(sqrtf(1.0f - (cosTheta * cosTheta)), 0.0f, 1.0f);
+        float sinPhi = sinf(phi);
+        float cosPhi = cosf(phi);
+
+        return Vec3(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+    }
+
+    //----------------------------------------------------------------------
+    static Vec3 ImportanceSampleGTR2(float rgh, float r1, float r2)
+    //----------------------------------------------------------------------
+    {
+        float a = std::max(0.001f, rgh);
+
+        float phi = r1 * kTwoPi;
+
+        float cosTheta = sqrtf((1.0f - r2) / (1.0f + (a * a - 1.0f) * r2));
+        float sinTheta = Math::Clamp(sqrtf(1.0f - (cosTheta * cosTheta)), 0.0f, 1.0f);
+        float sinPhi = sinf(phi);
+        float cosPhi = cosf(phi);
+
+        return Vec3(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+    }
+
+    //-----------------------------------------------------------------------
+    static float SchlickFresnel(float u)
+    //-----------------------------------------------------------------------
+    {
+        float m = Math::Clamp(1.0f - u, 0.0f, 1.0f);
+        float m2 = m * m;
+        return m2 * m2 * m; // pow(m,5)
+    }
+
+    //-----------------------------------------------------------------------
+    static float DielectricFresnel(float cos_theta_i, float eta)
+    //-----------------------------------------------------------------------
+    {
+        float sinThetaTSq = eta * eta * (1.0f - cos_theta_i * cos_theta_i);
+
+        // Total internal reflection
+        if (sinThetaTSq > 1.0f)
+            return 1.0f;
+
+        float cos_theta_t = sqrtf(std::max(1.0f - sinThetaTSq, 0.0f));
+
+        float rs = (eta * cos_theta_t - cos_theta_i) / (eta * cos_theta_t + cos_theta_i);
+        float rp = (eta * cos_theta_i - cos_theta_t) / (eta * cos_theta_i + cos_theta_t);
+
+        return 0.5f * (rs * rs + rp * rp);
+    }
+
+    //-----------------------------------------------------------------------
+    static float GTR1(float NDotH, float a)
+    //-----------------------------------------------------------------------
+    {
+        if (a >= 1.0f)
+            return kInvPi;
+        float a2 = a * a;
+        float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+        return (a2 - 1.0f) / (PI * logf(a2) * t);
+    }
+
+    //-----------------------------------------------------------------------
+    static float GTR2(float NDotH, float a)
+    //-----------------------------------------------------------------------
+    {
+        float a2 = a * a;
+        float t = 1.0f + (a2 - 1.0f) * NDotH * NDotH;
+        return a2 / (PI * t * t);
+    }
+
+    //-----------------------------------------------------------------------
+    static float SmithG_GGX(float NDotV, float alphaG)
+    //-----------------------------------------------------------------------
+    {
+        float a = alphaG * alphaG;
+        float b = NDotV * NDotV;
+        return 1.0f / (NDotV + sqrtf(a + b - a * b));
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 CosineSampleHemisphere(float r1, float r2)
+    //-----------------------------------------------------------------------
+    {
+        Vec3 dir;
+        float r = sqrtf(r1);
+        float phi = kTwoPi * r2;
+        dir.x = r * cosf(phi);
+        dir.y = r * sinf(phi);
+        dir.z = sqrtf(std::max(0.0f, 1.0f - dir.x * dir.x - dir.y * dir.y));
+
+        return dir;
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 UniformSampleHemisphere(float r1, float r2)
+    //-----------------------------------------------------------------------
+    {
+        float r = sqrtf(std::max(0.0f, 1.0f - r1 * r1));
+        float phi = kTwoPi * r2;
+
+        return Vec3(r * cosf(phi), r * sinf(phi), r1);
+    }
+
+    //-----------------------------------------------------------------------
+    float PowerHeuristic(float a, float b)
+    //-----------------------------------------------------------------------
+    {
+        float t = a * a;
+        return t / (b * b + t);
+    }
+
+    //-----------------------------------------------------------------------
+    static void SampleSphereLight(const Light& light, const Vec3& surfacePos, int numOfLights, Rng& rng, LightSampleRec& lightSampleRec)
+    //-----------------------------------------------------------------------
+    {
+        float r1 = rng.Next();
+        float r2 = rng.Next();
+
+        Vec3 sphereCentertoSurface = surfacePos - light.position;
+        float distToSphereCenter = Vec3::Length(sphereCentertoSurface);
+        Vec3 sampledDir;
+
+        // TODO: Fix this. Currently assumes the light will be hit only from the outside
+        sphereCentertoSurface = sphereCentertoSurface / distToSphereCenter;
+        sampledDir = UniformSampleHemisphere(r1, r2);
+        Vec3 T, B;
+        Onb(sphereCentertoSurface, T, B);
+        sampledDir = T * sampledDir.x + B * sampledDir.y + sphereCentertoSurface * sampledDir.z;
+
+        Vec3 lightSurfacePos = light.position + sampledDir * light.radius;
+
+        lightSampleRec.direction = lightSurfacePos - surfacePos;
+        lightSampleRec.dist = Vec3::Length(lightSampleRec.direction);
+        float distSq = lightSampleRec.dist * lightSampleRec.dist;
+
+        lightSampleRec.direction = lightSampleRec.direction / lightSampleRec.dist;
+        lightSampleRec.normal = Vec3::Normalize(lightSurfacePos - light.position);
+        lightSampleRec.emission = light.emission * float(numOfLights);
+        lightSampleRec.pdf = distSq / (light.area * 0.5f * fabs(Vec3::Dot(lightSampleRec.normal, lightSampleRec.direction)));
+    }
+
+    //-----------------------------------------------------------------------
+    static void SampleRectLight(const Light& light, const Vec3& surfacePos, int numOfLights, Rng& rng, LightSampleRec& lightSampleRec)
+    //-----------------------------------------------------------------------
+    {
+        float r1 = rng.Next();
+        float r2 = rng.Next();
+
+        Vec3 lightSurfacePos = light.position + light.u * r1 + light.v * r2;
+        lightSampleRec.direction = lightSurfacePos - surfacePos;
+        lightSampleRec.dist = Vec3::Length(lightSampleRec.direction);
+        float distSq = lightSampleRec.dist * lightSampleRec.dist;
+        lightSampleRec.direction = lightSampleRec.direction / lightSampleRec.dist;
+        lightSampleRec.normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+        lightSampleRec.emission = light.emission * float(numOfLights);
+        lightSampleRec.pdf = distSq / (light.area * fabs(Vec3::Dot(lightSampleRec.normal, lightSampleRec.direction)));
+    }
+
+    //-----------------------------------------------------------------------
+    static void SampleDistantLight(const Light& light, const Vec3& surfacePos, int numOfLights, LightSampleRec& lightSampleRec)
+    //-----------------------------------------------------------------------
+    {
+        lightSampleRec.direction = Vec3::Normalize(light.position);
+        lightSampleRec.normal = Vec3::Normalize(surfacePos - light.position);
+        lightSampleRec.emission = light.emission * float(numOfLights);
+        lightSampleRec.dist = kInfinity;
+        lightSampleRec.pdf = 1.0f;
+    }
+
+    //-----------------------------------------------------------------------
+    void SampleOneLight(const Light& light, const Vec3& surfacePos, int numOfLights, Rng& rng, LightSampleRec& lightSampleRec)
+    //-----------------------------------------------------------------------
+    {
+        int type = int(light.type);
+
+        if (type == LightType::RectLight)
+            SampleRectLight(light, surfacePos, numOfLights, rng, lightSampleRec);
+        else if (type == LightType::SphereLight)
+            SampleSphereLight(light, surfacePos, numOfLights, rng, lightSampleRec);
+        else
+            SampleDistantLight(light, surfacePos, numOfLights, lightSampleRec);
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 EvalDielectricReflection(const State& state, const Vec3& V, const Vec3& N, const Vec3& L, const Vec3& H, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        if (Vec3::Dot(N, L) <= 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+
+        float F = DielectricFresnel(Vec3::Dot(V, H), state.eta);
+        float D = GTR2(Vec3::Dot(N, H), state.mat.roughness);
+
+        pdf = D * Vec3::Dot(N, H) * F / (4.0f * fabs(Vec3::Dot(V, H)));
+
+        float G = SmithG_GGX(fabs(Vec3::Dot(N, L)), state.mat.roughness) * SmithG_GGX(fabs(Vec3::Dot(N, V)), state.mat.roughness);
+        return state.mat.albedo * (F * D * G);
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 EvalDielectricRefraction(const State& state, const Vec3& V, const Vec3& N, const Vec3& L, const Vec3& H, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        if (Vec3::Dot(N, L) >= 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+
+        float F = DielectricFresnel(fabs(Vec3::Dot(V, H)), state.eta);
+        float D = GTR2(Vec3::Dot(N, H), state.mat.roughness);
+
+        float denomSqrt = Vec3::Dot(L, H) + Vec3::Dot(V, H) * state.eta;
+        pdf = D * Vec3::Dot(N, H) * (1.0f - F) * fabs(Vec3::Dot(L, H)) / (denomSqrt * denomSqrt);
+
+        float G = SmithG_GGX(fabs(Vec3::Dot(N, L)), state.mat.roughness) * SmithG_GGX(fabs(Vec3::Dot(N, V)), state.mat.roughness);
+        return state.mat.albedo * ((1.0f - F) * D * G * fabs(Vec3::Dot(V, H)) * fabs(Vec3::Dot(L, H)) * 4.0f * state.eta * state.eta / (denomSqrt * denomSqrt));
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 EvalSpecular(const State& state, const Vec3& Cspec0, const Vec3& V, const Vec3& N, const Vec3& L, const Vec3& H, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        if (Vec3::Dot(N, L) <= 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+
+        float D = GTR2(Vec3::Dot(N, H), state.mat.roughness);
+        pdf = D * Vec3::Dot(N, H) / (4.0f * Vec3::Dot(V, H));
+
+        float FH = SchlickFresnel(Vec3::Dot(L, H));
+        Vec3 F = Mix(Cspec0, Vec3(1.0f, 1.0f, 1.0f), FH);
+        float G = SmithG_GGX(fabs(Vec3::Dot(N, L)), state.mat.roughness) * SmithG_GGX(fabs(Vec3::Dot(N, V)), state.mat.roughness);
+        return F * (D * G);
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 EvalClearcoat(const State& state, const Vec3& V, const Vec3& N, const Vec3& L, const Vec3& H, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        if (Vec3::Dot(N, L) <= 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+
+        float D = GTR1(Vec3::Dot(N, H), Mix(0.1f, 0.001f, state.mat.clearcoatGloss));
+        pdf = D * Vec3::Dot(N, H) / (4.0f * Vec3::Dot(V, H));
+
+        float FH = SchlickFresnel(Vec3::Dot(L, H));
+        float F = Mix(0.04f, 1.0f, FH);
+        float G = SmithG_GGX(Vec3::Dot(N, L), 0.25f) * SmithG_GGX(Vec3::Dot(N, V), 0.25f);
+        float c = 0.25f * state.mat.clearcoat * F * D * G;
+        return Vec3(c, c, c);
+    }
+
+    //-----------------------------------------------------------------------
+    static Vec3 EvalDiffuse(const State& state, const Vec3& Csheen, const Vec3& V, const Vec3& N, const Vec3& L, const Vec3& H, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        if (Vec3::Dot(N, L) <= 0.0f)
+            return Vec3(0.0f, 0.0f, 0.0f);
+
+        pdf = Vec3::Dot(N, L) * kInvPi;
+
+        // Diffuse
+        float FL = SchlickFresnel(Vec3::Dot(N, L));
+        float FV = SchlickFresnel(Vec3::Dot(N, V));
+        float FH = SchlickFresnel(Vec3::Dot(L, H));
+        float Fd90 = 0.5f + 2.0f * Vec3::Dot(L, H) * Vec3::Dot(L, H) * state.mat.roughness;
+        float Fd = Mix(1.0f, Fd90, FL) * Mix(1.0f, Fd90, FV);
+
+        // Fake Subsurface TODO: Replace with volumetric scattering
+        float Fss90 = Vec3::Dot(L, H) * Vec3::Dot(L, H) * state.mat.roughness;
+        float Fss = Mix(1.0f, Fss90, FL) * Mix(1.0f, Fss90, FV);
+        float ss = 1.25f * (Fss * (1.0f / (Vec3::Dot(N, L) + Vec3::Dot(N, V)) - 0.5f) + 0.5f);
+
+        Vec3 Fsheen = Csheen * (FH * state.mat.sheen);
+        return (state.mat.albedo * (kInvPi * Mix(Fd, ss, state.mat.subsurface)) + Fsheen) * (1.0f - state.mat.metallic);
+    }
+
+    // Tint colors shared by DisneySample and DisneyEval
+    static void GetSpecularColors(const State& state, Vec3& Cspec0, Vec3& Csheen)
+    {
+        Vec3 Cdlin = state.mat.albedo;
+        float Cdlum = 0.3f * Cdlin.x + 0.6f * Cdlin.y + 0.1f * Cdlin.z; // luminance approx.
+
+        Vec3 Ctint = Cdlum > 0.0f ? Cdlin / Cdlum : Vec3(1.0f, 1.0f, 1.0f); // normalize lum. to isolate hue+sat
+        Cspec0 = Mix(Mix(Vec3(1.0f, 1.0f, 1.0f), Ctint, state.mat.specularTint) * (state.mat.specular * 0.08f), Cdlin, state.mat.metallic);
+        Csheen = Mix(Vec3(1.0f, 1.0f, 1.0f), Ctint, state.mat.sheenTint);
+    }
+
+    //-----------------------------------------------------------------------
+    Vec3 DisneySample(State& state, const Vec3& V, const Vec3& N, Vec3& L, float& pdf, Rng& rng)
+    //-----------------------------------------------------------------------
+    {
+        pdf = 0.0f;
+        Vec3 f = Vec3(0.0f, 0.0f, 0.0f);
+
+        float r1 = rng.Next();
+        float r2 = rng.Next();
+
+        float diffuseRatio = 0.5f * (1.0f - state.mat.metallic);
+        float transWeight = (1.0f - state.mat.metallic) * state.mat.transmission;
+
+        Vec3 Cspec0, Csheen;
+        GetSpecularColors(state, Cspec0, Csheen);
+
+        // TODO: Reuse random numbers and reduce so many calls to rand()
+        if (rng.Next() < transWeight)
+        {
+            Vec3 H = ImportanceSampleGTR2(state.mat.roughness, r1, r2);
+            H = state.tangent * H.x + state.bitangent * H.y + N * H.z;
+
+            if (Vec3::Dot(V, H) < 0.0f)
+                H = -H;
+
+            Vec3 R = Reflect(-V, H);
+            float F = DielectricFresnel(fabs(Vec3::Dot(R, H)), state.eta);
+
+            // Reflection/Total internal reflection
+            if (rng.Next() < F)
+            {
+                L = Vec3::Normalize(R);
+                f = EvalDielectricReflection(state, V, N, L, H, pdf);
+            }
+            else // Transmission
+            {
+                L = Vec3::Normalize(Refract(-V, H, state.eta));
+                f = EvalDielectricRefraction(state, V, N, L, H, pdf);
+            }
+
+            f *= transWeight;
+            pdf *= transWeight;
+        }
+        else
+        {
+            if (rng.Next() < diffuseRatio)
+            {
+                L = CosineSampleHemisphere(r1, r2);
+                L = state.tangent * L.x + state.bitangent * L.y + N * L.z;
+
+                Vec3 H = Vec3::Normalize(L + V);
+
+                f = EvalDiffuse(state, Csheen, V, N, L, H, pdf);
+                pdf *= diffuseRatio;
+            }
+            else // Specular
+            {
+                float primarySpecRatio = 1.0f / (1.0f + state.mat.clearcoat);
+
+                // Sample primary specular lobe
+                if (rng.Next() < primarySpecRatio)
+                {
+                    Vec3 H = ImportanceSampleGTR2(state.mat.roughness, r1, r2);
+                    H = state.tangent * H.x + state.bitangent * H.y + N * H.z;
+
+                    if (Vec3::Dot(V, H) < 0.0f)
+                        H = -H;
+
+                    L = Vec3::Normalize(Reflect(-V, H));
+
+                    f = EvalSpecular(state, Cspec0, V, N, L, H, pdf);
+                    pdf *= primarySpecRatio * (1.0f - diffuseRatio);
+                }
+                else // Sample clearcoat lobe
+                {
+                    Vec3 H = ImportanceSampleGTR1(Mix(0.1f, 0.001f, state.mat.clearcoatGloss), r1, r2);
+                    H = state.tangent * H.x + state.bitangent * H.y + N * H.z;
+
+                    if (Vec3::Dot(V, H) < 0.0f)
+                        H = -H;
+
+                    L = Vec3::Normalize(Reflect(-V, H));
+
+                    f = EvalClearcoat(state, V, N, L, H, pdf);
+                    pdf *= (1.0f - primarySpecRatio) * (1.0f - diffuseRatio);
+                }
+            }
+
+            f *= (1.0f - transWeight);
+            pdf *= (1.0f - transWeight);
+        }
+        return f;
+    }
+
+    //-----------------------------------------------------------------------
+    Vec3 DisneyEval(const State& state, const Vec3& V, const Vec3& N, const Vec3& L, float& pdf)
+    //-----------------------------------------------------------------------
+    {
+        Vec3 H;
+        bool refl = Vec3::Dot(N, L) > 0.0f;
+
+        if (refl)
+            H = Vec3::Normalize(L + V);
+        else
+            H = Vec3::Normalize(L + V * state.eta);
+
+        if (Vec3::Dot(V, H) < 0.0f)
+            H = -H;
+
+        float diffuseRatio = 0.5f * (1.0f - state.mat.metallic);
+        float primarySpecRatio = 1.0f / (1.0f + state.mat.clearcoat);
+        float transWeight = (1.0f - state.mat.metallic) * state.mat.transmission;
+
+        Vec3 brdf = Vec3(0.0f, 0.0f, 0.0f);
+        Vec3 bsdf = Vec3(0.0f, 0.0f, 0.0f);
+        float brdfPdf = 0.0f;
+        float bsdfPdf = 0.0f;
+
+        if (transWeight > 0.0f)
+        {
+            // Reflection
+            if (refl)
+                bsdf = EvalDielectricReflection(state, V, N, L, H, bsdfPdf);
+            else // Transmission
+                bsdf = EvalDielectricRefraction(state, V, N, L, H, bsdfPdf);
+        }
+
+        float m_pdf;
+
+        if (transWeight < 1.0f)
+        {
+            Vec3 Cspec0, Csheen;
+            GetSpecularColors(state, Cspec0, Csheen);
+
+            // Diffuse
+            brdf += EvalDiffuse(state, Csheen, V, N, L, H, m_pdf);
+            brdfPdf += m_pdf * diffuseRatio;
+
+            // Specular
+            brdf += EvalSpecular(state, Cspec0, V, N, L, H, m_pdf);
+            brdfPdf += m_pdf * primarySpecRatio * (1.0f - diffuseRatio);
+
+            // Clearcoat
+            brdf += EvalClearcoat(state, V, N, L, H, m_pdf);
+            brdfPdf += m_pdf * (1.0f - primarySpecRatio) * (1.0f - diffuseRatio);
+        }
+
+        pdf = Mix(brdfPdf, bsdfPdf, transWeight);
+        return Mix(brdf, bsdf, transWeight);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "CpuTracer.h"
+
+namespace GLSLPT
+{
+    struct Light;
+
+    // pcg4d generator from shaders/common/globals.glsl. Seeded the same way as InitRNG() so
+    // that a pixel gets the same random sequence on both backends
+    struct Rng
+    {
+        void Init(int x, int y, int frame)
+        {
+            s[0] = uint32_t(x);
+            s[1] = uint32_t(y);
+            s[2] = uint32_t(frame);
+            s[3] = uint32_t(x) + uint32_t(y);
+        }
+
+        float Next()
+        {
+            s[0] = s[0] * 1664525u + 1013904223u;
+            s[1] = s[1] * 1664525u + 1013904223u;
+            s[2] = s[2] * 1664525u + 1013904223u;
+            s[3] = s[3] * 1664525u + 1013904223u;
+
+            s[0] += s[1] * s[3]; s[1] += s[2] * s[0]; s[2] += s[0] * s[1]; s[3] += s[1] * s[2];
+            s[0] ^= s[0] >> 16u; s[1] ^= s[1] >> 16u; s[2] ^= s[2] >> 16u; s[3] ^= s[3] >> 16u;
+            s[0] += s[1] * s[3]; s[1] += s[2] * s[0]; s[2] += s[0] * s[1]; s[3] += s[1] * s[2];
+
+            return float(s[0]) / float(0xffffffffu);
+        }
+
+        uint32_t s[4];
+    };
+
+    // Port of shaders/common/sampling.glsl
+    float PowerHeuristic(float a, float b);
+    void SampleOneLight(const Light& light, const Vec3& surfacePos, int numOfLights, Rng& rng, LightSampleRec& lightSampleRec);
+
+    // Port of shaders/common/disney.glsl
+    Vec3 DisneySample(State& state, const Vec3& V, const Vec3& N, Vec3& L, float& pdf, Rng& rng);
+    Vec3 DisneyEval(const State& state, const Vec3& V, const Vec3& N, const Vec3& L, float& pdf);
+}
@@ -0,0 +1,818 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Config.h"
+#include "CpuRenderer.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "OpenImageDenoise/oidn.hpp"
+
+#include <cstring>
+
+namespace GLSLPT
+{
+    static const float kTwoPi = 6.28318530717958648f;
+    static const float kInfinity = 1000000.0f;
+    static const float kEps = 0.001f;
+
+    static const int kPacketWidth = 4;
+    static const int kPacketHeight = 2;
+
+    static inline int WrapRepeat(int i, int n)
+    {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    CpuRenderer::CpuRenderer(Scene *scene, const std::string& shadersDirectory) : Renderer(scene, shadersDirectory)
+        , tracer(nullptr)
+        , outputTexture(0)
+        , denoisedTexture(0)
+        , tileWidth(scene->renderOptions.tileWidth)
+        , tileHeight(scene->renderOptions.tileHeight)
+        , numTiles(0, 0)
+        , sampleCounter(0)
+        , denoised(false)
+        , statRays(0)
+        , statNodeVisits(0)
+        , statTriTests(0)
+        , statNodeBytes(0)
+    {
+    }
+
+    CpuRenderer::~CpuRenderer()
+    {
+        // Renderer::~Renderer only knows about the GL resources of the base class
+        Finish();
+    }
+
+    void CpuRenderer::Init()
+    {
+        if (initialized)
+            return;
+
+        if (scene == nullptr)
+        {
+            printf("Error: No Scene Found\n");
+            return;
+        }
+
+        tracer = new CpuTracer(scene, scene->renderOptions.bvhWidth);
+
+        numTiles.x = ceil((float)screenSize.x / tileWidth);
+        numTiles.y = ceil((float)screenSize.y / tileHeight);
+
+        // One tile queue per thread of the pool the scene was loaded with
+        scheduler.Init(numTiles, scene->renderOptions.tileOrder, scene->GetWorkerPool()->GetNumThreads());
+
+        accumBuffer.assign(screenSize.x * screenSize.y, Vec3());
+        statsBuffer.assign(scene->renderOptions.enableTraversalStats ? screenSize.x * screenSize.y : 0, Vec3());
+        sampleCounter = 0;
+        denoised = false;
+
+        printf("Screen Resolution : %d %d\n", screenSize.x, screenSize.y);
+        printf("CPU Threads : %d\n", scheduler.GetNumThreads());
+        printf("CPU BVH Width : %d\n", tracer->GetBvhWidth());
+
+        initialized = true;
+    }
+
+    void CpuRenderer::Finish()
+    {
+        if (!initialized)
+            return;
+
+        delete tracer;
+        tracer = nullptr;
+
+        if (outputTexture != 0)
+            glDeleteTextures(1, &outputTexture);
+        if (denoisedTexture != 0)
+            glDeleteTextures(1, &denoisedTexture);
+        outputTexture = denoisedTexture = 0;
+
+        accumBuffer.clear();
+        denoisedBuffer.clear();
+        statsBuffer.clear();
+        displayBuffer.clear();
+
+        initialized = false;
+        printf("CPU Renderer finished!\n");
+    }
+
+    void CpuRenderer::Render()
+    {
+        if (!initialized)
+        {
+            printf("CPU Renderer is not initialized\n");
+            return;
+        }
+
+        // Renders one sample for every pixel
+        int frame = sampleCounter + 1;
+        scheduler.Run([this, frame](const iVec2& tile) { RenderTile(tile, frame); }, scene->GetWorkerPool());
+        sampleCounter++;
+        denoised = false;
+
+        scene->instancesModified = false;
+    }
+
+    void CpuRenderer::RenderTile(const iVec2& tile, int frame)
+    {
+        int xStart = tile.x * tileWidth;
+        int yStart = tile.y * tileHeight;
+        int xEnd = std::min(xStart + tileWidth, screenSize.x);
+        int yEnd = std::min(yStart + tileHeight, screenSize.y);
+
+        // The rays of a packet can't be told apart in the per pixel stats
+        bool pixelStats = !statsBuffer.empty();
+        bool usePackets = scene->renderOptions.enableRayPackets && scene->renderOptions.maxDepth > 0 && !pixelStats;
+
+        TraceStats stats;
+
+        // Pixel blocks of kPacketWidth x kPacketHeight share a ray packet for the first bounce
+        for (int y = yStart; y < yEnd; y += kPacketHeight)
+        {
+            for (int x = xStart; x < xEnd; x += kPacketWidth)
+            {
+                PathState paths[CpuTracer::kPacketSize];
+                iVec2 pixels[CpuTracer::kPacketSize];
+                int count = 0;
+
+                for (int py = y; py < std::min(y + kPacketHeight, yEnd); py++)
+                {
+                    for (int px = x; px < std::min(x + kPacketWidth, xEnd); px++)
+                    {
+                        pixels[count] = iVec2(px, py);
+                        GeneratePath(paths[count++], px, py, frame);
+                    }
+                }
+
+                if (usePackets)
+                    PathTracePacket(paths, count, stats);
+                else
+                {
+                    for (int i = 0; i < count; i++)
+                    {
+                        TraceStats before = stats;
+                        PathTrace(paths[i], stats);
+
+                        if (pixelStats)
+                            statsBuffer[pixels[i].y * screenSize.x + pixels[i].x] += Vec3(float(stats.nodeVisits - before.nodeVisits),
+                                float(stats.triTests - before.triTests), float(stats.rays - before.rays));
+                    }
+                }
+
+                for (int i = 0; i < count; i++)
+                    accumBuffer[pixels[i].y * screenSize.x + pixels[i].x] += paths[i].radiance;
+            }
+        }
+
+        statRays += stats.rays;
+        statNodeVisits += stats.nodeVisits;
+        statTriTests += stats.triTests;
+        statNodeBytes += stats.nodeBytes;
+    }
+
+    void CpuRenderer::GeneratePath(PathState& path, int x, int y, int frame) const
+    {
+        const Camera* camera = scene->camera;
+        float scale = tanf(camera->fov * 0.5f);
+        float aspect = float(screenSize.y) / float(screenSize.x);
+
+        Rng& rng = path.rng;
+        rng.Init(x, y, frame);
+
+        // Tent filter, same as tiled.glsl
+        float r1 = 2.0f * rng.Next();
+        float r2 = 2.0f * rng.Next();
+
+        Vec2 jitter;
+        jitter.x = r1 < 1.0f ? sqrtf(r1) - 1.0f : 1.0f - sqrtf(2.0f - r1);
+        jitter.y = r2 < 1.0f ? sqrtf(r2) - 1.0f : 1.0f - sqrtf(2.0f - r2);
+
+        jitter.x /= (screenSize.x * 0.5f);
+        jitter.y /= (screenSize.y * 0.5f);
+
+        Vec2 d;
+        d.x = ((x + 0.5f) / screenSize.x) * 2.0f - 1.0f + jitter.x;
+        d.y = ((y + 0.5f) / screenSize.y) * 2.0f - 1.0f + jitter.y;
+
+        d.y *= aspect * scale;
+        d.x *= scale;
+        Vec3 rayDir = Vec3::Normalize(camera->right * d.x + camera->up * d.y + camera->forward);
+
+        Vec3 focalPoint = rayDir * camera->focalDist;
+        float cam_r1 = rng.Next() * kTwoPi;
+        float cam_r2 = rng.Next() * camera->aperture;
+        Vec3 randomAperturePos = (camera->right * cosf(cam_r1) + camera->up * sinf(cam_r1)) * sqrtf(cam_r2);
+        Vec3 finalRayDir = Vec3::Normalize(focalPoint - randomAperturePos);
+
+        path.ray = Ray(camera->position + randomAperturePos, finalRayDir);
+        path.radiance = Vec3();
+        path.throughput = Vec3(1.0f, 1.0f, 1.0f);
+        path.absorption = Vec3();
+        path.state.isEmitter = false;
+        path.state.matID = 0;
+        path.bsdfSampleRec.pdf = 0.0f;
+        path.depth = 0;
+    }
+
+    //-----------------------------------------------------------------------
+    void CpuRenderer::GetMaterials(State& state, const Ray& r) const
+    //-----------------------------------------------------------------------
+    {
+        Material mat = scene->materials[state.matID];
+        mat.roughness = std::max(mat.roughness, 0.001f);
+
+        Vec2 texUV = state.texCoord;
+        texUV.y = 1.0f - texUV.y;
+
+        // Albedo Map
+        if (int(mat.albedoTexID) >= 0)
+        {
+            Vec3 albedo = SampleTexture(int(mat.albedoTexID), texUV);
+            mat.albedo *= Vec3(powf(albedo.x, 2.2f), powf(albedo.y, 2.2f), powf(albedo.z, 2.2f));
+        }
+
+        // Metallic Roughness Map
+        if (int(mat.metallicRoughnessTexID) >= 0)
+        {
+            // TODO: Change metallic roughness maps in repo to linear space and remove gamma correction
+            Vec3 matRgh = SampleTexture(int(mat.metallicRoughnessTexID), texUV);
+            mat.metallic = powf(matRgh.x, 2.2f);
+            mat.roughness = std::max(powf(matRgh.y, 2.2f), 0.001f);
+        }
+
+        // Normal Map
+        if (int(mat.normalmapTexID) >= 0)
+        {
+            Vec3 nrm = SampleTexture(int(mat.normalmapTexID), texUV);
+            nrm = Vec3::Normalize(nrm * 2.0f - Vec3(1.0f, 1.0f, 1.0f));
+
+            Vec3 T, B;
+            Onb(state.normal, T, B);
+
+            nrm = T * nrm.x + B * nrm.y + state.normal * nrm.z;
+            state.normal = Vec3::Normalize(nrm);
+            state.ffnormal = Vec3::Dot(state.normal, r.direction) <= 0.0f ? state.normal : state.normal * -1.0f;
+
+            Onb(state.normal, state.tangent, state.bitangent);
+        }
+
+        state.mat = mat;
+        state.eta = Vec3::Dot(state.normal, state.ffnormal) > 0.0f ? (1.0f / mat.ior) : mat.ior;
+    }
+
+    //-----------------------------------------------------------------------
+    void CpuRenderer::SampleDirectLight(PathState& path, DirectLightSample& direct) const
+    //-----------------------------------------------------------------------
+    {
+        const Ray& r = path.ray;
+        const State& state = path.state;
+        Rng& rng = path.rng;
+
+        Vec3 surfacePos = state.fhp + state.normal * kEps;
+
+        BsdfSampleRec bsdfSampleRec;
+
+        direct.valid[0] = direct.valid[1] = false;
+
+        // Environment Light
+        if (scene->renderOptions.useEnvMap && scene->hdrData != nullptr && !scene->renderOptions.useConstantBg)
+        {
+            Vec3 color;
+            float lightPdf;
+            Vec3 lightDir = EnvSample(color, lightPdf, rng);
+
+            bsdfSampleRec.f = DisneyEval(state, -r.direction, state.ffnormal, lightDir, bsdfSampleRec.pdf);
+
+            if (bsdfSampleRec.pdf > 0.0f)
+            {
+                float misWeight = PowerHeuristic(lightPdf, bsdfSampleRec.pdf);
+                if (misWeight > 0.0f)
+                {
+                    direct.shadowRays[0] = Ray(surfacePos, lightDir);
+                    direct.maxDists[0] = kInfinity - kEps;
+                    direct.Li[0] = bsdfSampleRec.f * color * (misWeight * fabs(Vec3::Dot(lightDir, state.ffnormal)) / lightPdf);
+                    direct.valid[0] = true;
+                }
+            }
+        }
+
+        // Analytic Lights
+        if (!scene->lights.empty())
+        {
+            LightSampleRec lightSampleRec;
+            int numOfLights = (int)scene->lights.size();
+
+            //Pick a light to sample
+            int index = std::min(int(rng.Next() * float(numOfLights)), numOfLights - 1);
+            const Light& light = scene->lights[index];
+
+            SampleOneLight(light, surfacePos, numOfLights, rng, lightSampleRec);
+
+            if (Vec3::Dot(lightSampleRec.direction, lightSampleRec.normal) < 0.0f) // Required for quad lights with single sided emission
+            {
+                bsdfSampleRec.f = DisneyEval(state, -r.direction, state.ffnormal, lightSampleRec.direction, bsdfSampleRec.pdf);
+
+                float weight = 1.0f;
+                if (light.area > 0.0f) // No MIS for distant light
+                    weight = PowerHeuristic(lightSampleRec.pdf, bsdfSampleRec.pdf);
+
+                if (bsdfSampleRec.pdf > 0.0f)
+                {
+                    direct.shadowRays[1] = Ray(surfacePos, lightSampleRec.direction);
+                    direct.maxDists[1] = lightSampleRec.dist - kEps;
+                    direct.Li[1] = bsdfSampleRec.f * lightSampleRec.emission * (weight * fabs(Vec3::Dot(state.ffnormal, lightSampleRec.direction)) / lightSampleRec.pdf);
+                    direct.valid[1] = true;
+                }
+            }
+        }
+    }
+
+    //-----------------------------------------------------------------------
+    bool CpuRenderer::ShadeHit(PathState& path, bool hit) const
+    //-----------------------------------------------------------------------
+    {
+        const RenderOptions& options = scene->renderOptions;
+        const Ray& r = path.ray;
+        State& state = path.state;
+
+        if (!hit)
+        {
+            if (options.useConstantBg)
+                path.radiance += options.bgColor * path.throughput;
+            else if (options.useEnvMap && scene->hdrData != nullptr)
+            {
+                float misWeight = 1.0f;
+                float u = (PI + atan2f(r.direction.z, r.direction.x)) * (1.0f / kTwoPi);
+                float v = acosf(r.direction.y) * (1.0f / PI);
+
+                if (path.depth > 0)
+                {
+                    // TODO: Fix NaNs when using certain HDRs
+                    float lightPdf = EnvPdf(r);
+                    misWeight = PowerHeuristic(path.bsdfSampleRec.pdf, lightPdf);
+                }
+                path.radiance += SampleHDR(u, v) * path.throughput * (misWeight * options.hdrMultiplier);
+            }
+            return false;
+        }
+
+        // Lights have no material, matID still belongs to the previous surface or is unset for camera rays
+        if (state.isEmitter)
+        {
+            Vec3 Le;
+            if (state.depth == 0)
+                Le = path.lightSampleRec.emission;
+            else
+                Le = path.lightSampleRec.emission * PowerHeuristic(path.bsdfSampleRec.pdf, path.lightSampleRec.pdf);
+
+            path.radiance += Le * path.throughput;
+            return false;
+        }
+
+        GetMaterials(state, r);
+
+        // Reset absorption when ray is going out of surface
+        if (Vec3::Dot(state.normal, state.ffnormal) > 0.0f)
+            path.absorption = Vec3();
+
+        path.radiance += state.mat.emission * path.throughput;
+
+        // Add absoption
+        path.throughput *= Vec3(expf(-path.absorption.x * state.hitDist), expf(-path.absorption.y * state.hitDist), expf(-path.absorption.z * state.hitDist));
+
+        return true;
+    }
+
+    //-----------------------------------------------------------------------
+    bool CpuRenderer::ScatterPath(PathState& path) const
+    //-----------------------------------------------------------------------
+    {
+        const RenderOptions& options = scene->renderOptions;
+        State& state = path.state;
+        BsdfSampleRec& bsdfSampleRec = path.bsdfSampleRec;
+
+        bsdfSampleRec.f = DisneySample(state, -path.ray.direction, state.ffnormal, bsdfSampleRec.L, bsdfSampleRec.pdf, path.rng);
+
+        // Set absorption only if the ray is currently inside the object.
+        if (Vec3::Dot(state.ffnormal, bsdfSampleRec.L) < 0.0f)
+        {
+            const Vec3& ext = state.mat.extinction;
+            path.absorption = Vec3(-logf(ext.x), -logf(ext.y), -logf(ext.z)) / state.mat.atDistance;
+        }
+
+        if (bsdfSampleRec.pdf > 0.0f)
+            path.throughput *= bsdfSampleRec.f * (fabs(Vec3::Dot(state.ffnormal, bsdfSampleRec.L)) / bsdfSampleRec.pdf);
+        else
+            return false;
+
+        // Russian roulette
+        if (options.enableRR && path.depth >= options.RRDepth)
+        {
+            const Vec3& throughput = path.throughput;
+            float q = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) + 0.001f, 0.95f);
+            if (path.rng.Next() > q)
+                return false;
+            path.throughput = throughput / q;
+        }
+
+        path.ray.direction = bsdfSampleRec.L;
+        path.ray.origin = state.fhp + path.ray.direction * kEps;
+
+        return true;
+    }
+
+    //-----------------------------------------------------------------------
+    void CpuRenderer::PathTrace(PathState& path, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        for (; path.depth < scene->renderOptions.maxDepth; path.depth++)
+        {
+            path.state.depth = path.depth;
+            bool hit = tracer->ClosestHit(path.ray, path.state, path.lightSampleRec, &stats);
+
+            if (!ShadeHit(path, hit))
+                return;
+
+            DirectLightSample direct;
+            SampleDirectLight(path, direct);
+
+            Vec3 Li;
+            for (int i = 0; i < 2; i++)
+                if (direct.valid[i] && !tracer->AnyHit(direct.shadowRays[i], direct.maxDists[i], &stats))
+                    Li += direct.Li[i];
+            path.radiance += Li * path.throughput;
+
+            if (!ScatterPath(path))
+                return;
+        }
+    }
+
+    // Traces the first bounce of up to CpuTracer::kPacketSize paths together, camera rays as one packet and
+    // the shadow rays of each kind of light sample as another. The paths then continue one by one
+    //-----------------------------------------------------------------------
+    void CpuRenderer::PathTracePacket(PathState* paths, int count, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const int kPacketSize = CpuTracer::kPacketSize;
+
+        Ray rays[kPacketSize];
+        State states[kPacketSize];
+        LightSampleRec lightSampleRecs[kPacketSize];
+        bool hits[kPacketSize];
+
+        for (int i = 0; i < count; i++)
+        {
+            paths[i].state.depth = 0;
+            rays[i] = paths[i].ray;
+            states[i] = paths[i].state;
+        }
+
+        tracer->ClosestHitPacket(rays, count, states, lightSampleRecs, hits, &stats);
+
+        DirectLightSample direct[kPacketSize];
+        bool alive[kPacketSize];
+
+        for (int i = 0; i < count; i++)
+        {
+            paths[i].state = states[i];
+            paths[i].lightSampleRec = lightSampleRecs[i];
+
+            alive[i] = ShadeHit(paths[i], hits[i]);
+            if (alive[i])
+                SampleDirectLight(paths[i], direct[i]);
+        }
+
+        for (int s = 0; s < 2; s++)
+        {
+            Ray shadowRays[kPacketSize];
+            float maxDists[kPacketSize];
+            bool occluded[kPacketSize];
+            int pathIndex[kPacketSize];
+            int numShadowRays = 0;
+
+            for (int i = 0; i < count; i++)
+            {
+                if (alive[i] && direct[i].valid[s])
+                {
+                    shadowRays[numShadowRays] = direct[i].shadowRays[s];
+                    maxDists[numShadowRays] = direct[i].maxDists[s];
+                    pathIndex[numShadowRays++] = i;
+                }
+            }
+
+            tracer->AnyHitPacket(shadowRays, maxDists, numShadowRays, occluded, &stats);
+
+            for (int j = 0; j < numShadowRays; j++)
+                direct[pathIndex[j]].valid[s] = !occluded[j];
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (!alive[i])
+                continue;
+
+            Vec3 Li;
+            for (int s = 0; s < 2; s++)
+                if (direct[i].valid[s])
+                    Li += direct[i].Li[s];
+            paths[i].radiance += Li * paths[i].throughput;
+
+            if (ScatterPath(paths[i]))
+            {
+                paths[i].depth++;
+                PathTrace(paths[i], stats);
+            }
+        }
+    }
+
+    // Bilinear lookup with GL_REPEAT wrapping, matching the sampler state of textureMapsArrayTex
+    Vec3 CpuRenderer::SampleTexture(int texID, const Vec2& uv) const
+    {
+        int w = scene->texWidth;
+        int h = scene->texHeight;
+        const unsigned char* data = &scene->textureMapsArray[size_t(texID) * w * h * 3];
+
+        float fx = uv.x * w - 0.5f;
+        float fy = uv.y * h - 0.5f;
+        int x0 = (int)floorf(fx);
+        int y0 = (int)floorf(fy);
+        float tx = fx - x0;
+        float ty = fy - y0;
+
+        int x1 = WrapRepeat(x0 + 1, w);
+        int y1 = WrapRepeat(y0 + 1, h);
+        x0 = WrapRepeat(x0, w);
+        y0 = WrapRepeat(y0, h);
+
+        auto texel = [&](int x, int y)
+        {
+            const unsigned char* p = data + (y * w + x) * 3;
+            return Vec3(p[0], p[1], p[2]);
+        };
+
+        Vec3 c = (texel(x0, y0) * (1.0f - tx) + texel(x1, y0) * tx) * (1.0f - ty) +
+                 (texel(x0, y1) * (1.0f - tx) + texel(x1, y1) * tx) * ty;
+
+        return c * (1.0f / 255.0f);
+    }
+
+    // Bilinear lookup with GL_REPEAT wrapping, matching the sampler state of hdrTex
+    Vec3 CpuRenderer::SampleHDR(float u, float v) const
+    {
+        const HDRData* hdr = scene->hdrData;
+        int w = hdr->width;
+        int h = hdr->height;
+
+        float fx = u * w - 0.5f;
+        float fy = v * h - 0.5f;
+        int x0 = (int)floorf(fx);
+        int y0 = (int)floorf(fy);
+        float tx = fx - x0;
+        float ty = fy - y0;
+
+        int x1 = WrapRepeat(x0 + 1, w);
+        int y1 = WrapRepeat(y0 + 1, h);
+        x0 = WrapRepeat(x0, w);
+        y0 = WrapRepeat(y0, h);
+
+        auto texel = [&](int x, int y)
+        {
+            const float* p = hdr->cols + (y * w + x) * 3;
+            return Vec3(p[0], p[1], p[2]);
+        };
+
+        return (texel(x0, y0) * (1.0f - tx) + texel(x1, y0) * tx) * (1.0f - ty) +
+               (texel(x0, y1) * (1.0f - tx) + texel(x1, y1) * tx) * ty;
+    }
+
+    // Nearest lookups into the distribution textures, see hdrMarginalDistTex/hdrConditionalDistTex in Renderer::Init()
+    Vec2 CpuRenderer::FetchMarginal(float u) const
+    {
+        int n = scene->hdrData->height;
+        return scene->hdrData->marginalDistData[WrapRepeat((int)floorf(u * n), n)];
+    }
+
+    Vec2 CpuRenderer::FetchConditional(float u, float v) const
+    {
+        int w = scene->hdrData->width;
+        int h = scene->hdrData->height;
+        int x = WrapRepeat((int)floorf(u * w), w);
+        int y = WrapRepeat((int)floorf(v * h), h);
+        return scene->hdrData->conditionalDistData[y * w + x];
+    }
+
+    //-----------------------------------------------------------------------
+    float CpuRenderer::EnvPdf(const Ray& r) const
+    //-----------------------------------------------------------------------
+    {
+        float hdrResolution = float(scene->hdrData->width * scene->hdrData->height);
+        float theta = acosf(Math::Clamp(r.direction.y, -1.0f, 1.0f));
+        Vec2 uv = Vec2((PI + atan2f(r.direction.z, r.direction.x)) * (1.0f / kTwoPi), theta * (1.0f / PI));
+        float pdf = FetchConditional(uv.x, uv.y).y * FetchMarginal(uv.y).y;
+        return (pdf * hdrResolution) / (2.0f * PI * PI * sinf(theta));
+    }
+
+    //-----------------------------------------------------------------------
+    Vec3 CpuRenderer::EnvSample(Vec3& color, float& pdf, Rng& rng) const
+    //-----------------------------------------------------------------------
+    {
+        float hdrResolution = float(scene->hdrData->width * scene->hdrData->height);
+        float r1 = rng.Next();
+        float r2 = rng.Next();
+
+        float v = FetchMarginal(r1).x;
+        float u = FetchConditional(r2, v).x;
+
+        color = SampleHDR(u, v) * scene->renderOptions.hdrMultiplier;
+        pdf = FetchConditional(u, v).y * FetchMarginal(v).y;
+
+        float phi = u * kTwoPi;
+        float theta = v * PI;
+
+        if (sinf(theta) == 0.0f)
+            pdf = 0.0f;
+
+        pdf = (pdf * hdrResolution) / (2.0f * PI * PI * sinf(theta));
+        return Vec3(-sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi));
+    }
+
+    // Same as shaders/tonemap.glsl
+    Vec3 CpuRenderer::ToneMap(const Vec3& c) const
+    {
+        Vec3 color = c * (1.0f / std::max(sampleCounter, 1));
+        float luminance = 0.3f * color.x + 0.6f * color.y + 0.1f * color.z;
+        color = color * (1.0f / (1.0f + luminance / 1.5f));
+
+        return Vec3(powf(color.x, 1.0f / 2.2f), powf(color.y, 1.0f / 2.2f), powf(color.z, 1.0f / 2.2f));
+    }
+
+    void CpuRenderer::UpdateDisplayBuffer()
+    {
+        int numPixels = screenSize.x * screenSize.y;
+        displayBuffer.resize(numPixels * 3);
+
+        for (int i = 0; i < numPixels; i++)
+        {
+            Vec3 c = denoised ? denoisedBuffer[i] : ToneMap(accumBuffer[i]);
+            displayBuffer[i * 3 + 0] = (unsigned char)(Math::Clamp(c.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+            displayBuffer[i * 3 + 1] = (unsigned char)(Math::Clamp(c.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+            displayBuffer[i * 3 + 2] = (unsigned char)(Math::Clamp(c.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    void CpuRenderer::Present() const
+    {
+        // The image is handed to the UI through SetViewport()
+    }
+
+    float CpuRenderer::GetProgress() const
+    {
+        // Render() always completes a full sample
+        return 1.0f;
+    }
+
+    void CpuRenderer::GetOutputBuffer(unsigned char** data, int &w, int &h)
+    {
+        w = screenSize.x;
+        h = screenSize.y;
+
+        UpdateDisplayBuffer();
+
+        *data = new unsigned char[w * h * 3];
+        memcpy(*data, &displayBuffer[0], w * h * 3);
+    }
+
+    TraceStats CpuRenderer::GetTraceStats() const
+    {
+        TraceStats stats;
+        stats.rays = statRays;
+        stats.nodeVisits = statNodeVisits;
+        stats.triTests = statTriTests;
+        stats.nodeBytes = statNodeBytes;
+        return stats;
+    }
+
+    int CpuRenderer::GetSampleCount() const
+    {
+        return sampleCounter;
+    }
+
+    void CpuRenderer::Update(float secondsElapsed)
+    {
+        if (!initialized)
+            return;
+
+        if (scene->instancesModified)
+            tracer->UpdateInstances();
+
+        if (scene->camera->isMoving || scene->instancesModified)
+        {
+            // Clear out the accumulated samples for rendering a new image
+            std::fill(accumBuffer.begin(), accumBuffer.end(), Vec3());
+            std::fill(statsBuffer.begin(), statsBuffer.end(), Vec3());
+            sampleCounter = 0;
+            denoised = false;
+        }
+    }
+
+    uint32_t CpuRenderer::SetViewport(int width, int height)
+    {
+        UpdateDisplayBuffer();
+
+        if (outputTexture == 0)
+        {
+            glGenTextures(1, &outputTexture);
+            glBindTexture(GL_TEXTURE_2D, outputTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, outputTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, screenSize.x, screenSize.y, 0, GL_RGB, GL_UNSIGNED_BYTE, &displayBuffer[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return outputTexture;
+    }
+
+    bool CpuRenderer::DenoiseOutput()
+    {
+        int numPixels = screenSize.x * screenSize.y;
+
+        std::vector<Vec3> denoiserInput(numPixels);
+        for (int i = 0; i < numPixels; i++)
+            denoiserInput[i] = ToneMap(accumBuffer[i]);
+        denoisedBuffer.resize(numPixels);
+
+        // Create an Intel Open Image Denoise device
+        oidn::DeviceRef device = oidn::newDevice();
+        device.commit();
+
+        // Create a denoising filter
+        oidn::FilterRef filter = device.newFilter("RT"); // generic ray tracing filter
+        filter.setImage("color", &denoiserInput[0], oidn::Format::Float3, screenSize.x, screenSize.y);
+        filter.setImage("output", &denoisedBuffer[0], oidn::Format::Float3, screenSize.x, screenSize.y);
+        filter.set("hdr", false);
+        filter.commit();
+
+        // Filter the image
+        filter.execute();
+
+        // Check for errors
+        const char* errorMessage;
+        if (device.getError(errorMessage) != oidn::Error::None)
+        {
+            printf("Error: %s\n", errorMessage);
+            return false;
+        }
+
+        denoised = true;
+        return true;
+    }
+
+    uint32_t CpuRenderer::Denoise()
+    {
+        if (!DenoiseOutput())
+            return 0;
+
+        if (denoisedTexture == 0)
+        {
+            glGenTextures(1, &denoisedTexture);
+            glBindTexture(GL_TEXTURE_2D, denoisedTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+
+        // Copy the denoised data to denoisedTexture
+        glBindTexture(GL_TEXTURE_2D, denoisedTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, screenSize.x, screenSize.y, 0, GL_RGB, GL_FLOAT, &denoisedBuffer[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return denoisedTexture;
+    }
+}
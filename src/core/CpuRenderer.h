@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "Renderer.h"
+#include "CpuTracer.h"
+#include "CpuDisney.h"
+#include "TileScheduler.h"
+
+#include <atomic>
+
+namespace GLSLPT
+{
+    class Scene;
+
+    // Path tracer running on the CPU. Reads the same flattened scene data that Renderer::Init() uploads
+    // to the GPU and follows shaders/tiled.glsl + shaders/common/pathtrace.glsl, so both backends converge
+    // to the same image. Init() does not touch OpenGL and can be used without a context.
+    class CpuRenderer : public Renderer
+    {
+    private:
+        CpuTracer* tracer;
+
+        // Accumulated radiance, bottom row first to match the GL textures
+        std::vector<Vec3> accumBuffer;
+        std::vector<Vec3> denoisedBuffer;
+        std::vector<unsigned char> displayBuffer;
+
+        // Node visits, triangle tests and rays per pixel when RenderOptions::enableTraversalStats is set
+        std::vector<Vec3> statsBuffer;
+
+        GLuint outputTexture;
+        GLuint denoisedTexture;
+
+        int tileWidth;
+        int tileHeight;
+        iVec2 numTiles;
+        TileScheduler scheduler;
+
+        int sampleCounter;
+        bool denoised;
+
+        // Summed up from every tile since Init()
+        std::atomic<uint64_t> statRays;
+        std::atomic<uint64_t> statNodeVisits;
+        std::atomic<uint64_t> statTriTests;
+        std::atomic<uint64_t> statNodeBytes;
+
+        // A path being traced from one pixel
+        struct PathState
+        {
+            Ray ray;
+            Rng rng;
+            int depth;
+            Vec3 radiance;
+            Vec3 throughput;
+            Vec3 absorption;
+            State state;
+            LightSampleRec lightSampleRec;
+            BsdfSampleRec bsdfSampleRec;
+        };
+
+        // Environment (0) and analytic light (1) samples of one path vertex, each adding Li when its shadow ray is unoccluded
+        struct DirectLightSample
+        {
+            Ray shadowRays[2];
+            float maxDists[2];
+            Vec3 Li[2];
+            bool valid[2];
+        };
+
+        void RenderTile(const iVec2& tile, int frame);
+        void GeneratePath(PathState& path, int x, int y, int frame) const;
+        void PathTrace(PathState& path, TraceStats& stats) const;
+        void PathTracePacket(PathState* paths, int count, TraceStats& stats) const;
+        bool ShadeHit(PathState& path, bool hit) const;
+        void SampleDirectLight(PathState& path, DirectLightSample& direct) const;
+        bool ScatterPath(PathState& path) const;
+        void GetMaterials(State& state, const Ray& r) const;
+
+        Vec3 SampleTexture(int texID, const Vec2& uv) const;
+        Vec3 SampleHDR(float u, float v) const;
+        Vec2 FetchMarginal(float u) const;
+        Vec2 FetchConditional(float u, float v) const;
+        float EnvPdf(const Ray& r) const;
+        Vec3 EnvSample(Vec3& color, float& pdf, Rng& rng) const;
+
+        Vec3 ToneMap(const Vec3& c) const;
+        void UpdateDisplayBuffer();
+
+    public:
+        CpuRenderer(Scene *scene, const std::string& shadersDirectory);
+        ~CpuRenderer();
+
+        void Init();
+        void Finish();
+        void Render();
+        void Present() const;
+        void Update(float secondsElapsed);
+        uint32_t SetViewport(int width, int height);
+        uint32_t Denoise();
+        float GetProgress() const;
+        int GetSampleCount() const;
+        void GetOutputBuffer(unsigned char**, int &w, int &h);
+
+        // Runs the denoiser on the CPU buffers only. GetOutputBuffer() returns the denoised
+        // image until the next sample is rendered
+        bool DenoiseOutput();
+
+        const TileScheduler& GetTileScheduler() const { return scheduler; }
+        TraceStats GetTraceStats() const;
+        const CpuTracer* GetTracer() const { return tracer; }
+
+        // Summed over all samples, bottom row first. Empty unless RenderOptions::enableTraversalStats is set
+        const std::vector<Vec3>& GetTraversalStatsBuffer() const { return statsBuffer; }
+    };
+}
@@ -0,0 +1,1440 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include "CpuTracer.h"
+#include "Scene.h"
+#include "CacheModel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CPU_TRACER_SSE
+#include <immintrin.h>
+#endif
+
+#if defined(CPU_TRACER_SSE) && defined(__AVX__)
+#define CPU_TRACER_AVX
+#endif
+
+namespace GLSLPT
+{
+    static const float kInfinity = 1000000.0f;
+    static const float kEps = 0.001f;
+
+    static inline Vec3 TransformPoint(const Mat4& m, const Vec3& p)
+    {
+        return Vec3(
+            m.data[0][0] * p.x + m.data[1][0] * p.y + m.data[2][0] * p.z + m.data[3][0],
+            m.data[0][1] * p.x + m.data[1][1] * p.y + m.data[2][1] * p.z + m.data[3][1],
+            m.data[0][2] * p.x + m.data[1][2] * p.y + m.data[2][2] * p.z + m.data[3][2]
+        );
+    }
+
+    static inline Vec3 TransformDirection(const Mat4& m, const Vec3& d)
+    {
+        return Vec3(
+            m.data[0][0] * d.x + m.data[1][0] * d.y + m.data[2][0] * d.z,
+            m.data[0][1] * d.x + m.data[1][1] * d.y + m.data[2][1] * d.z,
+            m.data[0][2] * d.x + m.data[1][2] * d.y + m.data[2][2] * d.z
+        );
+    }
+
+    // Same as transpose(inverse(mat3(transform))) * n when given the inverse transform
+    static inline Vec3 TransformNormal(const Mat4& inv, const Vec3& n)
+    {
+        return Vec3(
+            inv.data[0][0] * n.x + inv.data[0][1] * n.y + inv.data[0][2] * n.z,
+            inv.data[1][0] * n.x + inv.data[1][1] * n.y + inv.data[1][2] * n.z,
+            inv.data[2][0] * n.x + inv.data[2][1] * n.y + inv.data[2][2] * n.z
+        );
+    }
+
+    //-----------------------------------------------------------------------
+    static float SphereIntersect(float rad, const Vec3& pos, const Ray& r)
+    //-----------------------------------------------------------------------
+    {
+        Vec3 op = pos - r.origin;
+        float eps = 0.001f;
+        float b = Vec3::Dot(op, r.direction);
+        float det = b * b - Vec3::Dot(op, op) + rad * rad;
+        if (det < 0.0f)
+            return kInfinity;
+
+        det = sqrtf(det);
+        float t1 = b - det;
+        if (t1 > eps)
+            return t1;
+
+        float t2 = b + det;
+        if (t2 > eps)
+            return t2;
+
+        return kInfinity;
+    }
+
+    //-----------------------------------------------------------------------
+    static float RectIntersect(const Vec3& pos, const Vec3& u, const Vec3& v, const Vec3& n, float planeDist, const Ray& r)
+    //-----------------------------------------------------------------------
+    {
+        float dt = Vec3::Dot(r.direction, n);
+        float t = (planeDist - Vec3::Dot(n, r.origin)) / dt;
+        if (t > kEps)
+        {
+            Vec3 p = r.origin + r.direction * t;
+            Vec3 vi = p - pos;
+            float a1 = Vec3::Dot(u, vi);
+            if (a1 >= 0.0f && a1 <= 1.0f)
+            {
+                float a2 = Vec3::Dot(v, vi);
+                if (a2 >= 0.0f && a2 <= 1.0f)
+                    return t;
+            }
+        }
+
+        return kInfinity;
+    }
+
+    static inline Vec3 InverseDirection(const Vec3& d)
+    {
+        return Vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+    }
+
+    //----------------------------------------------------------------
+    static float AABBIntersect(const Vec3& minCorner, const Vec3& maxCorner, const Vec3& origin, const Vec3& invDir, float tMax)
+    //----------------------------------------------------------------
+    {
+        // Entry distance clamped to the ray start, -1 when the box is missed or entered beyond tMax
+        Vec3 f = (maxCorner - origin) * invDir;
+        Vec3 n = (minCorner - origin) * invDir;
+
+        Vec3 tmax = Vec3::Max(f, n);
+        Vec3 tmin = Vec3::Min(f, n);
+
+        float t1 = std::min(std::min(tmax.x, std::min(tmax.y, tmax.z)), tMax);
+        float t0 = std::max(std::max(tmin.x, std::max(tmin.y, tmin.z)), 0.0f);
+
+        return (t1 >= t0) ? t0 : -1.0f;
+    }
+
+    // Moller-Trumbore, returns (u, v, t) in uvt and 1 - u - v in w
+    static inline bool TriangleIntersect(const Vec4& v0, const Vec4& v1, const Vec4& v2, const Ray& r, float maxDist, Vec3& uvt, float& w)
+    {
+        Vec3 p0 = Vec3(v0);
+        Vec3 e0 = Vec3(v1) - p0;
+        Vec3 e1 = Vec3(v2) - p0;
+        Vec3 pv = Vec3::Cross(r.direction, e1);
+        float det = Vec3::Dot(e0, pv);
+
+        Vec3 tv = r.origin - p0;
+        Vec3 qv = Vec3::Cross(tv, e0);
+
+        uvt.x = Vec3::Dot(tv, pv);
+        uvt.y = Vec3::Dot(r.direction, qv);
+        uvt.z = Vec3::Dot(e1, qv);
+        uvt = uvt / det;
+        w = 1.0f - uvt.x - uvt.y;
+
+        return uvt.x >= 0.0f && uvt.y >= 0.0f && uvt.z >= 0.0f && w >= 0.0f && uvt.z < maxDist;
+    }
+
+    void Onb(const Vec3& N, Vec3& T, Vec3& B)
+    {
+        Vec3 UpVector = fabs(N.z) < 0.999f ? Vec3(0, 0, 1) : Vec3(1, 0, 0);
+        T = Vec3::Normalize(Vec3::Cross(UpVector, N));
+        B = Vec3::Cross(N, T);
+    }
+
+    CpuTracer::CpuTracer(const Scene *scene, int bvhWidth)
+        : scene(scene)
+        , bvhWidth(bvhWidth)
+        , topBVHIndex(scene->bvhTranslator.topLevelIndex)
+    {
+        if (bvhWidth != 2 && bvhWidth != 4 && bvhWidth != 8)
+        {
+            printf("Unsupported bvh width %d, using 4\n", bvhWidth);
+            this->bvhWidth = 4;
+        }
+
+        bvh4.treeletLayout = scene->renderOptions.treeletBvh;
+        bvh8.treeletLayout = scene->renderOptions.treeletBvh;
+
+        if (this->bvhWidth == 4)
+            bvh4.Process(scene->GetSceneBvh(), scene->meshes, scene->meshInstances);
+        else if (this->bvhWidth == 8)
+            bvh8.Process(scene->GetSceneBvh(), scene->meshes, scene->meshInstances);
+
+        UpdateInstances();
+    }
+
+    void CpuTracer::UpdateInstances()
+    {
+        topBVHIndex = scene->bvhTranslator.topLevelIndex;
+
+        // Refitted meshes may collapse differently, so deformed geometry rebuilds the wide nodes of all meshes
+        if (scene->dirtyVerticesEnd > scene->dirtyVerticesBegin)
+        {
+            if (bvhWidth == 4)
+                bvh4.Process(scene->GetSceneBvh(), scene->meshes, scene->meshInstances);
+            else if (bvhWidth == 8)
+                bvh8.Process(scene->GetSceneBvh(), scene->meshes, scene->meshInstances);
+            return;
+        }
+
+        if (bvhWidth == 4 && !bvh4.nodes.empty())
+            bvh4.UpdateTLAS(scene->GetSceneBvh(), scene->meshInstances);
+        else if (bvhWidth == 8 && !bvh8.nodes.empty())
+            bvh8.UpdateTLAS(scene->GetSceneBvh(), scene->meshInstances);
+    }
+
+    //-----------------------------------------------------------------------
+    float CpuTracer::IntersectLights(const Ray& r, State& state, LightSampleRec& lightSampleRec) const
+    //-----------------------------------------------------------------------
+    {
+        float t = kInfinity;
+        float d;
+
+        for (int i = 0; i < scene->lights.size(); i++)
+        {
+            const Light& light = scene->lights[i];
+            int type = int(light.type);
+
+            if (type == LightType::RectLight)
+            {
+                Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                if (Vec3::Dot(normal, r.direction) > 0.0f) // Hide backfacing quad light
+                    continue;
+                Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+                Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+
+                d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+                if (d < 0.0f)
+                    d = kInfinity;
+                if (d < t)
+                {
+                    t = d;
+                    float cosTheta = Vec3::Dot(-r.direction, normal);
+                    lightSampleRec.pdf = (t * t) / (light.area * cosTheta);
+                    lightSampleRec.emission = light.emission;
+                    state.isEmitter = true;
+                }
+            }
+
+            if (type == LightType::SphereLight)
+            {
+                d = SphereIntersect(light.radius, light.position, r);
+                if (d < 0.0f)
+                    d = kInfinity;
+                if (d < t)
+                {
+                    t = d;
+                    Vec3 hitPt = r.origin + r.direction * t;
+                    float cosTheta = Vec3::Dot(-r.direction, Vec3::Normalize(hitPt - light.position));
+                    // TODO: Fix this. Currently assumes the light will be hit only from the outside
+                    lightSampleRec.pdf = (t * t) / (light.area * cosTheta * 0.5f);
+                    lightSampleRec.emission = light.emission;
+                    state.isEmitter = true;
+                }
+            }
+        }
+
+        return t;
+    }
+
+    //-----------------------------------------------------------------------
+    bool CpuTracer::OccludedByLights(const Ray& r, float maxDist) const
+    //-----------------------------------------------------------------------
+    {
+        for (int i = 0; i < scene->lights.size(); i++)
+        {
+            const Light& light = scene->lights[i];
+            int type = int(light.type);
+
+            // Intersect rectangular area light
+            if (type == LightType::RectLight)
+            {
+                Vec3 normal = Vec3::Normalize(Vec3::Cross(light.u, light.v));
+                Vec3 u = light.u * (1.0f / Vec3::Dot(light.u, light.u));
+                Vec3 v = light.v * (1.0f / Vec3::Dot(light.v, light.v));
+
+                float d = RectIntersect(light.position, u, v, normal, Vec3::Dot(normal, light.position), r);
+                if (d > 0.0f && d < maxDist)
+                    return true;
+            }
+
+            // Intersect spherical area light
+            if (type == LightType::SphereLight)
+            {
+                float d = SphereIntersect(light.radius, light.position, r);
+                if (d > 0.0f && d < maxDist)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Node access of the binary traversal for the full and the compressed BvhTranslator layout. Reads are counted
+    // in nodeBytes the same way shaders/common/closest_hit.glsl fetches texels
+    struct BinaryNodes
+    {
+        const RadeonRays::BvhTranslator::Node* nodes;
+
+        // Nodes reached from their parent were already read together with its child bounds
+        void Fetch(int index, bool prefetched, int& offset, int& count, uint64_t& bytes) const
+        {
+            if (!prefetched)
+                bytes += sizeof(RadeonRays::BvhTranslator::Node);
+
+            offset = nodes[index].offset;
+            count = nodes[index].count;
+        }
+
+        // Material of a TLAS leaf, stored in the node after it
+        static const int kMaterialBytes = sizeof(RadeonRays::BvhTranslator::Node) / 2;
+        int MaterialID(int index) const
+        {
+            return nodes[index + 1].offset;
+        }
+
+        void ChildBounds(int index, int rightIndex, Vec3& lmin, Vec3& lmax, Vec3& rmin, Vec3& rmax, uint64_t& bytes) const
+        {
+            bytes += 2 * sizeof(RadeonRays::BvhTranslator::Node);
+
+            lmin = nodes[index + 1].bboxmin;
+            lmax = nodes[index + 1].bboxmax;
+            rmin = nodes[rightIndex].bboxmin;
+            rmax = nodes[rightIndex].bboxmax;
+        }
+    };
+
+    struct CompressedBinaryNodes
+    {
+        const RadeonRays::BvhTranslator::CompressedNode* nodes;
+
+        void Fetch(int index, bool prefetched, int& offset, int& count, uint64_t& bytes) const
+        {
+            const int* header = nodes[index].header;
+            bytes += sizeof(nodes[index].header);
+
+            bool leaf = header[3] < 0;
+            offset = leaf ? header[0] : header[3];
+            count = leaf ? header[1] : 0;
+        }
+
+        // Read together with the header
+        static const int kMaterialBytes = 0;
+        int MaterialID(int index) const
+        {
+            return nodes[index].header[2];
+        }
+
+        void ChildBounds(int index, int rightIndex, Vec3& lmin, Vec3& lmax, Vec3& rmin, Vec3& rmax, uint64_t& bytes) const
+        {
+            bytes += sizeof(nodes[index].childBounds);
+            nodes[index].DecodeChildBounds(lmin, lmax, rmin, rmax);
+        }
+    };
+
+    //-----------------------------------------------------------------------
+    bool CpuTracer::ClosestHit(const Ray& r, State& state, LightSampleRec& lightSampleRec, TraceStats* stats) const
+    //-----------------------------------------------------------------------
+    {
+        TraceStats localStats;
+        TraceStats& counters = stats ? *stats : localStats;
+        counters.rays++;
+
+        Hit hit;
+        hit.t = IntersectLights(r, state, lightSampleRec);
+        hit.triIndex = -1;
+        hit.instance = -1;
+        hit.matID = 0;
+
+        if (bvhWidth == 4)
+            TraverseWide<4, false>(bvh4, bvh4.topLevelIndex, r, hit, counters);
+        else if (bvhWidth == 8)
+            TraverseWide<8, false>(bvh8, bvh8.topLevelIndex, r, hit, counters);
+        else if (scene->bvhTranslator.stackless)
+            TraverseStackless<false>(r, hit, counters);
+        else if (scene->bvhTranslator.compress)
+            IntersectBinary(CompressedBinaryNodes{ &scene->bvhTranslator.compressedNodes[0] }, r, hit, counters);
+        else
+            IntersectBinary(BinaryNodes{ &scene->bvhTranslator.nodes[0] }, r, hit, counters);
+
+        return FinishHit(r, hit, state);
+    }
+
+    //-----------------------------------------------------------------------
+    bool CpuTracer::FinishHit(const Ray& r, const Hit& hit, State& state) const
+    //-----------------------------------------------------------------------
+    {
+        // No intersections
+        if (hit.t == kInfinity)
+            return false;
+
+        state.hitDist = hit.t;
+        state.fhp = r.origin + r.direction * hit.t;
+
+        // Ray hit a triangle and not a light source
+        if (hit.triIndex != -1)
+        {
+            state.isEmitter = false;
+            state.matID = hit.matID;
+
+            const Indices& triID = scene->vertIndices[hit.triIndex];
+            Vec3 bary = Vec3(1.0f - hit.u - hit.v, hit.u, hit.v);
+
+            const Vec4& v1 = scene->verticesUVX[triID.x];
+            const Vec4& v2 = scene->verticesUVX[triID.y];
+            const Vec4& v3 = scene->verticesUVX[triID.z];
+
+            const Vec4& n1 = scene->normalsUVY[triID.x];
+            const Vec4& n2 = scene->normalsUVY[triID.y];
+            const Vec4& n3 = scene->normalsUVY[triID.z];
+
+            // Create texcoords from w coord of vertices and normals
+            state.texCoord.x = v1.w * bary.x + v2.w * bary.y + v3.w * bary.z;
+            state.texCoord.y = n1.w * bary.x + n2.w * bary.y + n3.w * bary.z;
+
+            Vec3 normal = Vec3::Normalize(Vec3(n1) * bary.x + Vec3(n2) * bary.y + Vec3(n3) * bary.z);
+
+            state.normal = Vec3::Normalize(TransformNormal(scene->invTransforms[hit.instance], normal));
+            state.ffnormal = Vec3::Dot(state.normal, r.direction) <= 0.0f ? state.normal : state.normal * -1.0f;
+
+            Onb(state.normal, state.tangent, state.bitangent);
+        }
+
+        return true;
+    }
+
+    //-----------------------------------------------------------------------
+    bool CpuTracer::AnyHit(const Ray& r, float maxDist, TraceStats* stats) const
+    //-----------------------------------------------------------------------
+    {
+        TraceStats localStats;
+        TraceStats& counters = stats ? *stats : localStats;
+        counters.rays++;
+
+        if (OccludedByLights(r, maxDist))
+            return true;
+
+        Hit hit;
+        hit.t = maxDist;
+        hit.triIndex = -1;
+
+        if (bvhWidth == 4)
+            return TraverseWide<4, true>(bvh4, bvh4.topLevelIndex, r, hit, counters);
+        else if (bvhWidth == 8)
+            return TraverseWide<8, true>(bvh8, bvh8.topLevelIndex, r, hit, counters);
+
+        if (scene->bvhTranslator.stackless)
+            return TraverseStackless<true>(r, hit, counters);
+
+        if (scene->bvhTranslator.compress)
+            return OccludedBinary(CompressedBinaryNodes{ &scene->bvhTranslator.compressedNodes[0] }, r, maxDist, counters);
+
+        return OccludedBinary(BinaryNodes{ &scene->bvhTranslator.nodes[0] }, r, maxDist, counters);
+    }
+
+    //-----------------------------------------------------------------------
+    template <class Nodes>
+    void CpuTracer::IntersectBinary(const Nodes& nodes, const Ray& r, Hit& hit, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const Indices* vertIndices = &scene->vertIndices[0];
+        const Vec4* vertices = &scene->verticesUVX[0];
+
+        int stack[64];
+        int ptr = 0;
+        stack[ptr++] = -1;
+
+        int index = topBVHIndex;
+        float leftHit = 0.0f;
+        float rightHit = 0.0f;
+        bool prefetched = false;
+
+        int currMatID = 0;
+        int currInstance = -1;
+        bool BLAS = false;
+
+        Ray rTrans = r;
+        Vec3 invDir = InverseDirection(r.direction);
+
+        while (index != -1)
+        {
+            int offset, leaf;
+            nodes.Fetch(index, prefetched, offset, leaf, stats.nodeBytes);
+            prefetched = false;
+            stats.nodeVisits++;
+
+            int leftIndex  = index + 1;
+            int rightIndex = offset;
+
+            if (leaf > 0) // Leaf node of BLAS
+            {
+                stats.triTests += leaf;
+                for (int i = 0; i < leaf; i++) // Loop through tris
+                {
+                    const Indices& tri = vertIndices[offset + i];
+
+                    Vec3 uvt;
+                    float w;
+                    if (TriangleIntersect(vertices[tri.x], vertices[tri.y], vertices[tri.z], rTrans, hit.t, uvt, w))
+                    {
+                        hit.t = uvt.z;
+                        hit.triIndex = offset + i;
+                        hit.instance = currInstance;
+                        hit.matID = currMatID;
+                        hit.u = uvt.x;
+                        hit.v = uvt.y;
+                    }
+                }
+            }
+            else if (leaf < 0) // Leaf node of TLAS
+            {
+                currInstance = -leaf - 1;
+                const Mat4& invTransform = scene->invTransforms[currInstance];
+
+                rTrans.origin    = TransformPoint(invTransform, r.origin);
+                rTrans.direction = TransformDirection(invTransform, r.direction);
+                invDir = InverseDirection(rTrans.direction);
+
+                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
+                stack[ptr++] = -1;
+                stats.nodeBytes += nodes.kMaterialBytes;
+                currMatID = nodes.MaterialID(index);
+                index = offset;
+                BLAS = true;
+                continue;
+            }
+            else
+            {
+                Vec3 lmin, lmax, rmin, rmax;
+                nodes.ChildBounds(index, rightIndex, lmin, lmax, rmin, rmax, stats.nodeBytes);
+
+                leftHit  = AABBIntersect(lmin, lmax, rTrans.origin, invDir, hit.t);
+                rightHit = AABBIntersect(rmin, rmax, rTrans.origin, invDir, hit.t);
+                prefetched = leftHit >= 0.0f || rightHit >= 0.0f;
+
+                if (leftHit >= 0.0f && rightHit >= 0.0f)
+                {
+                    int deferred = -1;
+                    if (leftHit > rightHit)
+                    {
+                        index = rightIndex;
+                        deferred = leftIndex;
+                    }
+                    else
+                    {
+                        index = leftIndex;
+                        deferred = rightIndex;
+                    }
+
+                    stack[ptr++] = deferred;
+                    continue;
+                }
+                else if (leftHit >= 0.0f)
+                {
+                    index = leftIndex;
+                    continue;
+                }
+                else if (rightHit >= 0.0f)
+                {
+                    index = rightIndex;
+                    continue;
+                }
+            }
+            index = stack[--ptr];
+
+            // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
+            if (BLAS && index == -1)
+            {
+                BLAS = false;
+
+                index = stack[--ptr];
+
+                rTrans = r;
+                invDir = InverseDirection(r.direction);
+            }
+        }
+    }
+
+    //-----------------------------------------------------------------------
+    template <class Nodes>
+    bool CpuTracer::OccludedBinary(const Nodes& nodes, const Ray& r, float maxDist, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const Indices* vertIndices = &scene->vertIndices[0];
+        const Vec4* vertices = &scene->verticesUVX[0];
+
+        int stack[64];
+        int ptr = 0;
+        stack[ptr++] = -1;
+
+        int index = topBVHIndex;
+        float leftHit = 0.0f;
+        float rightHit = 0.0f;
+        bool prefetched = false;
+
+        bool BLAS = false;
+
+        Ray rTrans = r;
+        Vec3 invDir = InverseDirection(r.direction);
+
+        while (index != -1)
+        {
+            int offset, leaf;
+            nodes.Fetch(index, prefetched, offset, leaf, stats.nodeBytes);
+            prefetched = false;
+            stats.nodeVisits++;
+
+            int leftIndex  = index + 1;
+            int rightIndex = offset;
+
+            if (leaf > 0) // Leaf node of BLAS
+            {
+                for (int i = 0; i < leaf; i++) // Loop through tris
+                {
+                    const Indices& tri = vertIndices[offset + i];
+
+                    stats.triTests++;
+                    Vec3 uvt;
+                    float w;
+                    if (TriangleIntersect(vertices[tri.x], vertices[tri.y], vertices[tri.z], rTrans, maxDist, uvt, w))
+                        return true;
+                }
+            }
+            else if (leaf < 0) // Leaf node of TLAS
+            {
+                const Mat4& invTransform = scene->invTransforms[-leaf - 1];
+
+                rTrans.origin    = TransformPoint(invTransform, r.origin);
+                rTrans.direction = TransformDirection(invTransform, r.direction);
+                invDir = InverseDirection(rTrans.direction);
+
+                // Add a marker. We'll return to this spot after we've traversed the entire BLAS
+                stack[ptr++] = -1;
+
+                index = offset;
+                BLAS = true;
+                continue;
+            }
+            else
+            {
+                Vec3 lmin, lmax, rmin, rmax;
+                nodes.ChildBounds(index, rightIndex, lmin, lmax, rmin, rmax, stats.nodeBytes);
+
+                leftHit  = AABBIntersect(lmin, lmax, rTrans.origin, invDir, maxDist);
+                rightHit = AABBIntersect(rmin, rmax, rTrans.origin, invDir, maxDist);
+                prefetched = leftHit >= 0.0f || rightHit >= 0.0f;
+
+                if (leftHit >= 0.0f && rightHit >= 0.0f)
+                {
+                    int deferred = -1;
+                    if (leftHit > rightHit)
+                    {
+                        index = rightIndex;
+                        deferred = leftIndex;
+                    }
+                    else
+                    {
+                        index = leftIndex;
+                        deferred = rightIndex;
+                    }
+
+                    stack[ptr++] = deferred;
+                    continue;
+                }
+                else if (leftHit >= 0.0f)
+                {
+                    index = leftIndex;
+                    continue;
+                }
+                else if (rightHit >= 0.0f)
+                {
+                    index = rightIndex;
+                    continue;
+                }
+            }
+            index = stack[--ptr];
+
+            // If we've traversed the entire BLAS then switch to back to TLAS and resume where we left off
+            if (BLAS && index == -1)
+            {
+                BLAS = false;
+
+                index = stack[--ptr];
+
+                rTrans = r;
+                invDir = InverseDirection(r.direction);
+            }
+        }
+
+        return false;
+    }
+
+    //-----------------------------------------------------------------------
+    template <bool anyHit>
+    bool CpuTracer::TraverseStackless(const Ray& r, Hit& hit, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const RadeonRays::BvhTranslator::Node* nodes = &scene->bvhTranslator.nodes[0];
+        const int* missLinks = &scene->bvhTranslator.missLinks[0];
+        const Indices* vertIndices = &scene->vertIndices[0];
+        const Vec4* vertices = &scene->verticesUVX[0];
+
+        int index = topBVHIndex;
+        int resumeIndex = -1;
+
+        int currMatID = 0;
+        int currInstance = -1;
+        bool BLAS = false;
+
+        Ray rTrans = r;
+        Vec3 invDir = InverseDirection(r.direction);
+
+        while (index != -1)
+        {
+            const RadeonRays::BvhTranslator::Node& node = nodes[index];
+            stats.nodeBytes += sizeof(RadeonRays::BvhTranslator::Node);
+            stats.nodeVisits++;
+
+            if (AABBIntersect(node.bboxmin, node.bboxmax, rTrans.origin, invDir, hit.t) >= 0.0f)
+            {
+                if (node.count == 0) // Internal node
+                {
+                    index++;
+                    continue;
+                }
+                else if (node.count < 0) // Leaf node of TLAS
+                {
+                    currInstance = -node.count - 1;
+                    const Mat4& invTransform = scene->invTransforms[currInstance];
+
+                    rTrans.origin    = TransformPoint(invTransform, r.origin);
+                    rTrans.direction = TransformDirection(invTransform, r.direction);
+                    invDir = InverseDirection(rTrans.direction);
+
+                    stats.nodeBytes += sizeof(RadeonRays::BvhTranslator::Node) / 2 + sizeof(int);
+                    currMatID = nodes[index + 1].offset;
+                    resumeIndex = missLinks[index];
+                    index = node.offset;
+                    BLAS = true;
+                    continue;
+                }
+
+                // Leaf node of BLAS
+                for (int i = 0; i < node.count; i++) // Loop through tris
+                {
+                    const Indices& tri = vertIndices[node.offset + i];
+
+                    stats.triTests++;
+                    Vec3 uvt;
+                    float w;
+                    if (TriangleIntersect(vertices[tri.x], vertices[tri.y], vertices[tri.z], rTrans, hit.t, uvt, w))
+                    {
+                        if (anyHit)
+                            return true;
+
+                        hit.t = uvt.z;
+                        hit.triIndex = node.offset + i;
+                        hit.instance = currInstance;
+                        hit.matID = currMatID;
+                        hit.u = uvt.x;
+                        hit.v = uvt.y;
+                    }
+                }
+            }
+            stats.nodeBytes += sizeof(int);
+            index = missLinks[index];
+
+            // The last node of a BLAS links to -1, continue in the TLAS
+            if (BLAS && index == -1)
+            {
+                BLAS = false;
+
+                index = resumeIndex;
+
+                rTrans = r;
+                invDir = InverseDirection(r.direction);
+            }
+        }
+
+        return false;
+    }
+
+    // Ray with everything the slab test needs, broadcast once per BVH level (TLAS, then each BLAS)
+    struct WideRay
+    {
+        WideRay(const Ray& r) : ray(r)
+        {
+            invDir = Vec3(1.0f / r.direction.x, 1.0f / r.direction.y, 1.0f / r.direction.z);
+#if defined(CPU_TRACER_SSE)
+            for (int axis = 0; axis < 3; axis++)
+            {
+                origin4[axis] = _mm_set1_ps(r.origin[axis]);
+                invDir4[axis] = _mm_set1_ps(invDir[axis]);
+            }
+#endif
+#if defined(CPU_TRACER_AVX)
+            for (int axis = 0; axis < 3; axis++)
+            {
+                origin8[axis] = _mm256_set1_ps(r.origin[axis]);
+                invDir8[axis] = _mm256_set1_ps(invDir[axis]);
+            }
+#endif
+        }
+
+        Ray ray;
+        Vec3 invDir;
+#if defined(CPU_TRACER_SSE)
+        __m128 origin4[3];
+        __m128 invDir4[3];
+#endif
+#if defined(CPU_TRACER_AVX)
+        __m256 origin8[3];
+        __m256 invDir8[3];
+#endif
+    };
+
+#if defined(CPU_TRACER_SSE)
+    // Slab test of four children, bmin/bmax point at the first of them on each axis
+    static inline int IntersectChildren4(const float* const bmin[3], const float* const bmax[3], const WideRay& r, float tMax, float* tNear)
+    {
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(tMax);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmin[axis]), r.origin4[axis]), r.invDir4[axis]);
+            __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmax[axis]), r.origin4[axis]), r.invDir4[axis]);
+            t0 = _mm_max_ps(t0, _mm_min_ps(n, f));
+            t1 = _mm_min_ps(t1, _mm_max_ps(n, f));
+        }
+
+        _mm_storeu_ps(tNear, t0);
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+#endif
+
+    // Returns a bitmask of the children of 'node' hit within [0, tMax] and their entry distances
+    template <int N>
+    static inline int IntersectChildren(const typename RadeonRays::WideBvhTranslator<N>::Node& node, const WideRay& r, float tMax, float* tNear)
+    {
+#if defined(CPU_TRACER_AVX)
+        if (N == 8)
+        {
+            __m256 t0 = _mm256_setzero_ps();
+            __m256 t1 = _mm256_set1_ps(tMax);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bmin[axis]), r.origin8[axis]), r.invDir8[axis]);
+                __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bmax[axis]), r.origin8[axis]), r.invDir8[axis]);
+                t0 = _mm256_max_ps(t0, _mm256_min_ps(n, f));
+                t1 = _mm256_min_ps(t1, _mm256_max_ps(n, f));
+            }
+
+            _mm256_storeu_ps(tNear, t0);
+            return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+        }
+#endif
+#if defined(CPU_TRACER_SSE)
+        // Without AVX an 8 wide node is tested as two halves
+        int mask = 0;
+        for (int first = 0; first < N; first += 4)
+        {
+            const float* bmin[3] = { node.bmin[0] + first, node.bmin[1] + first, node.bmin[2] + first };
+            const float* bmax[3] = { node.bmax[0] + first, node.bmax[1] + first, node.bmax[2] + first };
+            mask |= IntersectChildren4(bmin, bmax, r, tMax, tNear + first) << first;
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int i = 0; i < N; i++)
+        {
+            float t0 = 0.0f;
+            float t1 = tMax;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float n = (node.bmin[axis][i] - r.ray.origin[axis]) * r.invDir[axis];
+                float f = (node.bmax[axis][i] - r.ray.origin[axis]) * r.invDir[axis];
+                t0 = std::max(t0, std::min(n, f));
+                t1 = std::min(t1, std::max(n, f));
+            }
+            tNear[i] = t0;
+            if (t0 <= t1)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Collects the children in 'mask' sorted by entry distance, nearest first
+    template <int N>
+    static inline int SortChildren(int mask, const float* tNear, int* order)
+    {
+        int count = 0;
+        for (int i = 0; i < N; i++)
+        {
+            if (!(mask & (1 << i)))
+                continue;
+
+            int j = count++;
+            while (j > 0 && tNear[order[j - 1]] > tNear[i])
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        return count;
+    }
+
+    struct WideStackEntry
+    {
+        int index;
+        float t;
+    };
+
+    static const int kWideStackSize = 256;
+
+    //-----------------------------------------------------------------------
+    template <int N, bool anyHit>
+    bool CpuTracer::TraverseBlas(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray& r, int instance, int matID, Hit& hit, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const Indices* vertIndices = &scene->vertIndices[0];
+        const Vec4* vertices = &scene->verticesUVX[0];
+
+        WideRay wr(r);
+
+        WideStackEntry stack[kWideStackSize];
+        int ptr = 0;
+        stack[ptr++] = { root, 0.0f };
+
+        while (ptr > 0)
+        {
+            WideStackEntry entry = stack[--ptr];
+            if (entry.t > hit.t)
+                continue;
+
+            const typename RadeonRays::WideBvhTranslator<N>::Node& node = bvh.nodes[entry.index];
+            stats.nodeVisits++;
+            stats.nodeBytes += sizeof(node);
+            if (stats.nodeMemory)
+                stats.nodeMemory->Read(&node, sizeof(node));
+
+            float tNear[N];
+            int order[N];
+            int mask = IntersectChildren<N>(node, wr, hit.t, tNear);
+            int numHits = SortChildren<N>(mask, tNear, order);
+
+            // Leaves are intersected right away, nearest first, which shrinks hit.t for the rest
+            for (int i = 0; i < numHits; i++)
+            {
+                int slot = order[i];
+                int count = node.count[slot];
+                if (count <= 0)
+                    continue;
+
+                int first = node.child[slot];
+                stats.triTests += count;
+                for (int j = 0; j < count; j++)
+                {
+                    const Indices& tri = vertIndices[first + j];
+
+                    Vec3 uvt;
+                    float w;
+                    if (TriangleIntersect(vertices[tri.x], vertices[tri.y], vertices[tri.z], r, hit.t, uvt, w))
+                    {
+                        if (anyHit)
+                            return true;
+
+                        hit.t = uvt.z;
+                        hit.triIndex = first + j;
+                        hit.instance = instance;
+                        hit.matID = matID;
+                        hit.u = uvt.x;
+                        hit.v = uvt.y;
+                    }
+                }
+            }
+
+            // Far children first so that the nearest one is popped next
+            for (int i = numHits - 1; i >= 0; i--)
+            {
+                int slot = order[i];
+                if (node.count[slot] == 0 && tNear[slot] <= hit.t)
+                    stack[ptr++] = { node.child[slot], tNear[slot] };
+            }
+        }
+
+        return false;
+    }
+
+    //-----------------------------------------------------------------------
+    template <int N, bool anyHit>
+    bool CpuTracer::TraverseWide(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray& r, Hit& hit, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        WideRay wr(r);
+
+        WideStackEntry stack[kWideStackSize];
+        int ptr = 0;
+        stack[ptr++] = { root, 0.0f };
+
+        while (ptr > 0)
+        {
+            WideStackEntry entry = stack[--ptr];
+            if (entry.t > hit.t)
+                continue;
+
+            const typename RadeonRays::WideBvhTranslator<N>::Node& node = bvh.nodes[entry.index];
+            stats.nodeVisits++;
+            stats.nodeBytes += sizeof(node);
+            if (stats.nodeMemory)
+                stats.nodeMemory->Read(&node, sizeof(node));
+
+            float tNear[N];
+            int order[N];
+            int mask = IntersectChildren<N>(node, wr, hit.t, tNear);
+            int numHits = SortChildren<N>(mask, tNear, order);
+
+            for (int i = 0; i < numHits; i++)
+            {
+                int slot = order[i];
+                int count = node.count[slot];
+                if (count >= 0 || tNear[slot] > hit.t)
+                    continue;
+
+                // The direction is not renormalized, so distances in instance space match world space
+                int instance = -count - 1;
+                const Mat4& invTransform = scene->invTransforms[instance];
+
+                Ray rTrans;
+                rTrans.origin    = TransformPoint(invTransform, r.origin);
+                rTrans.direction = TransformDirection(invTransform, r.direction);
+
+                if (TraverseBlas<N, anyHit>(bvh, node.child[slot], rTrans, instance, scene->meshInstances[instance].materialID, hit, stats))
+                    return true;
+            }
+
+            for (int i = numHits - 1; i >= 0; i--)
+            {
+                int slot = order[i];
+                if (node.count[slot] == 0 && tNear[slot] <= hit.t)
+                    stack[ptr++] = { node.child[slot], tNear[slot] };
+            }
+        }
+
+        return false;
+    }
+
+    static const int kPacketSize = CpuTracer::kPacketSize;
+
+    // Packet rays in SoA layout. Lanes of rays that are not part of the packet are never hit because their
+    // tHit is kept negative
+    struct PacketRays
+    {
+        PacketRays(const Ray* rays, int rayMask)
+        {
+            for (int i = 0; i < kPacketSize; i++)
+            {
+                bool valid = (rayMask & (1 << i)) != 0;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    origin[axis][i] = valid ? rays[i].origin[axis] : 0.0f;
+                    invDir[axis][i] = valid ? 1.0f / rays[i].direction[axis] : 1.0f;
+                }
+            }
+        }
+
+        alignas(32) float origin[3][kPacketSize];
+        alignas(32) float invDir[3][kPacketSize];
+    };
+
+    // Tests one child box against all rays of a packet. Returns the mask of rays that hit it within [0, tHit]
+    static inline int IntersectPacket(const float* bmin, const float* bmax, const PacketRays& p, const float* tHit, float* tNear)
+    {
+#if defined(CPU_TRACER_AVX)
+        __m256 t0 = _mm256_setzero_ps();
+        __m256 t1 = _mm256_loadu_ps(tHit);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            __m256 o = _mm256_load_ps(p.origin[axis]);
+            __m256 inv = _mm256_load_ps(p.invDir[axis]);
+            __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin[axis]), o), inv);
+            __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax[axis]), o), inv);
+            t0 = _mm256_max_ps(t0, _mm256_min_ps(n, f));
+            t1 = _mm256_min_ps(t1, _mm256_max_ps(n, f));
+        }
+
+        _mm256_storeu_ps(tNear, t0);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+#elif defined(CPU_TRACER_SSE)
+        int mask = 0;
+        for (int first = 0; first < kPacketSize; first += 4)
+        {
+            __m128 t0 = _mm_setzero_ps();
+            __m128 t1 = _mm_loadu_ps(tHit + first);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __m128 o = _mm_load_ps(p.origin[axis] + first);
+                __m128 inv = _mm_load_ps(p.invDir[axis] + first);
+                __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[axis]), o), inv);
+                __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[axis]), o), inv);
+                t0 = _mm_max_ps(t0, _mm_min_ps(n, f));
+                t1 = _mm_min_ps(t1, _mm_max_ps(n, f));
+            }
+
+            _mm_storeu_ps(tNear + first, t0);
+            mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << first;
+        }
+        return mask;
+#else
+        int mask = 0;
+        for (int i = 0; i < kPacketSize; i++)
+        {
+            float t0 = 0.0f;
+            float t1 = tHit[i];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float n = (bmin[axis] - p.origin[axis][i]) * p.invDir[axis][i];
+                float f = (bmax[axis] - p.origin[axis][i]) * p.invDir[axis][i];
+                t0 = std::max(t0, std::min(n, f));
+                t1 = std::min(t1, std::max(n, f));
+            }
+            tNear[i] = t0;
+            if (t0 <= t1)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    static inline int LowestBit(int mask)
+    {
+        int i = 0;
+        while (!(mask & (1 << i)))
+            i++;
+        return i;
+    }
+
+    static inline bool SingleBit(int mask)
+    {
+        return (mask & (mask - 1)) == 0;
+    }
+
+    struct PacketStackEntry
+    {
+        int index;
+        int mask;
+    };
+
+    // Inner child of a packet node, the rays that hit it and the nearest of their entry distances
+    struct PacketChild
+    {
+        int index;
+        int mask;
+        float t;
+    };
+
+    // Splits the children of a node hit by the packet into leaves and inner nodes sorted by entry distance
+    template <int N>
+    static inline int GatherPacketChildren(const typename RadeonRays::WideBvhTranslator<N>::Node& node, const PacketRays& p,
+        const float* tHit, int mask, PacketChild* children, int* leafSlots, int* leafMasks, int& numLeaves)
+    {
+        int numChildren = 0;
+        numLeaves = 0;
+
+        for (int slot = 0; slot < N && node.child[slot] != -1; slot++)
+        {
+            const float bmin[3] = { node.bmin[0][slot], node.bmin[1][slot], node.bmin[2][slot] };
+            const float bmax[3] = { node.bmax[0][slot], node.bmax[1][slot], node.bmax[2][slot] };
+
+            float tNear[kPacketSize];
+            int childMask = IntersectPacket(bmin, bmax, p, tHit, tNear) & mask;
+            if (!childMask)
+                continue;
+
+            if (node.count[slot] != 0)
+            {
+                leafSlots[numLeaves] = slot;
+                leafMasks[numLeaves++] = childMask;
+                continue;
+            }
+
+            float t = kInfinity;
+            for (int i = 0; i < kPacketSize; i++)
+                if (childMask & (1 << i))
+                    t = std::min(t, tNear[i]);
+
+            int j = numChildren++;
+            while (j > 0 && children[j - 1].t > t)
+            {
+                children[j] = children[j - 1];
+                j--;
+            }
+            children[j] = { node.child[slot], childMask, t };
+        }
+
+        return numChildren;
+    }
+
+    //-----------------------------------------------------------------------
+    template <int N, bool anyHit>
+    void CpuTracer::TraversePacketBlas(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray* rays, int rayMask, int& active,
+        float* tHit, int instance, int matID, Hit* hits, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        const Indices* vertIndices = &scene->vertIndices[0];
+        const Vec4* vertices = &scene->verticesUVX[0];
+
+        PacketRays p(rays, rayMask);
+
+        PacketStackEntry stack[kWideStackSize];
+        int ptr = 0;
+        stack[ptr++] = { root, rayMask };
+
+        while (ptr > 0)
+        {
+            PacketStackEntry entry = stack[--ptr];
+            int mask = entry.mask & active;
+            if (!mask)
+                continue;
+
+            // The packet has diverged, finish this subtree with the single ray traversal
+            if (SingleBit(mask))
+            {
+                int i = LowestBit(mask);
+                if (TraverseBlas<N, anyHit>(bvh, entry.index, rays[i], instance, matID, hits[i], stats))
+                    active &= ~mask;
+                tHit[i] = hits[i].t;
+                continue;
+            }
+
+            const typename RadeonRays::WideBvhTranslator<N>::Node& node = bvh.nodes[entry.index];
+            stats.nodeVisits++;
+            stats.nodeBytes += sizeof(node);
+            if (stats.nodeMemory)
+                stats.nodeMemory->Read(&node, sizeof(node));
+
+            PacketChild children[N];
+            int leafSlots[N];
+            int leafMasks[N];
+            int numLeaves;
+            int numChildren = GatherPacketChildren<N>(node, p, tHit, mask, children, leafSlots, leafMasks, numLeaves);
+
+            for (int l = 0; l < numLeaves; l++)
+            {
+                int first = node.child[leafSlots[l]];
+                int count = node.count[leafSlots[l]];
+
+                for (int i = 0; i < kPacketSize; i++)
+                {
+                    if (!(leafMasks[l] & active & (1 << i)))
+                        continue;
+
+                    stats.triTests += count;
+                    for (int j = 0; j < count; j++)
+                    {
+                        const Indices& tri = vertIndices[first + j];
+
+                        Vec3 uvt;
+                        float w;
+                        if (TriangleIntersect(vertices[tri.x], vertices[tri.y], vertices[tri.z], rays[i], tHit[i], uvt, w))
+                        {
+                            if (anyHit)
+                            {
+                                active &= ~(1 << i);
+                                break;
+                            }
+
+                            tHit[i] = uvt.z;
+                            hits[i].t = uvt.z;
+                            hits[i].triIndex = first + j;
+                            hits[i].instance = instance;
+                            hits[i].matID = matID;
+                            hits[i].u = uvt.x;
+                            hits[i].v = uvt.y;
+                        }
+                    }
+                }
+            }
+
+            for (int i = numChildren - 1; i >= 0; i--)
+                stack[ptr++] = { children[i].index, children[i].mask };
+        }
+    }
+
+    //-----------------------------------------------------------------------
+    template <int N, bool anyHit>
+    void CpuTracer::TraversePacket(const RadeonRays::WideBvhTranslator<N>& bvh, const Ray* rays, int rayMask, Hit* hits, TraceStats& stats) const
+    //-----------------------------------------------------------------------
+    {
+        PacketRays p(rays, rayMask);
+
+        alignas(32) float tHit[kPacketSize];
+        for (int i = 0; i < kPacketSize; i++)
+            tHit[i] = (rayMask & (1 << i)) ? hits[i].t : -1.0f;
+
+        int active = rayMask;
+
+        PacketStackEntry stack[kWideStackSize];
+        int ptr = 0;
+        stack[ptr++] = { bvh.topLevelIndex, rayMask };
+
+        while (ptr > 0)
+        {
+            PacketStackEntry entry = stack[--ptr];
+            int mask = entry.mask & active;
+            if (!mask)
+                continue;
+
+            if (SingleBit(mask))
+            {
+                int i = LowestBit(mask);
+                if (TraverseWide<N, anyHit>(bvh, entry.index, rays[i], hits[i], stats))
+                    active &= ~mask;
+                tHit[i] = hits[i].t;
+                continue;
+            }
+
+            const typename RadeonRays::WideBvhTranslator<N>::Node& node = bvh.nodes[entry.index];
+            stats.nodeVisits++;
+            stats.nodeBytes += sizeof(node);
+            if (stats.nodeMemory)
+                stats.nodeMemory->Read(&node, sizeof(node));
+
+            PacketChild children[N];
+            int leafSlots[N];
+            int leafMasks[N];
+            int numLeaves;
+            int numChildren = GatherPacketChildren<N>(node, p, tHit, mask, children, leafSlots, leafMasks, numLeaves);
+
+            for (int l = 0; l < numLeaves; l++)
+            {
+                int slot = leafSlots[l];
+                int instance = -node.count[slot] - 1;
+                const Mat4& invTransform = scene->invTransforms[instance];
+
+                Ray rTrans[kPacketSize];
+                for (int i = 0; i < kPacketSize; i++)
+                {
+                    if (leafMasks[l] & (1 << i))
+                    {
+                        rTrans[i].origin    = TransformPoint(invTransform, rays[i].origin);
+                        rTrans[i].direction = TransformDirection(invTransform, rays[i].direction);
+                    }
+                }
+
+                TraversePacketBlas<N, anyHit>(bvh, node.child[slot], rTrans, leafMasks[l] & active, active, tHit,
+                    instance, scene->meshInstances[instance].materialID, hits, stats);
+            }
+
+            for (int i = numChildren - 1; i >= 0; i--)
+                stack[ptr++] = { children[i].index, children[i].mask };
+        }
+
+        // Rays that were found occluded are the ones no longer active
+        if (anyHit)
+            for (int i = 0; i < kPacketSize; i++)
+                if ((rayMask & ~active) & (1 << i))
+                    hits[i].triIndex = 0;
+    }
+
+    //-----------------------------------------------------------------------
+    void CpuTracer::ClosestHitPacket(const Ray* rays, int count, State* states, LightSampleRec* lightSampleRecs, bool* hits, TraceStats* stats) const
+    //-----------------------------------------------------------------------
+    {
+        if (bvhWidth == 2 || count <= 1)
+        {
+            for (int i = 0; i < count; i++)
+                hits[i] = ClosestHit(rays[i], states[i], lightSampleRecs[i], stats);
+            return;
+        }
+
+        TraceStats localStats;
+        TraceStats& counters = stats ? *stats : localStats;
+        counters.rays += count;
+
+        Hit packetHits[kPacketSize];
+        for (int i = 0; i < count; i++)
+        {
+            packetHits[i].t = IntersectLights(rays[i], states[i], lightSampleRecs[i]);
+            packetHits[i].triIndex = -1;
+            packetHits[i].instance = -1;
+            packetHits[i].matID = 0;
+        }
+
+        int rayMask = (1 << count) - 1;
+        if (bvhWidth == 4)
+            TraversePacket<4, false>(bvh4, rays, rayMask, packetHits, counters);
+        else
+            TraversePacket<8, false>(bvh8, rays, rayMask, packetHits, counters);
+
+        for (int i = 0; i < count; i++)
+            hits[i] = FinishHit(rays[i], packetHits[i], states[i]);
+    }
+
+    //-----------------------------------------------------------------------
+    void CpuTracer::AnyHitPacket(const Ray* rays, const float* maxDists, int count, bool* occluded, TraceStats* stats) const
+    //-----------------------------------------------------------------------
+    {
+        if (bvhWidth == 2 || count <= 1)
+        {
+            for (int i = 0; i < count; i++)
+                occluded[i] = AnyHit(rays[i], maxDists[i], stats);
+            return;
+        }
+
+        TraceStats localStats;
+        TraceStats& counters = stats ? *stats : localStats;
+        counters.rays += count;
+
+        Hit packetHits[kPacketSize];
+        int rayMask = 0;
+        for (int i = 0; i < count; i++)
+        {
+            occluded[i] = OccludedByLights(rays[i], maxDists[i]);
+            packetHits[i].t = maxDists[i];
+            packetHits[i].triIndex = -1;
+            if (!occluded[i])
+                rayMask |= 1 << i;
+        }
+
+        if (!rayMask)
+            return;
+
+        if (bvhWidth == 4)
+            TraversePacket<4, true>(bvh4, rays, rayMask, packetHits, counters);
+        else
+            TraversePacket<8, true>(bvh8, rays, rayMask, packetHits, counters);
+
+        for (int i = 0; i < count; i++)
+            if (rayMask & (1 << i))
+                occluded[i] = packetHits[i].triIndex != -1;
+    }
+}
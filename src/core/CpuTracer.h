@@ -0,0 +1,170 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <Vec2.h>
+#include <Vec3.h>
+#include <Mat4.h>
+#include "Material.h"
+#include "wide_bvh.h"
+
+namespace GLSLPT
+{
+    class Scene;
+    struct MemoryModel;
+
+    // CPU counterparts of the structs in shaders/common/globals.glsl
+
+    struct Ray
+    {
+        Ray() {}
+        Ray(const Vec3& origin, const Vec3& direction) : origin(origin), direction(direction) {}
+
+        Vec3 origin;
+        Vec3 direction;
+    };
+
+    struct State
+    {
+        int depth;
+        float eta;
+        float hitDist;
+
+        Vec3 fhp;
+        Vec3 normal;
+        Vec3 ffnormal;
+        Vec3 tangent;
+        Vec3 bitangent;
+
+        bool isEmitter;
+
+        Vec2 texCoord;
+        int matID;
+        Material mat;
+    };
+
+    struct BsdfSampleRec
+    {
+        Vec3 L;
+        Vec3 f;
+        float pdf;
+    };
+
+    struct LightSampleRec
+    {
+        Vec3 normal;
+        Vec3 emission;
+        Vec3 direction;
+        float dist;
+        float pdf;
+    };
+
+    // Traversal counters, gathered per tile and summed up by the renderer
+    struct TraceStats
+    {
+        uint64_t rays = 0;
+        uint64_t nodeVisits = 0;
+        uint64_t triTests = 0;
+        uint64_t nodeBytes = 0; // BVH node data read, counted like the GPU texel fetches
+        MemoryModel* nodeMemory = nullptr; // Optional, replays the node reads of the 4/8-wide traversal
+    };
+
+    // Ray queries against the flattened scene data (vertIndices, verticesUVX, normalsUVY, lights).
+    // With a bvh width of 2 the binary bvhTranslator.nodes are walked exactly like shaders/common/closest_hit.glsl
+    // and shaders/common/anyhit.glsl. Widths 4 and 8 collapse the scene BVHs into a WideBvhTranslator and test
+    // all children of a node at once with SSE/AVX
+    class CpuTracer
+    {
+    public:
+        CpuTracer(const Scene *scene, int bvhWidth);
+
+        // Must be called whenever instances or mesh vertices change (Scene::RebuildInstances)
+        void UpdateInstances();
+
+        bool ClosestHit(const Ray& r, State& state, LightSampleRec& lightSampleRec, TraceStats* stats = nullptr) const;
+        bool AnyHit(const Ray& r, float maxDist, TraceStats* stats = nullptr) const;
+
+        // Packet versions of the queries above for up to kPacketSize coherent rays, e.g. the primary rays of a
+        // pixel block or the shadow rays towards one light. The rays of a packet share node fetches and are
+        // tested against each child box together. Once only one ray of the packet is left in a subtree it is
+        // finished with single ray traversal. Packets are traced one ray at a time with a bvh width of 2
+        static const int kPacketSize = 8;
+
+        void ClosestHitPacket(const Ray* rays, int count, State* states, LightSampleRec* lightSampleRecs, bool* hits, TraceStats* stats = nullptr) const;
+        void AnyHitPacket(const Ray* rays, const float* maxDists, int count, bool* occluded, TraceStats* stats = nullptr) const;
+
+        int GetBvhWidth() const { return bvhWidth; }
+
+    private:
+        struct Hit
+        {
+            float t;
+            int triIndex; // Index into vertIndices, -1 when nothing or a light was hit
+            int instance;
+            int matID;
+            float u, v;
+        };
+
+        // Fills in the surface state of the closest hit, returns false when nothing was hit
+        bool FinishHit(const Ray& r, const Hit& hit, State& state) const;
+
+        float IntersectLights(const Ray& r, State& state, LightSampleRec& lightSampleRec) const;
+        bool OccludedByLights(const Ray& r, float maxDist) const;
+
+        template <class Nodes>
+        void IntersectBinary(const Nodes& nodes, const Ray& r, Hit& hit, TraceStats& stats) const;
+
+        template <class Nodes>
+        bool OccludedBinary(const Nodes& nodes, const Ray& r, float maxDist, TraceStats& stats) const;
+
+        // Binary BVH through BvhTranslator::missLinks, same order as shaders/common/closest_hit.glsl with STACKLESS_BVH
+        template <bool anyHit>
+        bool TraverseStackless(const Ray& r, Hit& hit, TraceStats& stats) const;
+
+        template <int N, bool anyHit>
+        bool TraverseWide(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray& r, Hit& hit, TraceStats& stats) const;
+
+        template <int N, bool anyHit>
+        bool TraverseBlas(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray& r, int instance, int matID, Hit& hit, TraceStats& stats) const;
+
+        template <int N, bool anyHit>
+        void TraversePacket(const RadeonRays::WideBvhTranslator<N>& bvh, const Ray* rays, int rayMask, Hit* hits, TraceStats& stats) const;
+
+        template <int N, bool anyHit>
+        void TraversePacketBlas(const RadeonRays::WideBvhTranslator<N>& bvh, int root, const Ray* rays, int rayMask, int& active,
+            float* tHit, int instance, int matID, Hit* hits, TraceStats& stats) const;
+
+        const Scene *scene;
+        int bvhWidth;
+        int topBVHIndex;
+
+        RadeonRays::WideBvhTranslator<4> bvh4;
+        RadeonRays::WideBvhTranslator<8> bvh8;
+    };
+
+    void Onb(const Vec3& N, Vec3& T, Vec3& B);
+}
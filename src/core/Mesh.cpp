@@ -22,91 +22,75 @@
  * SOFTWARE.
  */
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-
 #include "Mesh.h"
+#include "ObjLoader.h"
+#include "lbvh.h"
 #include <iostream>
 
 namespace GLSLPT
 {
-    bool Mesh::LoadFromFile(const std::string &filename)
+    bool Mesh::LoadFromFile(const std::string &filename, ThreadPool* pool)
     {
         name = filename;
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string err;
-        bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str(), 0, true);
-
-        if (!ret)
-        {
-            printf("Unable to load model\n");
-            return false;
-        }
-
-        // Loop over shapes
-        for (size_t s = 0; s < shapes.size(); s++) 
-        {
-            // Loop over faces(polygon)
-            size_t index_offset = 0;
+        return LoadObj(filename, verticesUVX, normalsUVY, indices, pool);
+    }
 
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) 
-            {
-                int fv = shapes[s].mesh.num_face_vertices[f];
-                // Loop over vertices in the face.
-                for (size_t v = 0; v < fv; v++)
-                {
-                    // access to vertex
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                    tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-                    tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-                    tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-                    tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
-                    tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
-                    tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
+    void Mesh::SetBvhBuilder(BvhBuilder builder)
+    {
+        // Leaf settings carry over, so they may be set before or after the builder is chosen
+        int maxLeafSize = bvh ? bvh->GetMaxLeafSize() : RadeonRays::kMeshMaxLeafSize;
+        float leafCost = bvh ? bvh->GetLeafCost() : 0.0f;
 
-                    tinyobj::real_t tx, ty;
-                    
-                    // temporary fix
-                    if (!attrib.texcoords.empty())
-                    {
-                        tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-                        ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-                    }
-                    else
-                    {
-                        tx = ty = 0;
-                    }
+        delete bvh;
+        bvhBuilder = builder;
 
-                    verticesUVX.push_back(Vec4(vx, vy, vz, tx));
-                    normalsUVY.push_back(Vec4(nx, ny, nz, ty));
-                }
-    
-                index_offset += fv;
-            }
+        switch (builder)
+        {
+        case SahBuilder:
+            bvh = new RadeonRays::Bvh(2.0f, 64, true);
+            break;
+        case HlbvhBuilder:
+            bvh = new RadeonRays::LinearBvh(2.0f, true);
+            break;
+        case LbvhBuilder:
+            bvh = new RadeonRays::LinearBvh(2.0f, false);
+            break;
+        default:
+            bvh = new RadeonRays::SplitBvh(2.0f, 64, 0, 0.001f, 0);
+            break;
         }
 
-        return true;
+        bvh->SetLeafParams(maxLeafSize, leafCost);
     }
 
-    void Mesh::BuildBVH()
+    std::vector<RadeonRays::bbox> Mesh::triangleBounds(ThreadPool* pool) const
     {
-        const int numTris = verticesUVX.size() / 3;
+        const int numTris = NumTriangles();
         std::vector<RadeonRays::bbox> bounds(numTris);
 
-        #pragma omp parallel for
-        for (int i = 0; i < numTris; ++i)
+        ParallelFor(pool, 0, numTris, 4096, [this, &bounds](int i)
         {
-            const Vec3 v1 = Vec3(verticesUVX[i * 3 + 0]);
-            const Vec3 v2 = Vec3(verticesUVX[i * 3 + 1]);
-            const Vec3 v3 = Vec3(verticesUVX[i * 3 + 2]);
+            const Vec3 v1 = Vec3(verticesUVX[indices[i * 3 + 0]]);
+            const Vec3 v2 = Vec3(verticesUVX[indices[i * 3 + 1]]);
+            const Vec3 v3 = Vec3(verticesUVX[indices[i * 3 + 2]]);
 
             bounds[i].grow(v1);
             bounds[i].grow(v2);
             bounds[i].grow(v3);
-        }
+        });
+
+        return bounds;
+    }
 
-        bvh->Build(&bounds[0], numTris);
+    void Mesh::BuildBVH(ThreadPool* pool)
+    {
+        std::vector<RadeonRays::bbox> bounds = triangleBounds(pool);
+        bvh->Build(&bounds[0], bounds.size(), pool);
+    }
+
+    void Mesh::RefitBVH(ThreadPool* pool)
+    {
+        std::vector<RadeonRays::bbox> bounds = triangleBounds(pool);
+        bvh->Refit(&bounds[0], bounds.size(), pool);
     }
 }
\ No newline at end of file
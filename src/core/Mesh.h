@@ -24,11 +24,22 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include "split_bvh.h"
+#include "ThreadPool.h"
 
 namespace GLSLPT
 {    
+    // BVH builders a mesh can pick, from the slowest build and cheapest traversal to the opposite
+    enum BvhBuilder
+    {
+        SbvhBuilder,  // SplitBvh, binned SAH with spatial splits (default)
+        SahBuilder,   // Bvh, binned SAH
+        HlbvhBuilder, // LinearBvh, Morton code clusters joined by SAH
+        LbvhBuilder   // LinearBvh, Morton codes only
+    };
+
     class Mesh
     {
     public:
@@ -39,33 +50,48 @@ namespace GLSLPT
         }
         ~Mesh() { delete bvh; }
 
-        void BuildBVH();
-        bool LoadFromFile(const std::string& filename);
+        // Replaces the BVH with an empty one of the given builder, call before BuildBVH()
+        void SetBvhBuilder(BvhBuilder builder);
+        BvhBuilder GetBvhBuilder() const { return bvhBuilder; }
+        void BuildBVH(ThreadPool* pool = nullptr);
+        // Refits the BVH to the current vertices, e.g. after a skinning or simulation step moved them.
+        // Much cheaper than BuildBVH() but the tree gets worse the further triangles move from where it was built
+        void RefitBVH(ThreadPool* pool = nullptr);
+        // Large OBJ files are parsed in parallel on the pool
+        bool LoadFromFile(const std::string& filename, ThreadPool* pool = nullptr);
         
+        int NumTriangles() const { return (int)indices.size() / 3; }
         std::vector<Vec4> verticesUVX; // Vertex + texture Coord (u/s)
         std::vector<Vec4> normalsUVY;  // Normal + texture Coord (v/t)
+        std::vector<int> indices;      // Three vertices per triangle, corners sharing all OBJ attributes share a vertex
 
         RadeonRays::Bvh *bvh;
         std::string name;
+        uint64_t sourceHash = 0; // Contents of the source file while the vertices match it, see BvhCache
+
+    private:
+        BvhBuilder bvhBuilder = SbvhBuilder;
+        std::vector<RadeonRays::bbox> triangleBounds(ThreadPool* pool) const;
     };
 
+    // One entry of the scene's instance table. Names live in Scene::instanceNames, an instance array of millions
+    // of entries shares one of them
     class MeshInstance
     {
 
     public:
-        MeshInstance(std::string name, int meshId, Mat4 xform, int matId)
-            : name(name)
+        MeshInstance(int meshId, const Mat4& xform, int matId, int nameId = -1)
+            : transform(xform)
+            , materialID(matId)
             , meshID(meshId)
-            , transform(xform) 
-            , materialID(matId) 
+            , nameID(nameId)
         {
         }
-        ~MeshInstance() {}
 
         Mat4 transform;
-        std::string name;
 
         int materialID;
         int meshID;
+        int nameID;
     };
 }
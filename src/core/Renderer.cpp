@@ -39,6 +39,7 @@ namespace GLSLPT
 
     Renderer::Renderer(Scene *scene, const std::string& shadersDirectory) 
         : BVHTex(0)
+        , missLinksTex(0)
         , vertexIndicesTex(0)
         , verticesTex(0)
         , normalsTex(0)
@@ -72,6 +73,7 @@ namespace GLSLPT
         delete quad;
 
         glDeleteTextures(1, &BVHTex);
+        glDeleteTextures(1, &missLinksTex);
         glDeleteTextures(1, &vertexIndicesTex);
         glDeleteTextures(1, &verticesTex);
         glDeleteTextures(1, &normalsTex);
@@ -105,10 +107,24 @@ namespace GLSLPT
         //Create Buffer and Texture for BVH Tree
         glGenBuffers(1, &BVHBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-        glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * scene->bvhTranslator.nodes.size(), &scene->bvhTranslator.nodes[0], GL_STATIC_DRAW);
+        if (scene->bvhTranslator.compress)
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::CompressedNode) * scene->bvhTranslator.compressedNodes.size(), &scene->bvhTranslator.compressedNodes[0], GL_STATIC_DRAW);
+        else
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * scene->bvhTranslator.nodes.size(), &scene->bvhTranslator.nodes[0], GL_STATIC_DRAW);
         glGenTextures(1, &BVHTex);
         glBindTexture(GL_TEXTURE_BUFFER, BVHTex);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, BVHBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, BVHBuffer);
+
+        //Create Buffer and Texture for the skip links of stackless traversal
+        if (scene->bvhTranslator.stackless)
+        {
+            glGenBuffers(1, &missLinksBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, missLinksBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(int) * scene->bvhTranslator.missLinks.size(), &scene->bvhTranslator.missLinks[0], GL_STATIC_DRAW);
+            glGenTextures(1, &missLinksTex);
+            glBindTexture(GL_TEXTURE_BUFFER, missLinksTex);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, missLinksBuffer);
+        }
 
         //Create Buffer and Texture for VertexIndices
         glGenBuffers(1, &vertexIndicesBuffer);
@@ -142,13 +158,15 @@ namespace GLSLPT
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
 
-        //Create texture for Transforms
+        //Create Buffer and Texture for Transforms
+        // Only the inverses are read by the shaders. A buffer texture is not limited to the maximum texture
+        // width, which four texels per instance exceed after a few thousand instances
+        glGenBuffers(1, &transformsBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, transformsBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(Mat4) * scene->invTransforms.size(), &scene->invTransforms[0], GL_STATIC_DRAW);
         glGenTextures(1, &transformsTex);
-        glBindTexture(GL_TEXTURE_2D, transformsTex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Mat4) / sizeof(Vec4)) * scene->transforms.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->transforms[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, transformsTex);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformsBuffer);
 
         //Create texture for Lights
         if (numOfLights > 0)
@@ -205,16 +223,66 @@ namespace GLSLPT
     {
         if (scene->instancesModified)
         {
-            glBindTexture(GL_TEXTURE_2D, transformsTex);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (sizeof(Mat4) / sizeof(Vec4)) * scene->transforms.size(), 1, GL_RGBA, GL_FLOAT, &scene->transforms[0]);
+            // Only the transforms, vertices and BVH nodes changed by Scene::RebuildInstances() are uploaded.
+            // Added or removed instances change the size of the transforms and the TLAS, so their buffers are
+            // specified again instead. The buffer textures refer to the buffer objects and see the new store
+            glBindBuffer(GL_TEXTURE_BUFFER, transformsBuffer);
+            if (scene->instancesResized)
+                glBufferData(GL_TEXTURE_BUFFER, sizeof(Mat4) * scene->invTransforms.size(), scene->invTransforms.data(), GL_STATIC_DRAW);
+            else if (scene->dirtyInstancesEnd > scene->dirtyInstancesBegin)
+            {
+                int first = scene->dirtyInstancesBegin;
+                int count = scene->dirtyInstancesEnd - scene->dirtyInstancesBegin;
+                glBufferSubData(GL_TEXTURE_BUFFER, sizeof(Mat4) * first, sizeof(Mat4) * count, &scene->invTransforms[first]);
+            }
+
+            int firstVertex = scene->dirtyVerticesBegin;
+            int numVertices = scene->dirtyVerticesEnd - scene->dirtyVerticesBegin;
+            if (numVertices > 0)
+            {
+                glBindBuffer(GL_TEXTURE_BUFFER, verticesBuffer);
+                glBufferSubData(GL_TEXTURE_BUFFER, sizeof(Vec4) * firstVertex, sizeof(Vec4) * numVertices, &scene->verticesUVX[firstVertex]);
+                glBindBuffer(GL_TEXTURE_BUFFER, normalsBuffer);
+                glBufferSubData(GL_TEXTURE_BUFFER, sizeof(Vec4) * firstVertex, sizeof(Vec4) * numVertices, &scene->normalsUVY[firstVertex]);
+            }
 
             glBindTexture(GL_TEXTURE_2D, materialsTex);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (sizeof(Material) / sizeof(Vec4)) * scene->materials.size(), 1, 0, GL_RGBA, GL_FLOAT, &scene->materials[0]);
 
-            int index = scene->bvhTranslator.topLevelIndex;
-
             glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-            glBufferSubData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * index, sizeof(RadeonRays::BvhTranslator::Node) * (scene->bvhTranslator.nodes.size() - index), &scene->bvhTranslator.nodes[index]);
+            if (scene->instancesResized)
+            {
+                if (scene->bvhTranslator.compress)
+                    glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::CompressedNode) * scene->bvhTranslator.compressedNodes.size(), &scene->bvhTranslator.compressedNodes[0], GL_STATIC_DRAW);
+                else
+                    glBufferData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * scene->bvhTranslator.nodes.size(), &scene->bvhTranslator.nodes[0], GL_STATIC_DRAW);
+            }
+            else
+            {
+                for (const std::pair<int, int>& range : scene->bvhTranslator.dirtyRanges)
+                {
+                    int index = range.first;
+                    int numNodes = range.second - range.first;
+
+                    if (scene->bvhTranslator.compress)
+                        glBufferSubData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::CompressedNode) * index, sizeof(RadeonRays::BvhTranslator::CompressedNode) * numNodes, &scene->bvhTranslator.compressedNodes[index]);
+                    else
+                        glBufferSubData(GL_TEXTURE_BUFFER, sizeof(RadeonRays::BvhTranslator::Node) * index, sizeof(RadeonRays::BvhTranslator::Node) * numNodes, &scene->bvhTranslator.nodes[index]);
+                }
+            }
+
+            // The TLAS topology, and with it the links, only changes when it is rebuilt
+            if (scene->bvhTranslator.stackless && scene->instancesResized)
+            {
+                glBindBuffer(GL_TEXTURE_BUFFER, missLinksBuffer);
+                glBufferData(GL_TEXTURE_BUFFER, sizeof(int) * scene->bvhTranslator.missLinks.size(), &scene->bvhTranslator.missLinks[0], GL_STATIC_DRAW);
+            }
+            else if (scene->bvhTranslator.stackless && !scene->instancesRefitted)
+            {
+                int index = scene->bvhTranslator.topLevelIndex;
+                glBindBuffer(GL_TEXTURE_BUFFER, missLinksBuffer);
+                glBufferSubData(GL_TEXTURE_BUFFER, sizeof(int) * index, sizeof(int) * (scene->bvhTranslator.missLinks.size() - index), &scene->bvhTranslator.missLinks[index]);
+            }
         }
     }
 }
\ No newline at end of file
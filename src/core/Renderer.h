@@ -35,6 +35,14 @@ namespace GLSLPT
 {
     Program* LoadShaders(const ShaderInclude::ShaderSource& vertShaderObj, const ShaderInclude::ShaderSource& fragShaderObj);
 
+    // Order in which the CPU renderer hands out tiles
+    enum TileOrder
+    {
+        ScanlineOrder,
+        HilbertOrder,
+        CenterOutOrder
+    };
+
     struct RenderOptions
     {
         RenderOptions()
@@ -50,6 +58,14 @@ namespace GLSLPT
             RRDepth = 2;
             bgColor = Vec3(0.3f, 0.3f, 0.3f);
             enableDenoiser = true;
+            tileOrder = ScanlineOrder;
+            numThreads = 0;
+            bvhWidth = 4;
+            enableRayPackets = true;
+            compressedBvh = false;
+            stacklessBvh = false;
+            treeletBvh = false;
+            enableTraversalStats = false;
         }
         iVec2 resolution;
         int maxDepth;
@@ -62,6 +78,15 @@ namespace GLSLPT
         int RRDepth;
         float hdrMultiplier;
         Vec3 bgColor;
+        TileOrder tileOrder;
+        int numThreads; // CPU renderer and BVH build threads, 0 uses all cores
+        int bvhWidth;   // CPU renderer BVH branching factor: 2, 4 or 8
+        bool enableRayPackets; // CPU renderer traces the first bounce of pixel blocks as ray packets
+        bool compressedBvh;    // Traverse the quantized BvhTranslator::CompressedNode layout (GPU and binary CPU BVH)
+        bool stacklessBvh;     // Traverse the binary BVH through BvhTranslator::missLinks instead of a stack. Ignored with compressedBvh
+        bool treeletBvh;       // CPU renderer stores the 4/8-wide BVH nodes in page sized treelets instead of depth first
+        bool enableTraversalStats; // Per pixel node visits and triangle tests. The GPU renders them instead of the image
+        std::string bvhCacheDirectory; // Meshes and their BVHs are cached here across runs, empty disables the cache
     };
 
     class Scene;
@@ -77,6 +102,8 @@ namespace GLSLPT
 
         GLuint BVHBuffer;
         GLuint BVHTex;
+        GLuint missLinksBuffer;
+        GLuint missLinksTex;
         GLuint vertexIndicesBuffer;
         GLuint vertexIndicesTex;
         GLuint verticesBuffer;
@@ -84,6 +111,7 @@ namespace GLSLPT
         GLuint normalsBuffer;
         GLuint normalsTex;
         GLuint materialsTex;
+        GLuint transformsBuffer;
         GLuint transformsTex;
         GLuint lightsTex;
         GLuint textureMapsArrayTex;
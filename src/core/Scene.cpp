@@ -22,9 +22,13 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 
 #include "Scene.h"
+#include "BvhCache.h"
 #include "Camera.h"
 
 namespace GLSLPT
@@ -37,45 +41,37 @@ namespace GLSLPT
 
     int Scene::AddMesh(const std::string& filename)
     {
-        int id = -1;
-        // Check if mesh was already loaded
-        for (int i = 0; i < meshes.size(); i++)
-            if (meshes[i]->name == filename)
-                return i;
-            
-        id = meshes.size();
+        // Check if mesh was already requested
+        auto it = meshIDs.find(filename);
+        if (it != meshIDs.end())
+            return it->second;
+
+        int id = meshes.size();
 
+        // Loaded with the other requested assets in CreateAccelerationStructures(), until then only BVH settings can be changed
         Mesh* mesh = new Mesh;
+        mesh->name = filename;
+        meshes.push_back(mesh);
+        meshIDs[filename] = id;
+        pendingMeshes.push_back(id);
 
-        if (mesh->LoadFromFile(filename))
-        {
-            meshes.push_back(mesh);
-            printf("Model %s loaded\n", filename.c_str());
-        }
-        else
-            id = -1;
         return id;
     }
 
     int Scene::AddTexture(const std::string& filename)
     {
-        int id = -1;
-        // Check if texture was already loaded
-        for (int i = 0; i < textures.size(); i++)
-            if (textures[i]->name == filename)
-                return i;
+        // Check if texture was already requested
+        auto it = textureIDs.find(filename);
+        if (it != textureIDs.end())
+            return it->second;
 
-        id = textures.size();
+        int id = textures.size();
 
         Texture* texture = new Texture;
-
-        if (texture->LoadTexture(filename))
-        {
-            textures.push_back(texture);
-            printf("Texture %s loaded\n", filename.c_str());
-        }
-        else
-            id = -1;
+        texture->name = filename;
+        textures.push_back(texture);
+        textureIDs[filename] = id;
+        pendingTextures.push_back(id);
 
         return id;
     }
@@ -89,24 +85,45 @@ namespace GLSLPT
 
     void Scene::AddHDR(const std::string& filename)
     {
-        delete hdrData;
-        hdrData = HDRLoader::load(filename.c_str());
-        if (hdrData == nullptr)
-            printf("Unable to load HDR\n");
-        else
-        {
-            printf("HDR %s loaded\n", filename.c_str());
-            renderOptions.useEnvMap = true;
-        }
+        // Loaded next to the meshes and textures in CreateAccelerationStructures()
+        pendingHDR = filename;
+    }
+
+    int Scene::addInstanceName(const std::string& name)
+    {
+        auto it = instanceNameIDs.find(name);
+        if (it != instanceNameIDs.end())
+            return it->second;
+
+        int id = instanceNames.size();
+        instanceNames.push_back(name);
+        instanceNameIDs[name] = id;
+        return id;
+    }
+
+    int Scene::AddMeshInstance(const std::string &name, int meshID, const Mat4 &transform, int materialID)
+    {
+        int id = meshInstances.size();
+        meshInstances.push_back(MeshInstance(meshID, transform, materialID, addInstanceName(name)));
+        return id;
     }
 
-    int Scene::AddMeshInstance(const MeshInstance &meshInstance)
+    int Scene::AddMeshInstances(const std::string &name, int meshID, const Mat4 *transforms, int count, int materialID)
     {
         int id = meshInstances.size();
-        meshInstances.push_back(meshInstance);
+        int nameID = addInstanceName(name);
+        for (int i = 0; i < count; i++)
+            meshInstances.push_back(MeshInstance(meshID, transforms[i], materialID, nameID));
         return id;
     }
 
+    const std::string& Scene::GetInstanceName(int instanceID) const
+    {
+        static const std::string unnamed;
+        int nameID = meshInstances[instanceID].nameID;
+        return nameID >= 0 && nameID < instanceNames.size() ? instanceNames[nameID] : unnamed;
+    }
+
     int Scene::AddLight(const Light &light)
     {
         int id = lights.size();
@@ -114,14 +131,27 @@ namespace GLSLPT
         return id;
     }
 
-    void Scene::createTLAS()
+    // A refitted TLAS is rebuilt once its SAH cost grows past this factor of the cost after its last build
+    static const float kTlasRefitCostLimit = 1.5f;
+
+    ThreadPool* Scene::GetWorkerPool()
     {
-        // Loop through all the mesh Instances and build a Top Level BVH
-        std::vector<RadeonRays::bbox> bounds;
-        bounds.resize(meshInstances.size());
+        // Restarted if the thread count was changed since, e.g. for a renderer set up after loading
+        if (workerPool == nullptr || workerPoolThreads != renderOptions.numThreads)
+        {
+            delete workerPool;
+            workerPool = new ThreadPool(renderOptions.numThreads);
+            workerPoolThreads = renderOptions.numThreads;
+        }
+        return workerPool;
+    }
 
-        #pragma omp parallel for
-        for (int i = 0; i < meshInstances.size(); i++)
+    void Scene::updateInstanceBounds()
+    {
+        // World space bounds of every mesh instance, the primitives of the Top Level BVH
+        instanceBounds.resize(meshInstances.size());
+
+        ParallelFor(GetWorkerPool(), 0, (int)meshInstances.size(), 1024, [this](int i)
         {
             RadeonRays::bbox bbox = meshes[meshInstances[i].meshID]->bvh->Bounds();
             Mat4 matrix = meshInstances[i].transform;
@@ -150,63 +180,331 @@ namespace GLSLPT
             bound.pmin = minBound;
             bound.pmax = maxBound;
 
-            bounds[i] = bound;
+            instanceBounds[i] = bound;
+        });
+    }
+
+    void Scene::createTLAS()
+    {
+        sceneBvh->Build(&instanceBounds[0], instanceBounds.size(), GetWorkerPool());
+        sceneBounds = sceneBvh->Bounds();
+        tlasBuildCost = sceneBvh->SahCost();
+    }
+
+    bool Scene::refitTLAS()
+    {
+        sceneBvh->Refit(&instanceBounds[0], instanceBounds.size(), GetWorkerPool());
+
+        float cost = sceneBvh->SahCost();
+        if (cost > tlasBuildCost * kTlasRefitCostLimit)
+        {
+            printf("TLAS SAH cost grew from %.1f to %.1f, rebuilding\n", tlasBuildCost, cost);
+            return false;
         }
-        sceneBvh->Build(&bounds[0], bounds.size());
+
         sceneBounds = sceneBvh->Bounds();
+        return true;
     }
 
-    void Scene::createBLAS()
+    bool Scene::loadMesh(Mesh* mesh, ThreadPool* pool)
     {
-        // Loop through all meshes and build BVHs
-        #pragma omp parallel for
+        // With a BVH cache the OBJ is only parsed if the cache has no entry for its contents
+        bool cached = false;
+        if (!renderOptions.bvhCacheDirectory.empty() && BvhCache::HashFile(mesh->name, mesh->sourceHash))
+            cached = BvhCache(renderOptions.bvhCacheDirectory).LoadVertices(mesh);
+
+        if (!cached && !mesh->LoadFromFile(mesh->name, pool))
+            return false;
+
+        printf("Model %s loaded%s : %d triangles, %zu vertices\n", mesh->name.c_str(), cached ? " from cache" : "", mesh->NumTriangles(), mesh->verticesUVX.size());
+        return true;
+    }
+
+    void Scene::createBLAS(Mesh* mesh, ThreadPool* pool)
+    {
+        // Large meshes split their own build across the pool
+        BvhCache cache(renderOptions.bvhCacheDirectory);
+        bool cacheable = !renderOptions.bvhCacheDirectory.empty() && mesh->sourceHash != 0;
+
+        if (cacheable && cache.LoadBVH(mesh))
+        {
+            printf("Loaded cached BVH for %s\n", mesh->name.c_str());
+            return;
+        }
+
+        printf("Building BVH for %s\n", mesh->name.c_str());
+        mesh->BuildBVH(pool);
+
+        if (cacheable && !cache.Store(mesh))
+            printf("Unable to cache the BVH of %s in %s\n", mesh->name.c_str(), renderOptions.bvhCacheDirectory.c_str());
+    }
+
+    void Scene::loadAssets(ThreadPool* pool)
+    {
+        // One task per requested file. A mesh goes straight on to its BVH build, so builds overlap the loads still running
+        std::vector<char> meshLoaded(meshes.size(), 1);
+        std::vector<char> textureLoaded(textures.size(), 1);
+
+        // The environment map builds its sampling distributions on the pool as well
+        std::string hdrFile = pendingHDR;
+        Future<HDRData*> hdr = Async(pool, [hdrFile, pool]
+        {
+            return hdrFile.empty() ? nullptr : HDRLoader::load(hdrFile.c_str(), pool);
+        });
+
+        TaskGroup group(pool);
+        for (int i : pendingMeshes)
+        {
+            group.Run([this, i, pool, &meshLoaded]
+            {
+                meshLoaded[i] = loadMesh(meshes[i], pool);
+                if (meshLoaded[i])
+                    createBLAS(meshes[i], pool);
+            });
+        }
+        for (int i : pendingTextures)
+        {
+            group.Run([this, i, &textureLoaded]
+            {
+                textureLoaded[i] = textures[i]->LoadTexture(textures[i]->name);
+                if (textureLoaded[i])
+                    printf("Texture %s loaded\n", textures[i]->name.c_str());
+            });
+        }
+        group.Wait();
+
+        if (!pendingHDR.empty())
+        {
+            delete hdrData;
+            hdrData = hdr.Get();
+            if (hdrData == nullptr)
+                printf("Unable to load HDR\n");
+            else
+            {
+                printf("HDR %s loaded\n", pendingHDR.c_str());
+                renderOptions.useEnvMap = true;
+            }
+        }
+
+        pendingMeshes.clear();
+        pendingTextures.clear();
+        pendingHDR.clear();
+
+        if (std::find(meshLoaded.begin(), meshLoaded.end(), 0) != meshLoaded.end() ||
+            std::find(textureLoaded.begin(), textureLoaded.end(), 0) != textureLoaded.end())
+            removeFailedAssets(meshLoaded, textureLoaded);
+    }
+
+    void Scene::removeFailedAssets(const std::vector<char>& meshLoaded, const std::vector<char>& textureLoaded)
+    {
+        // IDs were handed out before loading. Later assets move down into the gaps and the instances
+        // of a missing mesh are dropped, materials lose a missing texture
+        std::vector<int> meshRemap(meshes.size(), -1);
+        int numMeshes = 0;
         for (int i = 0; i < meshes.size(); i++)
         {
-            printf("Building BVH for %s\n", meshes[i]->name.c_str());
-            meshes[i]->BuildBVH();
+            if (meshLoaded[i])
+            {
+                meshRemap[i] = numMeshes;
+                meshes[numMeshes++] = meshes[i];
+            }
+            else
+                delete meshes[i];
+        }
+        meshes.resize(numMeshes);
+
+        std::vector<int> textureRemap(textures.size(), -1);
+        int numTextures = 0;
+        for (int i = 0; i < textures.size(); i++)
+        {
+            if (textureLoaded[i])
+            {
+                textureRemap[i] = numTextures;
+                textures[numTextures++] = textures[i];
+            }
+            else
+            {
+                printf("Unable to load texture %s\n", textures[i]->name.c_str());
+                delete textures[i];
+            }
+        }
+        textures.resize(numTextures);
+
+        int numInstances = 0;
+        for (int i = 0; i < meshInstances.size(); i++)
+        {
+            MeshInstance& instance = meshInstances[i];
+            instance.meshID = meshRemap[instance.meshID];
+            if (instance.meshID != -1)
+                meshInstances[numInstances++] = instance;
+        }
+        meshInstances.erase(meshInstances.begin() + numInstances, meshInstances.end());
+
+        auto remapTexture = [&textureRemap](float& texID)
+        {
+            if (texID >= 0.0f)
+                texID = (float)textureRemap[(int)texID];
+        };
+        for (Material& material : materials)
+        {
+            remapTexture(material.albedoTexID);
+            remapTexture(material.metallicRoughnessTexID);
+            remapTexture(material.normalmapTexID);
+        }
+
+        meshIDs.clear();
+        for (int i = 0; i < meshes.size(); i++)
+            meshIDs[meshes[i]->name] = i;
+        textureIDs.clear();
+        for (int i = 0; i < textures.size(); i++)
+            textureIDs[textures[i]->name] = i;
+    }
+
+    void Scene::refitBLAS()
+    {
+        dirtyVerticesBegin = dirtyVerticesEnd = 0;
+        if (modifiedMeshes.empty())
+            return;
+
+        ThreadPool* pool = GetWorkerPool();
+
+        // Refit the meshes side by side, large ones also split their own refit across the pool
+        TaskGroup group(pool);
+        for (int meshID : modifiedMeshes)
+            group.Run([this, meshID, pool] { meshes[meshID]->RefitBVH(pool); });
+        group.Wait();
+
+        for (int meshID : modifiedMeshes)
+        {
+            const Mesh* mesh = meshes[meshID];
+            bvhTranslator.UpdateBLAS(meshID);
+
+            int first = meshVertexOffsets[meshID];
+            std::copy(mesh->verticesUVX.begin(), mesh->verticesUVX.end(), verticesUVX.begin() + first);
+            std::copy(mesh->normalsUVY.begin(), mesh->normalsUVY.end(), normalsUVY.begin() + first);
+
+            int last = first + (int)mesh->verticesUVX.size();
+            if (dirtyVerticesBegin == dirtyVerticesEnd)
+            {
+                dirtyVerticesBegin = first;
+                dirtyVerticesEnd = last;
+            }
+            else
+            {
+                dirtyVerticesBegin = std::min(dirtyVerticesBegin, first);
+                dirtyVerticesEnd = std::max(dirtyVerticesEnd, last);
+            }
         }
+
+        modifiedMeshes.clear();
+    }
+
+    bool Scene::UpdateMeshVertices(int meshID, const std::vector<Vec4>& newVerticesUVX, const std::vector<Vec4>& newNormalsUVY)
+    {
+        if (meshID < 0 || meshID >= meshes.size())
+        {
+            printf("Unable to update mesh %d, no such mesh\n", meshID);
+            return false;
+        }
+
+        Mesh* mesh = meshes[meshID];
+        if (newVerticesUVX.size() != mesh->verticesUVX.size() || newNormalsUVY.size() != mesh->normalsUVY.size())
+        {
+            printf("Unable to update mesh %s, the vertex count changed\n", mesh->name.c_str());
+            return false;
+        }
+
+        mesh->verticesUVX = newVerticesUVX;
+        mesh->normalsUVY = newNormalsUVY;
+        mesh->sourceHash = 0;
+
+        if (std::find(modifiedMeshes.begin(), modifiedMeshes.end(), meshID) == modifiedMeshes.end())
+            modifiedMeshes.push_back(meshID);
+        return true;
     }
     
     void Scene::RebuildInstances()
     {
-        delete sceneBvh;
-        sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
-
-        createTLAS();
+        auto start = std::chrono::steady_clock::now();
+
+        // Deformed meshes first, their new bounds feed into the instance bounds. The renderer uploads the
+        // nodes both passes change
+        bvhTranslator.dirtyRanges.clear();
+        refitBLAS();
+
+        // Transform, mesh, vertex and material edits keep the TLAS topology valid, so it is refitted unless
+        // instances were added or removed. Then the TLAS is built again and the translator grows or shrinks
+        // its nodes to match. A resize not yet uploaded by the renderer stays pending
+        instancesResized = (instancesModified && instancesResized) || transforms.size() != meshInstances.size();
+        bool canRefit = instanceBounds.size() == meshInstances.size();
+        updateInstanceBounds();
+
+        instancesRefitted = canRefit && refitTLAS();
+        if (!instancesRefitted)
+            createTLAS();
         bvhTranslator.UpdateTLAS(sceneBvh, meshInstances);
 
-        //Copy transforms
+        // Copy transforms, only changed instances need a new inverse and an upload
+        transforms.resize(meshInstances.size());
+        invTransforms.resize(meshInstances.size());
+        dirtyInstancesBegin = dirtyInstancesEnd = 0;
         for (int i = 0; i < meshInstances.size(); i++)
+        {
+            if (memcmp(&transforms[i], &meshInstances[i].transform, sizeof(Mat4)) == 0)
+                continue;
+
             transforms[i] = meshInstances[i].transform;
+            invTransforms[i] = Mat4::Inverse(transforms[i]);
+
+            if (dirtyInstancesBegin == dirtyInstancesEnd)
+                dirtyInstancesBegin = i;
+            dirtyInstancesEnd = i + 1;
+        }
 
         instancesModified = true;
+        instanceUpdateTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
     }
 
     void Scene::CreateAccelerationStructures()
     {
-        createBLAS();
+        loadAssets(GetWorkerPool());
 
         printf("Building scene BVH\n");
+        updateInstanceBounds();
         createTLAS();
 
         // Flatten BVH
+        bvhTranslator.compress = renderOptions.compressedBvh;
+        bvhTranslator.stackless = renderOptions.stacklessBvh && !renderOptions.compressedBvh;
+        if (renderOptions.stacklessBvh && renderOptions.compressedBvh)
+            printf("Stackless traversal needs the uncompressed BVH, using the stack\n");
         bvhTranslator.Process(sceneBvh, meshes, meshInstances);
 
+        printf("BVH nodes : %zu (%.2f MB)\n", bvhTranslator.nodes.size(), bvhTranslator.nodes.size() * sizeof(RadeonRays::BvhTranslator::Node) / (1024.0 * 1024.0));
+        if (bvhTranslator.compress)
+            printf("Compressed BVH nodes : %zu (%.2f MB)\n", bvhTranslator.compressedNodes.size(), bvhTranslator.compressedNodes.size() * sizeof(RadeonRays::BvhTranslator::CompressedNode) / (1024.0 * 1024.0));
+        if (bvhTranslator.stackless)
+            printf("BVH miss links : %zu (%.2f MB)\n", bvhTranslator.missLinks.size(), bvhTranslator.missLinks.size() * sizeof(int) / (1024.0 * 1024.0));
+
         int verticesCnt = 0;
 
         //Copy mesh data
+        meshVertexOffsets.clear();
         for (int i = 0; i < meshes.size(); i++)
         {
-            // Copy indices from BVH and not from Mesh
+            meshVertexOffsets.push_back(verticesCnt);
+
+            // Copy triangles in BVH order and not in Mesh order
             int numIndices = meshes[i]->bvh->GetNumIndices();
             const int * triIndices = meshes[i]->bvh->GetIndices();
+            const int * meshIndices = meshes[i]->indices.data();
 
             for (int j = 0; j < numIndices; j++)
             {
                 int index = triIndices[j];
-                int v1 = (index * 3 + 0) + verticesCnt;
-                int v2 = (index * 3 + 1) + verticesCnt;
-                int v3 = (index * 3 + 2) + verticesCnt;
+                int v1 = meshIndices[index * 3 + 0] + verticesCnt;
+                int v2 = meshIndices[index * 3 + 1] + verticesCnt;
+                int v3 = meshIndices[index * 3 + 2] + verticesCnt;
 
                 vertIndices.push_back(Indices{ v1, v2, v3 });
             }
@@ -217,11 +515,17 @@ namespace GLSLPT
             verticesCnt += meshes[i]->verticesUVX.size();
         }
 
+        printf("Triangles : %zu (%.2f MB), vertices : %zu (%.2f MB)\n", vertIndices.size(), vertIndices.size() * sizeof(Indices) / (1024.0 * 1024.0),
+            verticesUVX.size(), verticesUVX.size() * 2 * sizeof(Vec4) / (1024.0 * 1024.0));
+
         //Copy transforms
         transforms.resize(meshInstances.size());
-        #pragma omp parallel for
-        for (int i = 0; i < meshInstances.size(); i++)
+        invTransforms.resize(meshInstances.size());
+        ParallelFor(GetWorkerPool(), 0, (int)meshInstances.size(), 1024, [this](int i)
+        {
             transforms[i] = meshInstances[i].transform;
+            invTransforms[i] = Mat4::Inverse(transforms[i]);
+        });
 
         //Copy Textures
         for (int i = 0; i < textures.size(); i++)
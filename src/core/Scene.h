@@ -27,6 +27,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "hdrloader.h"
 #include "bvh.h"
 #include "Renderer.h"
@@ -69,19 +70,44 @@ namespace GLSLPT
         Scene() : camera(nullptr), hdrData(nullptr) {
             sceneBvh = new RadeonRays::Bvh(10.0f, 64, false);
         }
-        ~Scene() { delete camera; delete sceneBvh; delete hdrData; };
+        ~Scene() { delete camera; delete sceneBvh; delete hdrData; delete workerPool; };
 
+        // Meshes and textures are only requested here, the returned ID stays valid unless the file fails to load.
+        // CreateAccelerationStructures() loads all requested files side by side on the worker threads
         int AddMesh(const std::string &filename);
         int AddTexture(const std::string &filename);
         int AddMaterial(const Material &material);
-        int AddMeshInstance(const MeshInstance &meshInstance);
+        // Instances with the same name share one entry of instanceNames
+        int AddMeshInstance(const std::string &name, int meshID, const Mat4 &transform, int materialID);
+        // Adds count instances of one mesh and material under one name, e.g. read from a transform file.
+        // Returns the ID of the first
+        int AddMeshInstances(const std::string &name, int meshID, const Mat4 *transforms, int count, int materialID);
         int AddLight(const Light &light);
 
         void AddCamera(Vec3 eye, Vec3 lookat, float fov);
+        // Replaces the environment map once CreateAccelerationStructures() loads it
         void AddHDR(const std::string &filename);
 
         void CreateAccelerationStructures();
+        // Updates the TLAS, transforms and materials after instances were edited and refits the BVHs of
+        // meshes passed to UpdateMeshVertices()
         void RebuildInstances();
+        // Replaces the vertices and normals of a mesh, e.g. after a skinning or simulation step. The vertex
+        // count must not change. Takes effect with the next RebuildInstances()
+        bool UpdateMeshVertices(int meshID, const std::vector<Vec4>& verticesUVX, const std::vector<Vec4>& normalsUVY);
+
+        const RadeonRays::Bvh* GetSceneBvh() const { return sceneBvh; }
+        const std::string& GetInstanceName(int instanceID) const;
+
+        // Threads for loading, BVH builds and CPU rendering, renderOptions.numThreads of them. Created on first use,
+        // call only from the thread that owns the scene
+        ThreadPool* GetWorkerPool();
+
+        // Writes the scene after CreateAccelerationStructures() as one file: the renderer arrays, the BVHs and
+        // the options and camera it was loaded with
+        bool SaveBundle(const std::string &filename) const;
+        // Restores an empty scene from SaveBundle() instead of loading and building it
+        bool LoadBundle(const std::string &filename);
 
         //Options
         RenderOptions renderOptions;
@@ -94,11 +120,20 @@ namespace GLSLPT
         std::vector<Vec4> verticesUVX; // Vertex Data + x coord of uv 
         std::vector<Vec4> normalsUVY;  // Normal Data + y coord of uv
         std::vector<Mat4> transforms;
+        std::vector<Mat4> invTransforms; // Moves rays into instance space, transposed upper 3x3 is the normal matrix
 
         //Instances
         std::vector<Material> materials;
         std::vector<MeshInstance> meshInstances;
+        std::vector<std::string> instanceNames; // Indexed by MeshInstance::nameID
         bool instancesModified = false;
+        bool instancesRefitted = false;   // The last RebuildInstances() refitted the TLAS instead of building it
+        bool instancesResized = false;    // The last RebuildInstances() added or removed instances
+        float instanceUpdateTime = 0.0f;  // Seconds spent in the last RebuildInstances()
+        int dirtyInstancesBegin = 0;      // Transforms changed by the last RebuildInstances()
+        int dirtyInstancesEnd = 0;
+        int dirtyVerticesBegin = 0;       // Vertices and normals changed by the last RebuildInstances()
+        int dirtyVerticesEnd = 0;
 
         //Lights
         std::vector<Light> lights;
@@ -121,7 +156,26 @@ namespace GLSLPT
 
     private:
         RadeonRays::Bvh *sceneBvh;
-        void createBLAS();
+        std::vector<RadeonRays::bbox> instanceBounds;
+        float tlasBuildCost = 0.0f;
+        std::vector<int> meshVertexOffsets; // First vertex of each mesh in verticesUVX
+        std::vector<int> modifiedMeshes;    // Meshes waiting for a refit in RebuildInstances()
+        ThreadPool* workerPool = nullptr;
+        int workerPoolThreads = 0;
+        std::unordered_map<std::string, int> meshIDs;    // Requested files by name
+        std::unordered_map<std::string, int> textureIDs;
+        std::unordered_map<std::string, int> instanceNameIDs;
+        int addInstanceName(const std::string& name);
+        std::vector<int> pendingMeshes;     // Requested but not loaded yet
+        std::vector<int> pendingTextures;
+        std::string pendingHDR;
+        bool loadMesh(Mesh* mesh, ThreadPool* pool);
+        void createBLAS(Mesh* mesh, ThreadPool* pool);
+        void loadAssets(ThreadPool* pool);
+        void removeFailedAssets(const std::vector<char>& meshLoaded, const std::vector<char>& textureLoaded);
+        void refitBLAS();
+        void updateInstanceBounds();
         void createTLAS();
+        bool refitTLAS();
     };
 }
\ No newline at end of file
@@ -0,0 +1,707 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "Scene.h"
+#include "MappedFile.h"
+
+namespace GLSLPT
+{
+    // Bump whenever a section below or one of the structs stored in it changes, older bundles are then rejected
+    static const uint32_t kBundleVersion = 3;
+    static const char kBundleMagic[8] = { 'G', 'L', 'S', 'L', 'P', 'T', 'S', 'B' };
+    // Section data starts on cache line boundaries, the mapping itself is page aligned
+    static const uint64_t kBundleAlignment = 64;
+
+    // A bundle is a header, a table with one entry per section in this order and the section data.
+    // Sections hold plain arrays of the in-memory types, so loading is a copy per array
+    enum BundleSectionId
+    {
+        SceneSection,           // BundleScene
+        MeshSection,            // BundleMesh
+        MeshNodeSection,        // Bvh::PackedNode of all mesh BVHs
+        MeshIndexSection,       // Bvh::GetIndices() of all mesh BVHs
+        MeshTriangleSection,    // Mesh::indices of all meshes
+        InstanceSection,        // BundleInstance
+        TextureSection,         // BundleTexture
+        NameSection,            // Names of meshes, instances and textures
+        TlasNodeSection,        // Bvh::PackedNode of the top level BVH
+        TlasIndexSection,
+        BvhNodeSection,         // BvhTranslator::nodes
+        CompressedNodeSection,  // BvhTranslator::compressedNodes
+        MissLinkSection,        // BvhTranslator::missLinks
+        VertIndexSection,
+        VertexSection,
+        NormalSection,
+        TransformSection,
+        InvTransformSection,
+        MaterialSection,
+        LightSection,
+        TextureMapSection,
+        HdrColorSection,
+        HdrMarginalSection,
+        HdrConditionalSection,
+        NumBundleSections
+    };
+
+    struct BundleHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t numSections;
+        uint64_t fileSize;
+    };
+
+    struct BundleSection
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t elementSize; // Catches structs laid out differently by the writer and the reader
+        uint32_t padding;
+    };
+
+    // Render options, camera and the scalars of Scene
+    struct BundleScene
+    {
+        int32_t resolution[2];
+        int32_t maxDepth;
+        int32_t tileWidth;
+        int32_t tileHeight;
+        int32_t RRDepth;
+        int32_t tileOrder;
+        int32_t numThreads;
+        int32_t bvhWidth;
+        float hdrMultiplier;
+        Vec3 bgColor;
+        uint8_t useEnvMap;
+        uint8_t enableRR;
+        uint8_t enableDenoiser;
+        uint8_t useConstantBg;
+        uint8_t enableRayPackets;
+        uint8_t compressedBvh;
+        uint8_t stacklessBvh;
+        uint8_t treeletBvh;
+        uint8_t enableTraversalStats;
+
+        // Camera pose as rendered, the pivot restores its orbit controls
+        Vec3 cameraPosition;
+        Vec3 cameraUp;
+        Vec3 cameraRight;
+        Vec3 cameraForward;
+        Vec3 cameraPivot;
+        float cameraFov;
+        float cameraFocalDist;
+        float cameraAperture;
+
+        int32_t topLevelIndex;
+        int32_t compressedNodes;
+        int32_t missLinks;
+        int32_t texWidth;
+        int32_t texHeight;
+        int32_t hdrWidth;
+        int32_t hdrHeight;
+        Vec3 sceneBoundsMin;
+        Vec3 sceneBoundsMax;
+    };
+
+    struct BundleMesh
+    {
+        int32_t bvhBuilder;
+        int32_t maxLeafSize;
+        float leafCost;
+        int32_t firstVertex;    // Range in verticesUVX and normalsUVY
+        int32_t numVertices;
+        int32_t firstNode;      // Range in the mesh node section
+        int32_t numNodes;
+        int32_t firstIndex;     // Range in the mesh index section, also the first triangle in vertIndices
+        int32_t numIndices;
+        int32_t firstTriangle;  // Range in the mesh triangle section, in triangles
+        int32_t numTriangles;
+        int32_t rootNode;       // BLAS root in BvhTranslator::nodes
+        int32_t nameOffset;
+        int32_t nameLength;
+    };
+
+    struct BundleInstance
+    {
+        Mat4 transform;
+        int32_t meshID;
+        int32_t materialID;
+        int32_t nameOffset;
+        int32_t nameLength;
+    };
+
+    struct BundleTexture
+    {
+        int32_t width;
+        int32_t height;
+        int32_t nameOffset;
+        int32_t nameLength;
+    };
+
+    namespace
+    {
+        struct SectionData
+        {
+            const void* data;
+            size_t elementSize;
+            size_t count;
+        };
+
+        template <class T, class A>
+        SectionData Section(const std::vector<T, A>& v)
+        {
+            return SectionData{ v.data(), sizeof(T), v.size() };
+        }
+
+        template <class T>
+        SectionData Section(const T* data, size_t count)
+        {
+            return SectionData{ data, sizeof(T), count };
+        }
+
+        void AddName(std::vector<char>& names, const std::string& name, int32_t& offset, int32_t& length)
+        {
+            offset = (int32_t)names.size();
+            length = (int32_t)name.size();
+            names.insert(names.end(), name.begin(), name.end());
+        }
+
+        // Typed view of one section of a mapped bundle
+        class BundleReader
+        {
+        public:
+            bool Open(const std::string& filename)
+            {
+                if (!file.Open(filename) || file.Size() < sizeof(BundleHeader) + NumBundleSections * sizeof(BundleSection))
+                    return false;
+
+                const BundleHeader* header = (const BundleHeader*)file.Data();
+                if (memcmp(header->magic, kBundleMagic, sizeof(kBundleMagic)) != 0 || header->version != kBundleVersion ||
+                    header->numSections != NumBundleSections || header->fileSize != file.Size())
+                    return false;
+
+                sections = (const BundleSection*)(header + 1);
+                for (int i = 0; i < NumBundleSections; i++)
+                {
+                    const BundleSection& s = sections[i];
+                    if (s.offset % kBundleAlignment != 0 || s.offset > file.Size() || s.size > file.Size() - s.offset ||
+                        s.elementSize == 0 || s.size % s.elementSize != 0)
+                        return false;
+                }
+                return true;
+            }
+
+            // Returns false if the section does not hold elements of type T
+            template <class T>
+            bool Get(BundleSectionId id, const T*& data, size_t& count) const
+            {
+                const BundleSection& s = sections[id];
+                if (s.elementSize != sizeof(T))
+                    return false;
+                data = (const T*)(file.Data() + s.offset);
+                count = s.size / sizeof(T);
+                return true;
+            }
+
+            template <class T, class A>
+            bool Get(BundleSectionId id, std::vector<T, A>& v) const
+            {
+                const T* data;
+                size_t count;
+                if (!Get(id, data, count))
+                    return false;
+                v.assign(data, data + count);
+                return true;
+            }
+
+        private:
+            MappedFile file;
+            const BundleSection* sections = nullptr;
+        };
+
+        // Walks the restored tree stored in nodes [first, end) the way the traversals do and checks every index they
+        // follow. Children and miss links always come after their node in depth first order, so a walk that only
+        // moves forward can't loop either. validLeaf checks what a leaf points at
+        template <class LeafCheck>
+        bool ValidTree(const RadeonRays::BvhTranslator& translator, int first, int end, LeafCheck validLeaf)
+        {
+            const auto& nodes = translator.nodes;
+            const auto& compressed = translator.compressedNodes;
+            const auto& missLinks = translator.missLinks;
+
+            std::vector<int> stack(1, first);
+            int visited = 0;
+            while (!stack.empty())
+            {
+                int index = stack.back();
+                stack.pop_back();
+                if (index < first || index >= end || ++visited > end - first)
+                    return false;
+
+                const RadeonRays::BvhTranslator::Node& node = nodes[index];
+                if (!missLinks.empty() && missLinks[index] != -1 && (missLinks[index] <= index || missLinks[index] >= end))
+                    return false;
+
+                if (node.count != 0)
+                {
+                    if (!compressed.empty() && (compressed[index].header[0] != node.offset ||
+                        compressed[index].header[1] != node.count || compressed[index].header[3] != -1))
+                        return false;
+                    if (!validLeaf(index, node))
+                        return false;
+                    continue;
+                }
+
+                // The left child is the next node
+                if (node.offset <= index + 1 || (!compressed.empty() && compressed[index].header[3] != node.offset))
+                    return false;
+                stack.push_back(node.offset);
+                stack.push_back(index + 1);
+            }
+            return true;
+        }
+    }
+
+    bool Scene::SaveBundle(const std::string& filename) const
+    {
+        BundleScene info = {};
+        info.resolution[0] = renderOptions.resolution.x;
+        info.resolution[1] = renderOptions.resolution.y;
+        info.maxDepth = renderOptions.maxDepth;
+        info.tileWidth = renderOptions.tileWidth;
+        info.tileHeight = renderOptions.tileHeight;
+        info.RRDepth = renderOptions.RRDepth;
+        info.tileOrder = renderOptions.tileOrder;
+        info.numThreads = renderOptions.numThreads;
+        info.bvhWidth = renderOptions.bvhWidth;
+        info.hdrMultiplier = renderOptions.hdrMultiplier;
+        info.bgColor = renderOptions.bgColor;
+        info.useEnvMap = renderOptions.useEnvMap;
+        info.enableRR = renderOptions.enableRR;
+        info.enableDenoiser = renderOptions.enableDenoiser;
+        info.useConstantBg = renderOptions.useConstantBg;
+        info.enableRayPackets = renderOptions.enableRayPackets;
+        info.compressedBvh = renderOptions.compressedBvh;
+        info.stacklessBvh = renderOptions.stacklessBvh;
+        info.treeletBvh = renderOptions.treeletBvh;
+        info.enableTraversalStats = renderOptions.enableTraversalStats;
+
+        info.cameraPosition = camera->position;
+        info.cameraUp = camera->up;
+        info.cameraRight = camera->right;
+        info.cameraForward = camera->forward;
+        info.cameraPivot = camera->GetPivot();
+        info.cameraFov = camera->fov;
+        info.cameraFocalDist = camera->focalDist;
+        info.cameraAperture = camera->aperture;
+
+        info.topLevelIndex = bvhTranslator.topLevelIndex;
+        info.compressedNodes = bvhTranslator.compress;
+        info.missLinks = bvhTranslator.stackless;
+        info.texWidth = textures.empty() ? 0 : texWidth;
+        info.texHeight = textures.empty() ? 0 : texHeight;
+        info.hdrWidth = hdrData ? hdrData->width : 0;
+        info.hdrHeight = hdrData ? hdrData->height : 0;
+        info.sceneBoundsMin = sceneBounds.pmin;
+        info.sceneBoundsMax = sceneBounds.pmax;
+
+        std::vector<char> names;
+        std::vector<BundleMesh> bundleMeshes(meshes.size());
+        std::vector<RadeonRays::Bvh::PackedNode> meshNodes;
+        std::vector<int> meshIndices;
+        std::vector<int> meshTriangles;
+        const std::vector<int>& rootNodes = bvhTranslator.GetBLASRootIndices();
+
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const Mesh* mesh = meshes[i];
+            BundleMesh& m = bundleMeshes[i];
+            m.bvhBuilder = mesh->GetBvhBuilder();
+            m.maxLeafSize = mesh->bvh->GetMaxLeafSize();
+            m.leafCost = mesh->bvh->GetLeafCost();
+            m.firstVertex = meshVertexOffsets[i];
+            m.numVertices = (int32_t)mesh->verticesUVX.size();
+            m.firstNode = (int32_t)meshNodes.size();
+            mesh->bvh->Pack(meshNodes);
+            m.numNodes = (int32_t)meshNodes.size() - m.firstNode;
+            m.firstIndex = (int32_t)meshIndices.size();
+            m.numIndices = (int32_t)mesh->bvh->GetNumIndices();
+            meshIndices.insert(meshIndices.end(), mesh->bvh->GetIndices(), mesh->bvh->GetIndices() + m.numIndices);
+            m.firstTriangle = (int32_t)meshTriangles.size() / 3;
+            m.numTriangles = mesh->NumTriangles();
+            meshTriangles.insert(meshTriangles.end(), mesh->indices.begin(), mesh->indices.end());
+            m.rootNode = rootNodes[i];
+            AddName(names, mesh->name, m.nameOffset, m.nameLength);
+        }
+
+        // Each instance name is stored once, instances sharing it point to the same offset
+        std::vector<int32_t> instanceNameOffsets(instanceNames.size());
+        std::vector<int32_t> instanceNameLengths(instanceNames.size());
+        for (size_t i = 0; i < instanceNames.size(); i++)
+            AddName(names, instanceNames[i], instanceNameOffsets[i], instanceNameLengths[i]);
+
+        std::vector<BundleInstance> instances(meshInstances.size());
+        for (size_t i = 0; i < meshInstances.size(); i++)
+        {
+            instances[i].transform = meshInstances[i].transform;
+            instances[i].meshID = meshInstances[i].meshID;
+            instances[i].materialID = meshInstances[i].materialID;
+            int nameID = meshInstances[i].nameID;
+            bool named = nameID >= 0 && nameID < (int)instanceNames.size();
+            instances[i].nameOffset = named ? instanceNameOffsets[nameID] : 0;
+            instances[i].nameLength = named ? instanceNameLengths[nameID] : 0;
+        }
+
+        std::vector<BundleTexture> bundleTextures(textures.size());
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            bundleTextures[i].width = textures[i]->width;
+            bundleTextures[i].height = textures[i]->height;
+            AddName(names, textures[i]->name, bundleTextures[i].nameOffset, bundleTextures[i].nameLength);
+        }
+
+        std::vector<RadeonRays::Bvh::PackedNode> tlasNodes;
+        sceneBvh->Pack(tlasNodes);
+
+        size_t hdrPixels = hdrData ? (size_t)hdrData->width * hdrData->height : 0;
+
+        SectionData data[NumBundleSections];
+        data[SceneSection] = Section(&info, 1);
+        data[MeshSection] = Section(bundleMeshes);
+        data[MeshNodeSection] = Section(meshNodes);
+        data[MeshIndexSection] = Section(meshIndices);
+        data[MeshTriangleSection] = Section(meshTriangles);
+        data[InstanceSection] = Section(instances);
+        data[TextureSection] = Section(bundleTextures);
+        data[NameSection] = Section(names);
+        data[TlasNodeSection] = Section(tlasNodes);
+        data[TlasIndexSection] = Section(sceneBvh->GetIndices(), sceneBvh->GetNumIndices());
+        data[BvhNodeSection] = Section(bvhTranslator.nodes);
+        data[CompressedNodeSection] = Section(bvhTranslator.compressedNodes);
+        data[MissLinkSection] = Section(bvhTranslator.missLinks);
+        data[VertIndexSection] = Section(vertIndices);
+        data[VertexSection] = Section(verticesUVX);
+        data[NormalSection] = Section(normalsUVY);
+        data[TransformSection] = Section(transforms);
+        data[InvTransformSection] = Section(invTransforms);
+        data[MaterialSection] = Section(materials);
+        data[LightSection] = Section(lights);
+        data[TextureMapSection] = Section(textureMapsArray);
+        data[HdrColorSection] = Section(hdrData ? hdrData->cols : nullptr, hdrPixels * 3);
+        data[HdrMarginalSection] = Section(hdrData ? hdrData->marginalDistData : nullptr, hdrData ? hdrData->height : 0);
+        data[HdrConditionalSection] = Section(hdrData ? hdrData->conditionalDistData : nullptr, hdrPixels);
+
+        BundleHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kBundleMagic, sizeof(kBundleMagic));
+        header.version = kBundleVersion;
+        header.numSections = NumBundleSections;
+
+        BundleSection sections[NumBundleSections];
+        memset(sections, 0, sizeof(sections));
+        uint64_t offset = sizeof(header) + sizeof(sections);
+        for (int i = 0; i < NumBundleSections; i++)
+        {
+            offset = (offset + kBundleAlignment - 1) / kBundleAlignment * kBundleAlignment;
+            sections[i].offset = offset;
+            sections[i].size = data[i].elementSize * data[i].count;
+            sections[i].elementSize = (uint32_t)data[i].elementSize;
+            offset += sections[i].size;
+        }
+        header.fileSize = offset;
+
+        // Written next to the bundle and renamed, so a render started meanwhile never maps a partial file
+        std::string tmpPath = filename + ".tmp";
+        FILE* file = fopen(tmpPath.c_str(), "wb");
+        if (!file)
+        {
+            printf("Couldn't open %s for writing\n", tmpPath.c_str());
+            return false;
+        }
+
+        static const char zeros[kBundleAlignment] = {};
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(sections, sizeof(sections), 1, file) == 1;
+        uint64_t written = sizeof(header) + sizeof(sections);
+        for (int i = 0; i < NumBundleSections && ok; i++)
+        {
+            ok = fwrite(zeros, 1, sections[i].offset - written, file) == sections[i].offset - written;
+            // Empty sections have no data pointer to hand to fwrite
+            if (sections[i].size > 0)
+                ok = ok && fwrite(data[i].data, 1, sections[i].size, file) == sections[i].size;
+            written = sections[i].offset + sections[i].size;
+        }
+        ok = fclose(file) == 0 && ok;
+
+        // rename() does not replace an existing file everywhere
+        if (ok)
+        {
+            remove(filename.c_str());
+            ok = rename(tmpPath.c_str(), filename.c_str()) == 0;
+        }
+        if (!ok)
+        {
+            remove(tmpPath.c_str());
+            printf("Couldn't write scene bundle %s\n", filename.c_str());
+            return false;
+        }
+
+        printf("Scene bundle %s : %.2f MB\n", filename.c_str(), header.fileSize / (1024.0 * 1024.0));
+        return true;
+    }
+
+    bool Scene::LoadBundle(const std::string& filename)
+    {
+        BundleReader reader;
+        if (!reader.Open(filename))
+        {
+            printf("%s is not a scene bundle of this version\n", filename.c_str());
+            return false;
+        }
+
+        const BundleScene* info;
+        const BundleMesh* bundleMeshes;
+        const BundleInstance* instances;
+        const BundleTexture* bundleTextures;
+        const RadeonRays::Bvh::PackedNode* meshNodes;
+        const RadeonRays::Bvh::PackedNode* tlasNodes;
+        const int* meshIndices;
+        const int* tlasIndices;
+        const int* meshTriangles;
+        const char* names;
+        const float* hdrColors;
+        const Vec2* hdrMarginal;
+        const Vec2* hdrConditional;
+        size_t numInfos, numMeshes, numInstances, numTextures, numMeshNodes, numTlasNodes, numMeshIndices,
+            numMeshTriangles, numTlasIndices, numNames, numHdrColors, numHdrMarginal, numHdrConditional;
+
+        bool ok = reader.Get(SceneSection, info, numInfos) && numInfos == 1 &&
+            reader.Get(MeshSection, bundleMeshes, numMeshes) &&
+            reader.Get(InstanceSection, instances, numInstances) &&
+            reader.Get(TextureSection, bundleTextures, numTextures) &&
+            reader.Get(MeshNodeSection, meshNodes, numMeshNodes) &&
+            reader.Get(TlasNodeSection, tlasNodes, numTlasNodes) &&
+            reader.Get(MeshIndexSection, meshIndices, numMeshIndices) &&
+            reader.Get(TlasIndexSection, tlasIndices, numTlasIndices) &&
+            reader.Get(MeshTriangleSection, meshTriangles, numMeshTriangles) &&
+            reader.Get(NameSection, names, numNames) &&
+            reader.Get(HdrColorSection, hdrColors, numHdrColors) &&
+            reader.Get(HdrMarginalSection, hdrMarginal, numHdrMarginal) &&
+            reader.Get(HdrConditionalSection, hdrConditional, numHdrConditional) &&
+            reader.Get(BvhNodeSection, bvhTranslator.nodes) &&
+            reader.Get(CompressedNodeSection, bvhTranslator.compressedNodes) &&
+            reader.Get(MissLinkSection, bvhTranslator.missLinks) &&
+            reader.Get(VertIndexSection, vertIndices) &&
+            reader.Get(VertexSection, verticesUVX) &&
+            reader.Get(NormalSection, normalsUVY) &&
+            reader.Get(TransformSection, transforms) &&
+            reader.Get(InvTransformSection, invTransforms) &&
+            reader.Get(MaterialSection, materials) &&
+            reader.Get(LightSection, lights) &&
+            reader.Get(TextureMapSection, textureMapsArray);
+
+        // The flat arrays go straight to the renderers, so check they agree with each other before trusting them
+        size_t hdrPixels = ok ? (size_t)info->hdrWidth * info->hdrHeight : 0;
+        ok = ok && normalsUVY.size() == verticesUVX.size() &&
+            transforms.size() == numInstances && invTransforms.size() == numInstances &&
+            vertIndices.size() == numMeshIndices && numInstances > 0 && info->topLevelIndex >= 0 &&
+            bvhTranslator.nodes.size() == (size_t)info->topLevelIndex + 3 * numInstances &&
+            bvhTranslator.compressedNodes.size() == (info->compressedNodes ? bvhTranslator.nodes.size() : 0) &&
+            bvhTranslator.missLinks.size() == (info->missLinks ? bvhTranslator.nodes.size() : 0) &&
+            textureMapsArray.size() == (size_t)info->texWidth * info->texHeight * 3 * numTextures &&
+            numHdrColors == hdrPixels * 3 && numHdrMarginal == (hdrPixels ? (size_t)info->hdrHeight : 0) &&
+            numHdrConditional == hdrPixels;
+
+        for (size_t i = 0; i < vertIndices.size() && ok; i++)
+            ok = vertIndices[i].x >= 0 && vertIndices[i].y >= 0 && vertIndices[i].z >= 0 &&
+                (size_t)std::max(vertIndices[i].x, std::max(vertIndices[i].y, vertIndices[i].z)) < verticesUVX.size();
+
+        auto validName = [&](int32_t offset, int32_t length) {
+            return offset >= 0 && length >= 0 && (size_t)offset + length <= numNames;
+        };
+
+        std::vector<int> rootNodes;
+        std::vector<int> triStarts;
+        meshVertexOffsets.clear();
+        for (size_t i = 0; i < numMeshes && ok; i++)
+        {
+            const BundleMesh& m = bundleMeshes[i];
+            ok = m.firstVertex >= 0 && m.numVertices >= 0 && (size_t)m.firstVertex + m.numVertices <= verticesUVX.size() &&
+                m.firstNode >= 0 && m.numNodes >= 0 && (size_t)m.firstNode + m.numNodes <= numMeshNodes &&
+                m.firstIndex >= 0 && m.numIndices >= 0 && (size_t)m.firstIndex + m.numIndices <= numMeshIndices &&
+                m.firstTriangle >= 0 && m.numTriangles >= 0 && 3 * ((size_t)m.firstTriangle + m.numTriangles) <= numMeshTriangles &&
+                m.rootNode >= 0 && m.rootNode + m.numNodes <= info->topLevelIndex &&
+                m.bvhBuilder >= SbvhBuilder && m.bvhBuilder <= LbvhBuilder && validName(m.nameOffset, m.nameLength);
+            if (!ok)
+                break;
+
+            Mesh* mesh = new Mesh;
+            meshes.push_back(mesh);
+            mesh->name.assign(names + m.nameOffset, m.nameLength);
+            meshIDs[mesh->name] = (int)i;
+            mesh->SetBvhBuilder((BvhBuilder)m.bvhBuilder);
+            mesh->bvh->SetLeafParams(m.maxLeafSize, m.leafCost);
+            mesh->verticesUVX.assign(verticesUVX.begin() + m.firstVertex, verticesUVX.begin() + m.firstVertex + m.numVertices);
+            mesh->normalsUVY.assign(normalsUVY.begin() + m.firstVertex, normalsUVY.begin() + m.firstVertex + m.numVertices);
+            mesh->indices.assign(meshTriangles + 3 * m.firstTriangle, meshTriangles + 3 * (m.firstTriangle + m.numTriangles));
+            for (size_t j = 0; j < mesh->indices.size() && ok; j++)
+                ok = mesh->indices[j] >= 0 && mesh->indices[j] < m.numVertices;
+            ok = ok && mesh->bvh->Unpack(meshNodes + m.firstNode, m.numNodes, meshIndices + m.firstIndex, m.numIndices, m.numTriangles);
+
+            meshVertexOffsets.push_back(m.firstVertex);
+            rootNodes.push_back(m.rootNode);
+            triStarts.push_back(m.firstIndex);
+        }
+
+        // Instances sharing a name share its offset, so the string is only built once per name
+        std::unordered_map<int32_t, int> instanceNameOffsets;
+        auto instanceNameAt = [&](int32_t offset, int32_t length) {
+            auto it = instanceNameOffsets.find(offset);
+            if (it != instanceNameOffsets.end() && instanceNames[it->second].size() == (size_t)length)
+                return it->second;
+            int nameID = addInstanceName(std::string(names + offset, length));
+            instanceNameOffsets[offset] = nameID;
+            return nameID;
+        };
+
+        for (size_t i = 0; i < numInstances && ok; i++)
+        {
+            const BundleInstance& inst = instances[i];
+            ok = inst.meshID >= 0 && (size_t)inst.meshID < numMeshes &&
+                inst.materialID >= 0 && (size_t)inst.materialID < materials.size() && validName(inst.nameOffset, inst.nameLength);
+            if (ok)
+                meshInstances.push_back(MeshInstance(inst.meshID, inst.transform, inst.materialID, instanceNameAt(inst.nameOffset, inst.nameLength)));
+        }
+
+        for (size_t i = 0; i < numTextures && ok; i++)
+        {
+            const BundleTexture& t = bundleTextures[i];
+            ok = validName(t.nameOffset, t.nameLength);
+            if (!ok)
+                break;
+
+            // The pixels only live in textureMapsArray
+            Texture* texture = new Texture;
+            texture->name.assign(names + t.nameOffset, t.nameLength);
+            texture->width = t.width;
+            texture->height = t.height;
+            textures.push_back(texture);
+            textureIDs[texture->name] = (int)i;
+        }
+
+        ok = ok && sceneBvh->Unpack(tlasNodes, (int)numTlasNodes, tlasIndices, (int)numTlasIndices, (int)numInstances);
+
+        // Every mesh tree only points at its own triangles, the TLAS leaves at an instance, its mesh root and a material
+        for (size_t i = 0; i < numMeshes && ok; i++)
+        {
+            const BundleMesh& m = bundleMeshes[i];
+            ok = m.numNodes == 0 || ValidTree(bvhTranslator, m.rootNode, m.rootNode + m.numNodes,
+                [&](int, const RadeonRays::BvhTranslator::Node& leaf) {
+                    return leaf.count > 0 && leaf.offset >= m.firstIndex && leaf.offset - m.firstIndex <= m.numIndices - leaf.count;
+                });
+        }
+
+        const auto& nodes = bvhTranslator.nodes;
+        ok = ok && ValidTree(bvhTranslator, info->topLevelIndex, (int)nodes.size(),
+            [&](int index, const RadeonRays::BvhTranslator::Node& leaf) {
+                int instance = -(leaf.count + 1);
+                if (leaf.count > 0 || (size_t)instance >= numInstances || (size_t)index + 1 >= nodes.size())
+                    return false;
+
+                int materialID = nodes[index + 1].offset;
+                return leaf.offset == rootNodes[meshInstances[instance].meshID] && materialID >= 0 && (size_t)materialID < materials.size() &&
+                    (bvhTranslator.compressedNodes.empty() || bvhTranslator.compressedNodes[index].header[2] == materialID);
+            });
+
+        if (!ok)
+        {
+            printf("Scene bundle %s is damaged\n", filename.c_str());
+            return false;
+        }
+
+        // Options that change the node layout must stay as they were when the bundle was written
+        renderOptions.resolution = iVec2(info->resolution[0], info->resolution[1]);
+        renderOptions.maxDepth = info->maxDepth;
+        renderOptions.tileWidth = info->tileWidth;
+        renderOptions.tileHeight = info->tileHeight;
+        renderOptions.RRDepth = info->RRDepth;
+        renderOptions.tileOrder = (TileOrder)info->tileOrder;
+        renderOptions.numThreads = info->numThreads;
+        renderOptions.bvhWidth = info->bvhWidth;
+        renderOptions.hdrMultiplier = info->hdrMultiplier;
+        renderOptions.bgColor = info->bgColor;
+        renderOptions.useEnvMap = info->useEnvMap != 0;
+        renderOptions.enableRR = info->enableRR != 0;
+        renderOptions.enableDenoiser = info->enableDenoiser != 0;
+        renderOptions.useConstantBg = info->useConstantBg != 0;
+        renderOptions.enableRayPackets = info->enableRayPackets != 0;
+        renderOptions.compressedBvh = info->compressedBvh != 0;
+        renderOptions.stacklessBvh = info->stacklessBvh != 0;
+        renderOptions.treeletBvh = info->treeletBvh != 0;
+        renderOptions.enableTraversalStats = info->enableTraversalStats != 0;
+
+        AddCamera(info->cameraPosition, info->cameraPivot, Math::Degrees(info->cameraFov));
+        camera->position = info->cameraPosition;
+        camera->up = info->cameraUp;
+        camera->right = info->cameraRight;
+        camera->forward = info->cameraForward;
+        camera->fov = info->cameraFov;
+        camera->focalDist = info->cameraFocalDist;
+        camera->aperture = info->cameraAperture;
+
+        texWidth = info->texWidth;
+        texHeight = info->texHeight;
+
+        if (hdrPixels > 0)
+        {
+            delete hdrData;
+            hdrData = new HDRData;
+            hdrData->width = info->hdrWidth;
+            hdrData->height = info->hdrHeight;
+            hdrData->cols = new float[numHdrColors];
+            hdrData->marginalDistData = new Vec2[numHdrMarginal];
+            hdrData->conditionalDistData = new Vec2[numHdrConditional];
+            memcpy(hdrData->cols, hdrColors, numHdrColors * sizeof(float));
+            memcpy(hdrData->marginalDistData, hdrMarginal, numHdrMarginal * sizeof(Vec2));
+            memcpy(hdrData->conditionalDistData, hdrConditional, numHdrConditional * sizeof(Vec2));
+        }
+
+        // Instance edits refit the restored TLAS and rewrite the restored nodes in place
+        updateInstanceBounds();
+        sceneBounds = RadeonRays::bbox(info->sceneBoundsMin, info->sceneBoundsMax);
+        tlasBuildCost = sceneBvh->SahCost();
+        bvhTranslator.topLevelIndex = info->topLevelIndex;
+        bvhTranslator.compress = info->compressedNodes != 0;
+        bvhTranslator.stackless = info->missLinks != 0;
+        bvhTranslator.Restore(sceneBvh, meshes, meshInstances, rootNodes, triStarts);
+
+        printf("Scene bundle %s : %zu meshes, %zu instances, %zu BVH nodes\n", filename.c_str(), numMeshes, numInstances, bvhTranslator.nodes.size());
+        return true;
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace GLSLPT
+{
+    ThreadPool::ThreadPool(int numThreads)
+        : quit(false)
+    {
+        if (numThreads <= 0)
+            numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+        for (int i = 0; i < numThreads - 1; i++)
+            workers.emplace_back(&ThreadPool::Worker, this);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    void ThreadPool::Push(Task&& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // Runs the most recently queued task, which is usually the one closest in the recursion to the caller
+    bool ThreadPool::TryRunOne()
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        }
+
+        task.func();
+
+        if (--task.group->pending == 0)
+        {
+            // Waiters check pending under the lock, take it so the notification cannot slip in between
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_all();
+        }
+
+        return true;
+    }
+
+    void ThreadPool::Worker()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return quit || !tasks.empty(); });
+                if (quit && tasks.empty())
+                    return;
+            }
+
+            TryRunOne();
+        }
+    }
+
+    void TaskGroup::Run(std::function<void()> func)
+    {
+        if (pool == nullptr || pool->workers.empty())
+        {
+            func();
+            return;
+        }
+
+        pending++;
+        pool->Push({ std::move(func), this });
+    }
+
+    void TaskGroup::Wait()
+    {
+        while (pending > 0)
+        {
+            if (pool->TryRunOne())
+                continue;
+
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [this] { return pending == 0 || !pool->tasks.empty(); });
+        }
+    }
+}
@@ -0,0 +1,151 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace GLSLPT
+{
+    class TaskGroup;
+
+    // Fixed set of worker threads sharing one task queue. The thread waiting on a TaskGroup helps running
+    // queued tasks, so tasks may spawn and wait on nested groups without starving the pool.
+    class ThreadPool
+    {
+    public:
+        // numThreads counts the calling thread, 0 uses all cores
+        explicit ThreadPool(int numThreads = 0);
+        ~ThreadPool();
+
+        int GetNumThreads() const { return (int)workers.size() + 1; }
+
+    private:
+        friend class TaskGroup;
+
+        struct Task
+        {
+            std::function<void()> func;
+            TaskGroup* group;
+        };
+
+        void Push(Task&& task);
+        bool TryRunOne();
+        void Worker();
+
+        std::vector<std::thread> workers;
+        std::deque<Task> tasks;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool quit;
+    };
+
+    // Tasks submitted through Run() may execute on any pool thread. Wait() returns once all of them are done.
+    // Without a pool, or with a single thread, tasks run immediately on the calling thread.
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool* pool) : pool(pool), pending(0) {}
+        ~TaskGroup() { Wait(); }
+
+        void Run(std::function<void()> func);
+        void Wait();
+
+    private:
+        friend class ThreadPool;
+
+        ThreadPool* pool;
+        std::atomic<int> pending;
+    };
+
+    // Calls func(i) for every i in [begin, end). The range is split into at most four chunks per thread,
+    // none smaller than grainSize, that run as tasks of one group. Without a pool the loop runs in place
+    template <typename Func>
+    void ParallelFor(ThreadPool* pool, int begin, int end, int grainSize, const Func& func)
+    {
+        int count = end - begin;
+        int numChunks = pool ? std::min(pool->GetNumThreads() * 4, count / std::max(grainSize, 1)) : 1;
+
+        if (numChunks <= 1)
+        {
+            for (int i = begin; i < end; i++)
+                func(i);
+            return;
+        }
+
+        TaskGroup group(pool);
+        for (int chunk = 0; chunk < numChunks; chunk++)
+        {
+            int chunkBegin = begin + (int)((long long)count * chunk / numChunks);
+            int chunkEnd = begin + (int)((long long)count * (chunk + 1) / numChunks);
+            group.Run([chunkBegin, chunkEnd, &func]
+            {
+                for (int i = chunkBegin; i < chunkEnd; i++)
+                    func(i);
+            });
+        }
+        group.Wait();
+    }
+
+    // Result of a function running as a pool task, see Async(). Get() waits for it like TaskGroup::Wait(),
+    // running queued tasks meanwhile, so a task may wait on a future of its own
+    template <typename T>
+    class Future
+    {
+    public:
+        Future(ThreadPool* pool, std::function<T()> func)
+            : result(new T())
+            , group(new TaskGroup(pool))
+        {
+            T* out = result.get();
+            group->Run([out, func] { *out = func(); });
+        }
+
+        T& Get()
+        {
+            group->Wait();
+            return *result;
+        }
+
+    private:
+        // The group is destroyed first and waits for the task that writes the result
+        std::unique_ptr<T> result;
+        std::unique_ptr<TaskGroup> group;
+    };
+
+    template <typename Func>
+    Future<typename std::result_of<Func()>::type> Async(ThreadPool* pool, Func func)
+    {
+        return Future<typename std::result_of<Func()>::type>(pool, func);
+    }
+}
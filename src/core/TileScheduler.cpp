@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace GLSLPT
+{
+    // Maps a distance along a Hilbert curve filling an n x n grid (n power of two) to grid coordinates
+    static iVec2 HilbertToXY(int n, int d)
+    {
+        int x = 0, y = 0;
+        for (int s = 1; s < n; s *= 2)
+        {
+            int rx = 1 & (d / 2);
+            int ry = 1 & (d ^ rx);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+        return iVec2(x, y);
+    }
+
+    TileScheduler::TileScheduler()
+        : wallTime(0.0)
+        , numThreads(1)
+    {
+    }
+
+    void TileScheduler::Init(const iVec2& numTiles, TileOrder order, int numThreads)
+    {
+        this->numThreads = std::max(1, numThreads);
+
+        // Tile rows are stored bottom up, like the GL textures, so the top row is numTiles.y - 1
+        tiles.clear();
+        if (order == HilbertOrder)
+        {
+            int n = 1;
+            while (n < numTiles.x || n < numTiles.y)
+                n *= 2;
+
+            for (int d = 0; d < n * n; d++)
+            {
+                iVec2 t = HilbertToXY(n, d);
+                if (t.x < numTiles.x && t.y < numTiles.y)
+                    tiles.push_back(iVec2(t.x, numTiles.y - 1 - t.y));
+            }
+        }
+        else
+        {
+            for (int y = numTiles.y - 1; y >= 0; y--)
+                for (int x = 0; x < numTiles.x; x++)
+                    tiles.push_back(iVec2(x, y));
+
+            if (order == CenterOutOrder)
+            {
+                float cx = (numTiles.x - 1) * 0.5f;
+                float cy = (numTiles.y - 1) * 0.5f;
+                std::stable_sort(tiles.begin(), tiles.end(), [cx, cy](const iVec2& a, const iVec2& b)
+                {
+                    float da = (a.x - cx) * (a.x - cx) + (a.y - cy) * (a.y - cy);
+                    float db = (b.x - cx) * (b.x - cx) + (b.y - cy) * (b.y - cy);
+                    return da < db;
+                });
+            }
+        }
+
+        queues.clear();
+        for (int i = 0; i < this->numThreads; i++)
+            queues.emplace_back(new TileQueue);
+
+        ResetStats();
+    }
+
+    void TileScheduler::ResetStats()
+    {
+        stats.assign(numThreads, ThreadStats{ 0.0, 0, 0 });
+        wallTime = 0.0;
+    }
+
+    bool TileScheduler::Pop(int thread, int& tile)
+    {
+        TileQueue& queue = *queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (queue.tiles.empty())
+            return false;
+
+        tile = queue.tiles.front();
+        queue.tiles.pop_front();
+        return true;
+    }
+
+    bool TileScheduler::Steal(int thread, int& tile)
+    {
+        for (int i = 1; i < numThreads; i++)
+        {
+            TileQueue& victim = *queues[(thread + i) % numThreads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (victim.tiles.empty())
+                continue;
+
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+
+        return false;
+    }
+
+    void TileScheduler::Worker(int thread, const std::function<void(const iVec2&)>& renderTile)
+    {
+        ThreadStats& threadStats = stats[thread];
+        int tile;
+
+        while (true)
+        {
+            bool stolen = false;
+            if (!Pop(thread, tile))
+            {
+                // No tiles are added while a frame is running, so when stealing fails everything is taken
+                if (!Steal(thread, tile))
+                    break;
+                stolen = true;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            renderTile(tiles[tile]);
+            threadStats.busyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            threadStats.tilesRendered++;
+            threadStats.tilesStolen += stolen ? 1 : 0;
+        }
+    }
+
+    void TileScheduler::Run(const std::function<void(const iVec2&)>& renderTile, ThreadPool* pool)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        // Give each thread a contiguous run of the ordering so that neighbouring tiles stay on one thread
+        int numTiles = (int)tiles.size();
+        for (int i = 0; i < numThreads; i++)
+        {
+            int begin = (int)((long long)numTiles * i / numThreads);
+            int end = (int)((long long)numTiles * (i + 1) / numThreads);
+
+            queues[i]->tiles.clear();
+            for (int t = begin; t < end; t++)
+                queues[i]->tiles.push_back(t);
+        }
+
+        // The other queues are worked off by pool tasks, one per queue
+        TaskGroup group(pool);
+        for (int i = 1; i < numThreads; i++)
+            group.Run([this, i, &renderTile] { Worker(i, renderTile); });
+
+        Worker(0, renderTile);
+        group.Wait();
+
+        wallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void TileScheduler::PrintStats() const
+    {
+        double totalBusy = 0.0;
+        for (int i = 0; i < numThreads; i++)
+        {
+            const ThreadStats& s = stats[i];
+            totalBusy += s.busyTime;
+            printf("Thread %3d : busy %.3f s (%5.1f%%), tiles %d, stolen %d\n", i, s.busyTime,
+                wallTime > 0.0 ? 100.0 * s.busyTime / wallTime : 0.0, s.tilesRendered, s.tilesStolen);
+        }
+
+        printf("Threads    : %d, wall %.3f s, utilization %.1f%%\n", numThreads, wallTime,
+            wallTime > 0.0 ? 100.0 * totalBusy / (wallTime * numThreads) : 0.0);
+    }
+}
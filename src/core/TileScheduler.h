@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Renderer.h"
+#include "ThreadPool.h"
+
+namespace GLSLPT
+{
+    // Hands out the tiles of one frame to a set of threads. Every thread owns a queue holding a contiguous
+    // run of tiles in the requested order and pops from its front. Once a queue runs dry, its thread steals
+    // from the back of the other queues, so threads that got cheap tiles help out where the work is.
+    class TileScheduler
+    {
+    public:
+        struct ThreadStats
+        {
+            double busyTime;
+            int tilesRendered;
+            int tilesStolen;
+        };
+
+        TileScheduler();
+
+        void Init(const iVec2& numTiles, TileOrder order, int numThreads);
+
+        // Calls renderTile(tile) once for every tile, on the calling thread and the pool. Returns when the frame is done
+        void Run(const std::function<void(const iVec2&)>& renderTile, ThreadPool* pool);
+
+        int GetNumThreads() const { return numThreads; }
+        const std::vector<iVec2>& GetTileOrder() const { return tiles; }
+        const std::vector<ThreadStats>& GetStats() const { return stats; }
+
+        void ResetStats();
+        void PrintStats() const;
+
+    private:
+        struct TileQueue
+        {
+            std::mutex mutex;
+            std::deque<int> tiles;
+        };
+
+        bool Pop(int thread, int& tile);
+        bool Steal(int thread, int& tile);
+        void Worker(int thread, const std::function<void(const iVec2&)>& renderTile);
+
+        std::vector<iVec2> tiles;
+        std::vector<std::unique_ptr<TileQueue>> queues;
+        std::vector<ThreadStats> stats;
+        double wallTime;
+        int numThreads;
+    };
+}
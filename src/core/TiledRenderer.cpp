@@ -103,6 +103,12 @@ namespace GLSLPT
         }
         if (scene->renderOptions.useConstantBg)
             defines += "#define CONSTANT_BG\n";
+        if (scene->bvhTranslator.compress)
+            defines += "#define COMPRESSED_BVH\n";
+        if (scene->bvhTranslator.stackless)
+            defines += "#define STACKLESS_BVH\n";
+        if (scene->renderOptions.enableTraversalStats)
+            defines += "#define TRAVERSAL_STATS\n";
 
         if (defines.size() > 0)
         {
@@ -226,6 +232,7 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 9);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "missLinksTex"), 12);
 
         pathTraceShader->StopUsing();
 
@@ -248,6 +255,7 @@ namespace GLSLPT
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 9);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 11);
+        glUniform1i(glGetUniformLocation(shaderObject, "missLinksTex"), 12);
 
         pathTraceShaderLowRes->StopUsing();
 
@@ -262,7 +270,7 @@ namespace GLSLPT
         glActiveTexture(GL_TEXTURE5);
         glBindTexture(GL_TEXTURE_2D, materialsTex);
         glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, transformsTex);
+        glBindTexture(GL_TEXTURE_BUFFER, transformsTex);
         glActiveTexture(GL_TEXTURE7);
         glBindTexture(GL_TEXTURE_2D, lightsTex);
         glActiveTexture(GL_TEXTURE8);
@@ -273,6 +281,8 @@ namespace GLSLPT
         glBindTexture(GL_TEXTURE_2D, hdrMarginalDistTex);
         glActiveTexture(GL_TEXTURE11);
         glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTex);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_BUFFER, missLinksTex);
     }
 
     void TiledRenderer::Finish()
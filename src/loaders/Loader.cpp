@@ -26,158 +26,585 @@ freely, subject to the following restrictions:
 */
 
 #include "Loader.h"
-#include <tiny_obj_loader.h>
+#include "MappedFile.h"
+#include "ObjLoader.h"
 #include <iostream>
 #include <iterator>
 #include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
 #include <stdio.h>
+#include <unordered_map>
 
 namespace GLSLPT
 {
-    static const int kMaxLineLength = 2048;
     int(*Log)(const char* szFormat, ...) = printf;
 
-    bool LoadSceneFromFile(const std::string &filename, Scene *scene, RenderOptions& renderOptions)
+    namespace
     {
-        FILE* file;
-        file = fopen(filename.c_str(), "r");
+        struct Token
+        {
+            const char* text;
+            int length;
+            int line;
+            int column;
+
+            bool Is(const char* keyword) const { return strncmp(text, keyword, length) == 0 && keyword[length] == '\0'; }
+            std::string Str() const { return std::string(text, length); }
+        };
+
+        // Splits a scene file into whitespace separated tokens. Braces are tokens of their own and a token
+        // starting with # comments out the rest of its line. Every property sits on a line of its own, so the
+        // parser either asks for the first token of the next line or for the remaining ones of the current line
+        class SceneTokenizer
+        {
+        public:
+            SceneTokenizer(const std::string& filename, const char* data, size_t size)
+                : filename(filename), p(data), end(data + size), lineStart(data), line(1), errors(0), errorLine(0)
+            {
+            }
+
+            // Next token, moving on to the following lines once the current one is used up. False at the end of the file
+            bool NextLine(Token& token) { return next(token, true); }
+            // Next token of the current line, false at its end
+            bool Next(Token& token) { return next(token, false); }
+
+            // Consumes the next token if it is text, otherwise leaves it for the next call
+            bool NextIs(const char* text)
+            {
+                const char* start = p;
+                const char* startLine = lineStart;
+                int startLineNumber = line;
+
+                Token token;
+                if (NextLine(token) && token.Is(text))
+                    return true;
+
+                p = start;
+                lineStart = startLine;
+                line = startLineNumber;
+                return false;
+            }
+
+            // Remainder of the current line up to a tab, without surrounding blanks, for names with spaces
+            bool Rest(Token& token)
+            {
+                skipBlanks();
+                const char* start = p;
+                while (p < end && *p != '\n' && *p != '\t')
+                    p++;
+                const char* last = p;
+                while (last > start && (last[-1] == ' ' || last[-1] == '\r'))
+                    last--;
+                token = makeToken(start, (int)(last - start));
+                return last > start;
+            }
+
+            bool ReadFloats(const Token& key, float* values, int count)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    Token token;
+                    if (!value(key, token))
+                        return false;
+
+                    // Plain decimals take the OBJ parser's fast path, strtof handles the rest such as inf
+                    const char* q = token.text;
+                    values[i] = ParseFloat(q, token.text + token.length);
+                    if (q == token.text + token.length)
+                        continue;
+
+                    char buffer[64];
+                    char* numberEnd = copy(token, buffer, sizeof(buffer));
+                    values[i] = strtof(buffer, &numberEnd);
+                    if (numberEnd != buffer + token.length)
+                        return Error(token, "'%s' is not a number", buffer);
+                }
+                return true;
+            }
+
+            bool ReadInts(const Token& key, int* values, int count)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    Token token;
+                    if (!value(key, token))
+                        return false;
+
+                    char buffer[64];
+                    char* numberEnd = copy(token, buffer, sizeof(buffer));
+                    values[i] = (int)strtol(buffer, &numberEnd, 10);
+                    if (numberEnd != buffer + token.length)
+                        return Error(token, "'%s' is not an integer", buffer);
+                }
+                return true;
+            }
+
+            bool ReadWord(const Token& key, std::string& word)
+            {
+                Token token;
+                if (!value(key, token))
+                    return false;
+                word = token.Str();
+                return true;
+            }
+
+            bool ReadBool(const Token& key, bool& flag)
+            {
+                Token token;
+                if (!value(key, token))
+                    return false;
+                if (token.Is("True"))
+                    flag = true;
+                else if (token.Is("False"))
+                    flag = false;
+                else
+                    Warning(token, "%s should be True or False, not %s", key.Str().c_str(), token.Str().c_str());
+                return true;
+            }
+
+            // Skips what is left of the current line, warning about tokens nothing asked for
+            void EndLine()
+            {
+                Token token;
+                if (Next(token) && errorLine != line)
+                    Warning(token, "Ignoring '%s' and the rest of the line", token.Str().c_str());
+                SkipLine();
+            }
+
+            void SkipLine()
+            {
+                while (p < end && *p != '\n')
+                    p++;
+            }
+
+            bool Error(const Token& token, const char* format, ...)
+            {
+                va_list args;
+                va_start(args, format);
+                report(token, "error", format, args);
+                va_end(args);
+                errors++;
+                errorLine = line;
+                return false;
+            }
+
+            void Warning(const Token& token, const char* format, ...)
+            {
+                va_list args;
+                va_start(args, format);
+                report(token, "warning", format, args);
+                va_end(args);
+            }
+
+            int Errors() const { return errors; }
+            int Lines() const { return lineStart < end ? line : line - 1; }
+
+        private:
+            void skipBlanks()
+            {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                    p++;
+            }
+
+            bool next(Token& token, bool nextLine)
+            {
+                while (true)
+                {
+                    skipBlanks();
+                    if (p == end)
+                        return false;
+
+                    if (*p == '#')
+                    {
+                        while (p < end && *p != '\n')
+                            p++;
+                        continue;
+                    }
+
+                    if (*p == '\n')
+                    {
+                        if (!nextLine)
+                            return false;
+                        lineStart = ++p;
+                        line++;
+                        continue;
+                    }
+
+                    break;
+                }
+
+                const char* start = p;
+                if (*p == '{' || *p == '}')
+                    p++;
+                else
+                {
+                    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '{' && *p != '}')
+                        p++;
+                }
+                token = makeToken(start, (int)(p - start));
+                return true;
+            }
+
+            bool value(const Token& key, Token& token)
+            {
+                if (Next(token))
+                    return true;
+                token = makeToken(p, 0);
+                return Error(token, "Missing value for %s", key.Str().c_str());
+            }
+
+            Token makeToken(const char* start, int length) const
+            {
+                return Token{ start, length, line, (int)(start - lineStart) + 1 };
+            }
+
+            static char* copy(const Token& token, char* buffer, size_t size)
+            {
+                size_t length = std::min((size_t)token.length, size - 1);
+                memcpy(buffer, token.text, length);
+                buffer[length] = '\0';
+                return buffer + length;
+            }
 
-        if (!file)
+            void report(const Token& token, const char* kind, const char* format, va_list args)
+            {
+                char message[512];
+                vsnprintf(message, sizeof(message), format, args);
+                Log("%s:%d:%d: %s: %s\n", filename.c_str(), token.line, token.column, kind, message);
+            }
+
+            std::string filename;
+            const char* p;
+            const char* end;
+            const char* lineStart;
+            int line;
+            int errors;
+            int errorLine; // Last line with an error, its leftover tokens are not reported again
+        };
+
+        // Parses the properties of a block up to its closing brace. property(key) reads the values following key
+        // and returns false for keys the block does not know
+        template <typename Property>
+        bool ParseBlock(SceneTokenizer& tokens, const Token& header, Property property)
+        {
+            if (!tokens.NextIs("{"))
+                return tokens.Error(header, "Expected { after %s", header.Str().c_str());
+            tokens.EndLine();
+
+            Token token;
+            while (tokens.NextLine(token))
+            {
+                if (token.Is("}"))
+                {
+                    tokens.EndLine();
+                    return true;
+                }
+
+                if (property(token))
+                    tokens.EndLine();
+                else
+                {
+                    tokens.Warning(token, "Unknown %s property %s", header.Str().c_str(), token.Str().c_str());
+                    tokens.SkipLine();
+                }
+            }
+
+            return tokens.Error(header, "Missing } for this %s", header.Str().c_str());
+        }
+
+        // Properties shared by the mesh and instances blocks: the mesh file with its BVH settings and the
+        // material and name of the instances
+        struct MeshProperties
+        {
+            std::string filename;
+            std::string name;
+            int materialID = 0; // Default Material ID
+            int maxLeafSize = -1;
+            float leafCost = -1.0f;
+            std::string bvhBuilder;
+
+            bool Parse(SceneTokenizer& tokens, const Token& key, const std::string& path, const std::unordered_map<std::string, int>& materialMap)
+            {
+                if (key.Is("name"))
+                {
+                    Token token;
+                    if (tokens.Rest(token))
+                        name = token.Str();
+                }
+                else if (key.Is("file"))
+                {
+                    std::string file;
+                    if (tokens.ReadWord(key, file))
+                        filename = path + file;
+                }
+                else if (key.Is("material"))
+                {
+                    // look up material in dictionary
+                    std::string matName;
+                    if (tokens.ReadWord(key, matName))
+                    {
+                        auto it = materialMap.find(matName);
+                        if (it != materialMap.end())
+                            materialID = it->second;
+                        else
+                            tokens.Warning(key, "Could not find material %s", matName.c_str());
+                    }
+                }
+                else if (key.Is("maxLeafSize"))
+                    tokens.ReadInts(key, &maxLeafSize, 1);
+                else if (key.Is("leafCost"))
+                    tokens.ReadFloats(key, &leafCost, 1);
+                else if (key.Is("bvhBuilder"))
+                    tokens.ReadWord(key, bvhBuilder);
+                else
+                    return false;
+                return true;
+            }
+
+            // Requests the mesh and applies the BVH settings, which belong to the mesh: the last block that sets them wins
+            int AddMesh(Scene* scene, SceneTokenizer& tokens, const Token& header) const
+            {
+                int meshID = scene->AddMesh(filename);
+                if (meshID == -1)
+                    return -1;
+
+                if (!bvhBuilder.empty() && bvhBuilder != "None")
+                {
+                    if (bvhBuilder == "SBVH")
+                        scene->meshes[meshID]->SetBvhBuilder(SbvhBuilder);
+                    else if (bvhBuilder == "SAH")
+                        scene->meshes[meshID]->SetBvhBuilder(SahBuilder);
+                    else if (bvhBuilder == "HLBVH")
+                        scene->meshes[meshID]->SetBvhBuilder(HlbvhBuilder);
+                    else if (bvhBuilder == "LBVH")
+                        scene->meshes[meshID]->SetBvhBuilder(LbvhBuilder);
+                    else
+                        tokens.Warning(header, "Unknown bvhBuilder %s", bvhBuilder.c_str());
+                }
+
+                if (maxLeafSize > 0 || leafCost >= 0.0f)
+                {
+                    RadeonRays::Bvh* bvh = scene->meshes[meshID]->bvh;
+                    bvh->SetLeafParams(maxLeafSize > 0 ? maxLeafSize : bvh->GetMaxLeafSize(), leafCost >= 0.0f ? leafCost : bvh->GetLeafCost());
+                }
+                return meshID;
+            }
+
+            // The name property, or the mesh file without its directory
+            std::string InstanceName() const
+            {
+                if (!name.empty() && name != "None")
+                    return name;
+                return filename.substr(filename.find_last_of("/\\") + 1);
+            }
+        };
+
+        // Reads the transform file of an instances block. It holds one record of native (little-endian) float32
+        // values per instance and no header: 16 for a matrix, laid out like Mat4 with the translation in values
+        // 12 to 14, or 10 for trs: translation, rotation quaternion x y z w and scale
+        bool ReadTransforms(SceneTokenizer& tokens, const Token& key, const std::string& filename, bool trs, std::vector<Mat4>& transforms)
+        {
+            MappedFile file;
+            if (!file.Open(filename))
+                return tokens.Error(key, "Couldn't open %s", filename.c_str());
+
+            const size_t recordSize = (trs ? 10 : 16) * sizeof(float);
+            if (file.Size() % recordSize != 0)
+                return tokens.Error(key, "%s has %zu bytes, not a whole number of %zu byte records", filename.c_str(), file.Size(), recordSize);
+
+            transforms.resize(file.Size() / recordSize);
+            for (size_t i = 0; i < transforms.size(); i++)
+            {
+                const char* record = file.Data() + i * recordSize;
+                if (trs)
+                {
+                    float v[10];
+                    memcpy(v, record, sizeof(v));
+                    transforms[i] = Mat4::TRS(Vec3(v[0], v[1], v[2]), Vec4(v[3], v[4], v[5], v[6]), Vec3(v[7], v[8], v[9]));
+                }
+                else
+                    memcpy(&transforms[i], record, sizeof(Mat4));
+            }
+            return true;
+        }
+    }
+
+    bool LoadSceneFromFile(const std::string &filename, Scene *scene, RenderOptions& renderOptions, int numThreads)
+    {
+        // Bundles from Scene::SaveBundle() hold a loaded scene with its options
+        const std::string bundleExt = ".bundle";
+        if (filename.size() > bundleExt.size() && filename.compare(filename.size() - bundleExt.size(), bundleExt.size(), bundleExt) == 0)
+        {
+            Log("Loading Scene Bundle..\n");
+            if (!scene->LoadBundle(filename))
+                return false;
+
+            scene->renderOptions.bvhCacheDirectory = renderOptions.bvhCacheDirectory;
+            if (numThreads >= 0)
+                scene->renderOptions.numThreads = numThreads;
+            renderOptions = scene->renderOptions;
+            return true;
+        }
+
+        MappedFile file;
+        if (!file.Open(filename))
         {
             Log("Couldn't open %s for reading\n", filename.c_str());
             return false;
         }
 
         Log("Loading Scene..\n");
+        auto parseStart = std::chrono::steady_clock::now();
 
-        struct MaterialData
-        {
-            Material mat;
-            int id;
-        };
-
-        std::map<std::string, MaterialData> materialMap;
-        std::vector<std::string> albedoTex;
-        std::vector<std::string> metallicRoughnessTex;
-        std::vector<std::string> normalTex;
+        std::unordered_map<std::string, int> materialMap;
         std::string path = filename.substr(0, filename.find_last_of("/\\")) + "/";
 
-        int materialCount = 0;
-        char line[kMaxLineLength];
-
         //Defaults
         Material defaultMat;
         scene->AddMaterial(defaultMat);
 
         bool cameraAdded = false;
 
-        while (fgets(line, kMaxLineLength, file))
-        {
-            // skip comments
-            if (line[0] == '#')
-                continue;
-
-            // name used for materials and meshes
-            char name[kMaxLineLength] = { 0 };
+        SceneTokenizer tokens(filename, file.Data(), file.Size());
+        Token header;
 
+        while (tokens.NextLine(header))
+        {
             //--------------------------------------------
             // Material
 
-            if (sscanf(line, " material %s", name) == 1)
+            if (header.Is("material"))
             {
+                Token name;
+                bool named = tokens.Next(name);
+                if (!named)
+                    tokens.Error(header, "Missing material name");
+
                 Material material;
-                char albedoTexName[100] = "None";
-                char metallicRoughnessTexName[100] = "None";
-                char normalTexName[100] = "None";
+                std::string albedoTexName, metallicRoughnessTexName, normalTexName;
 
-                while (fgets(line, kMaxLineLength, file))
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " color %f %f %f", &material.albedo.x, &material.albedo.y, &material.albedo.z);
-                    sscanf(line, " emission %f %f %f", &material.emission.x, &material.emission.y, &material.emission.z);
-                    sscanf(line, " metallic %f", &material.metallic);
-                    sscanf(line, " roughness %f", &material.roughness);
-                    sscanf(line, " subsurface %f", &material.subsurface);
-                    sscanf(line, " specular %f", &material.specular);
-                    sscanf(line, " specularTint %f", &material.specularTint);
-                    sscanf(line, " anisotropic %f", &material.anisotropic);
-                    sscanf(line, " sheen %f", &material.sheen);
-                    sscanf(line, " sheenTint %f", &material.sheenTint);
-                    sscanf(line, " clearcoat %f", &material.clearcoat);
-                    sscanf(line, " clearcoatGloss %f", &material.clearcoatGloss);
-                    sscanf(line, " transmission %f", &material.transmission);
-                    sscanf(line, " ior %f", &material.ior);
-                    sscanf(line, " extinction %f %f %f", &material.extinction.x, &material.extinction.y, &material.extinction.z);
-                    sscanf(line, " atDistance %f", &material.atDistance);
-                    sscanf(line, " albedoTexture %s", albedoTexName);
-                    sscanf(line, " metallicRoughnessTexture %s", metallicRoughnessTexName);
-                    sscanf(line, " normalTexture %s", normalTexName);
-                }
+                    if (key.Is("color"))
+                        tokens.ReadFloats(key, &material.albedo.x, 3);
+                    else if (key.Is("emission"))
+                        tokens.ReadFloats(key, &material.emission.x, 3);
+                    else if (key.Is("metallic"))
+                        tokens.ReadFloats(key, &material.metallic, 1);
+                    else if (key.Is("roughness"))
+                        tokens.ReadFloats(key, &material.roughness, 1);
+                    else if (key.Is("subsurface"))
+                        tokens.ReadFloats(key, &material.subsurface, 1);
+                    else if (key.Is("specular"))
+                        tokens.ReadFloats(key, &material.specular, 1);
+                    else if (key.Is("specularTint"))
+                        tokens.ReadFloats(key, &material.specularTint, 1);
+                    else if (key.Is("anisotropic"))
+                        tokens.ReadFloats(key, &material.anisotropic, 1);
+                    else if (key.Is("sheen"))
+                        tokens.ReadFloats(key, &material.sheen, 1);
+                    else if (key.Is("sheenTint"))
+                        tokens.ReadFloats(key, &material.sheenTint, 1);
+                    else if (key.Is("clearcoat"))
+                        tokens.ReadFloats(key, &material.clearcoat, 1);
+                    else if (key.Is("clearcoatGloss"))
+                        tokens.ReadFloats(key, &material.clearcoatGloss, 1);
+                    else if (key.Is("transmission"))
+                        tokens.ReadFloats(key, &material.transmission, 1);
+                    else if (key.Is("ior"))
+                        tokens.ReadFloats(key, &material.ior, 1);
+                    else if (key.Is("extinction"))
+                        tokens.ReadFloats(key, &material.extinction.x, 3);
+                    else if (key.Is("atDistance"))
+                        tokens.ReadFloats(key, &material.atDistance, 1);
+                    else if (key.Is("albedoTexture"))
+                        tokens.ReadWord(key, albedoTexName);
+                    else if (key.Is("metallicRoughnessTexture"))
+                        tokens.ReadWord(key, metallicRoughnessTexName);
+                    else if (key.Is("normalTexture"))
+                        tokens.ReadWord(key, normalTexName);
+                    else
+                        return false;
+                    return true;
+                });
+
+                // Nothing is added for a block without braces, the error fails the load anyway
+                if (!parsed)
+                    continue;
+
+                // The first material of a name is kept
+                std::string materialName = named ? name.Str() : std::string();
+                if (!named || materialMap.find(materialName) != materialMap.end())
+                    continue;
 
                 // Albedo Texture
-                if (strcmp(albedoTexName, "None") != 0)
+                if (!albedoTexName.empty() && albedoTexName != "None")
                     material.albedoTexID = scene->AddTexture(path + albedoTexName);
              
                 // MetallicRoughness Texture
-                if (strcmp(metallicRoughnessTexName, "None") != 0)
+                if (!metallicRoughnessTexName.empty() && metallicRoughnessTexName != "None")
                     material.metallicRoughnessTexID = scene->AddTexture(path + metallicRoughnessTexName);
     
                 // Normal Map Texture
-                if (strcmp(normalTexName, "None") != 0)
+                if (!normalTexName.empty() && normalTexName != "None")
                     material.normalmapTexID = scene->AddTexture(path + normalTexName);
 
-                // add material to map
-                if (materialMap.find(name) == materialMap.end()) // New material
-                {
-                    int id = scene->AddMaterial(material);
-                    materialMap[name] = MaterialData{ material, id };
-                }
+                materialMap[materialName] = scene->AddMaterial(material);
             }
 
             //--------------------------------------------
             // Light
 
-            if (strstr(line, "light"))
+            else if (header.Is("light"))
             {
                 Light light;
                 Vec3 v1, v2;
-                char light_type[20] = "None";
+                std::string lightType;
 
-                while (fgets(line, kMaxLineLength, file))
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " position %f %f %f", &light.position.x, &light.position.y, &light.position.z);
-                    sscanf(line, " emission %f %f %f", &light.emission.x, &light.emission.y, &light.emission.z);
-
-                    sscanf(line, " radius %f", &light.radius);
-                    sscanf(line, " v1 %f %f %f", &v1.x, &v1.y, &v1.z);
-                    sscanf(line, " v2 %f %f %f", &v2.x, &v2.y, &v2.z);
-                    sscanf(line, " type %s", light_type);
-                }
-
-                if (strcmp(light_type, "Quad") == 0)
+                    if (key.Is("position"))
+                        tokens.ReadFloats(key, &light.position.x, 3);
+                    else if (key.Is("emission"))
+                        tokens.ReadFloats(key, &light.emission.x, 3);
+                    else if (key.Is("radius"))
+                        tokens.ReadFloats(key, &light.radius, 1);
+                    else if (key.Is("v1"))
+                        tokens.ReadFloats(key, &v1.x, 3);
+                    else if (key.Is("v2"))
+                        tokens.ReadFloats(key, &v2.x, 3);
+                    else if (key.Is("type"))
+                        tokens.ReadWord(key, lightType);
+                    else
+                        return false;
+                    return true;
+                });
+
+                if (!parsed)
+                    continue;
+
+                if (lightType == "Quad")
                 {
                     light.type = LightType::RectLight;
                     light.u = v1 - light.position;
                     light.v = v2 - light.position;
                     light.area = Vec3::Length(Vec3::Cross(light.u, light.v));
                 }
-                else if (strcmp(light_type, "Sphere") == 0)
+                else if (lightType == "Sphere")
                 {
                     light.type = LightType::SphereLight;
                     light.area = 4.0f * PI * light.radius * light.radius;
                 }
-                else if (strcmp(light_type, "Distant") == 0)
+                else if (lightType == "Distant")
                 {
                     light.type = LightType::DistantLight;
                     light.area = 0.0f;
                 }
+                else
+                    tokens.Warning(header, "Unknown light type '%s'", lightType.c_str());
 
                 scene->AddLight(light);
             }
@@ -185,25 +612,32 @@ namespace GLSLPT
             //--------------------------------------------
             // Camera
 
-            if (strstr(line, "Camera"))
+            else if (header.Is("Camera"))
             {
                 Vec3 position;
                 Vec3 lookAt;
-                float fov;
+                float fov = 35.0f;
                 float aperture = 0, focalDist = 1;
 
-                while (fgets(line, kMaxLineLength, file))
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " position %f %f %f", &position.x, &position.y, &position.z);
-                    sscanf(line, " lookAt %f %f %f", &lookAt.x, &lookAt.y, &lookAt.z);
-                    sscanf(line, " aperture %f ", &aperture);
-                    sscanf(line, " focaldist %f", &focalDist);
-                    sscanf(line, " fov %f", &fov);
-                }
+                    if (key.Is("position"))
+                        tokens.ReadFloats(key, &position.x, 3);
+                    else if (key.Is("lookAt"))
+                        tokens.ReadFloats(key, &lookAt.x, 3);
+                    else if (key.Is("aperture"))
+                        tokens.ReadFloats(key, &aperture, 1);
+                    else if (key.Is("focaldist"))
+                        tokens.ReadFloats(key, &focalDist, 1);
+                    else if (key.Is("fov"))
+                        tokens.ReadFloats(key, &fov, 1);
+                    else
+                        return false;
+                    return true;
+                });
+
+                if (!parsed)
+                    continue;
 
                 delete scene->camera;
                 scene->AddCamera(position, lookAt, fov);
@@ -215,115 +649,234 @@ namespace GLSLPT
             //--------------------------------------------
             // Renderer
 
-            if (strstr(line, "Renderer"))
+            else if (header.Is("Renderer"))
             {
-                char envMap[200] = "None";
-                char enableRR[10] = "None";
+                std::string envMap;
+                std::string tileOrder;
 
-                while (fgets(line, kMaxLineLength, file))
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
-
-                    sscanf(line, " envMap %s", envMap);
-                    sscanf(line, " resolution %d %d", &renderOptions.resolution.x, &renderOptions.resolution.y);
-                    sscanf(line, " hdrMultiplier %f", &renderOptions.hdrMultiplier);
-                    sscanf(line, " maxDepth %i", &renderOptions.maxDepth);
-                    sscanf(line, " tileWidth %i", &renderOptions.tileWidth);
-                    sscanf(line, " tileHeight %i", &renderOptions.tileHeight);
-                    sscanf(line, " enableRR %s", enableRR);
-                    sscanf(line, " RRDepth %i", &renderOptions.RRDepth);
-                }
-
-                if (strcmp(envMap, "None") != 0)
+                    if (key.Is("envMap"))
+                        tokens.ReadWord(key, envMap);
+                    else if (key.Is("resolution"))
+                        tokens.ReadInts(key, &renderOptions.resolution.x, 2);
+                    else if (key.Is("hdrMultiplier"))
+                        tokens.ReadFloats(key, &renderOptions.hdrMultiplier, 1);
+                    else if (key.Is("maxDepth"))
+                        tokens.ReadInts(key, &renderOptions.maxDepth, 1);
+                    else if (key.Is("tileWidth"))
+                        tokens.ReadInts(key, &renderOptions.tileWidth, 1);
+                    else if (key.Is("tileHeight"))
+                        tokens.ReadInts(key, &renderOptions.tileHeight, 1);
+                    else if (key.Is("enableRR"))
+                        tokens.ReadBool(key, renderOptions.enableRR);
+                    else if (key.Is("RRDepth"))
+                        tokens.ReadInts(key, &renderOptions.RRDepth, 1);
+                    else if (key.Is("tileOrder"))
+                        tokens.ReadWord(key, tileOrder);
+                    else if (key.Is("threads"))
+                        tokens.ReadInts(key, &renderOptions.numThreads, 1);
+                    else if (key.Is("bvhWidth"))
+                        tokens.ReadInts(key, &renderOptions.bvhWidth, 1);
+                    else if (key.Is("enableRayPackets"))
+                        tokens.ReadBool(key, renderOptions.enableRayPackets);
+                    else if (key.Is("compressedBvh"))
+                        tokens.ReadBool(key, renderOptions.compressedBvh);
+                    else if (key.Is("stacklessBvh"))
+                        tokens.ReadBool(key, renderOptions.stacklessBvh);
+                    else if (key.Is("treeletBvh"))
+                        tokens.ReadBool(key, renderOptions.treeletBvh);
+                    else if (key.Is("enableTraversalStats"))
+                        tokens.ReadBool(key, renderOptions.enableTraversalStats);
+                    else
+                        return false;
+                    return true;
+                });
+
+                if (!parsed)
+                    continue;
+
+                if (!envMap.empty() && envMap != "None")
                 {
                     scene->AddHDR(path + envMap);
                     renderOptions.useEnvMap = true;
                 }
 
-                if (strcmp(enableRR, "False") == 0)
-                    renderOptions.enableRR = false;
-                else if (strcmp(enableRR, "True") == 0)
-                    renderOptions.enableRR = true;
+                if (tileOrder == "Scanline")
+                    renderOptions.tileOrder = ScanlineOrder;
+                else if (tileOrder == "Hilbert")
+                    renderOptions.tileOrder = HilbertOrder;
+                else if (tileOrder == "CenterOut")
+                    renderOptions.tileOrder = CenterOutOrder;
+                else if (!tileOrder.empty())
+                    tokens.Warning(header, "Unknown tileOrder %s", tileOrder.c_str());
             }
 
-
             //--------------------------------------------
             // Mesh
 
-            if (strstr(line, "mesh"))
+            else if (header.Is("mesh"))
             {
-                std::string filename;
-                Vec3 pos;
-                Vec3 scale;
+                MeshProperties mesh;
+                Vec3 position, scale(1.0f, 1.0f, 1.0f);
+                Vec4 rotation(0.0f, 0.0f, 0.0f, 1.0f);
                 Mat4 xform;
-                int material_id = 0; // Default Material ID
-                char meshName[200] = "None";
+                bool rotated = false, hasTransform = false;
 
-                while (fgets(line, kMaxLineLength, file))
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
                 {
-                    // end group
-                    if (strchr(line, '}'))
-                        break;
+                    if (mesh.Parse(tokens, key, path, materialMap))
+                        return true;
+                    if (key.Is("position"))
+                        tokens.ReadFloats(key, &position.x, 3);
+                    else if (key.Is("scale"))
+                        tokens.ReadFloats(key, &scale.x, 3);
+                    else if (key.Is("rotation")) // Quaternion x y z w
+                        rotated = tokens.ReadFloats(key, &rotation.x, 4);
+                    else if (key.Is("transform")) // 16 values in the order of Mat4, the translation last
+                        hasTransform = tokens.ReadFloats(key, &xform[0][0], 16);
+                    else
+                        return false;
+                    return true;
+                });
+
+                if (!parsed)
+                    continue;
+
+                if (mesh.filename.empty())
+                {
+                    tokens.Warning(header, "Mesh without a file");
+                    continue;
+                }
 
-                    char file[2048];
-                    char matName[100];
+                // A full transform replaces position, rotation and scale
+                if (!hasTransform && rotated)
+                    xform = Mat4::TRS(position, rotation, scale);
+                else if (!hasTransform)
+                {
+                    xform[0][0] = scale.x;
+                    xform[1][1] = scale.y;
+                    xform[2][2] = scale.z;
+                    xform[3][0] = position.x;
+                    xform[3][1] = position.y;
+                    xform[3][2] = position.z;
+                }
 
-                    sscanf(line, " name %[^\t\n]s", meshName);
+                int mesh_id = mesh.AddMesh(scene, tokens, header);
+                if (mesh_id != -1)
+                    scene->AddMeshInstance(mesh.InstanceName(), mesh_id, xform, mesh.materialID);
+            }
 
-                    if (sscanf(line, " file %s", file) == 1)
-                    {
-                        filename = path + file;
-                    }
+            //--------------------------------------------
+            // Instance array, one mesh and material placed by the transforms in a binary file
 
-                    if (sscanf(line, " material %s", matName) == 1)
+            else if (header.Is("instances"))
+            {
+                MeshProperties mesh;
+                std::string transformsFile;
+                Token transformsKey = header;
+                bool trs = false, knownFormat = true;
+
+                bool parsed = ParseBlock(tokens, header, [&](const Token& key)
+                {
+                    if (mesh.Parse(tokens, key, path, materialMap))
+                        return true;
+                    if (key.Is("transforms"))
                     {
-                        // look up material in dictionary
-                        if (materialMap.find(matName) != materialMap.end())
+                        std::string file;
+                        if (tokens.ReadWord(key, file))
                         {
-                            material_id = materialMap[matName].id;
+                            transformsFile = path + file;
+                            transformsKey = key;
                         }
-                        else
+                    }
+                    else if (key.Is("format"))
+                    {
+                        std::string format;
+                        if (tokens.ReadWord(key, format))
                         {
-                            Log("Could not find material %s\n", matName);
+                            if (format == "trs")
+                                trs = true;
+                            else if (format == "matrix")
+                                trs = false;
+                            else
+                                knownFormat = tokens.Error(key, "Unknown transform format %s, expected matrix or trs", format.c_str());
                         }
                     }
+                    else
+                        return false;
+                    return true;
+                });
+
+                if (!parsed || !knownFormat)
+                    continue;
+
+                if (mesh.filename.empty() || transformsFile.empty())
+                {
+                    tokens.Error(header, "Instances need a mesh file and a transforms file");
+                    continue;
+                }
+
+                std::vector<Mat4> transforms;
+                if (!ReadTransforms(tokens, transformsKey, transformsFile, trs, transforms))
+                    continue;
+                if (transforms.empty())
+                {
+                    tokens.Warning(transformsKey, "%s holds no transforms", transformsFile.c_str());
+                    continue;
+                }
+
+                int mesh_id = mesh.AddMesh(scene, tokens, header);
+                if (mesh_id != -1)
+                    scene->AddMeshInstances(mesh.InstanceName(), mesh_id, transforms.data(), (int)transforms.size(), mesh.materialID);
+            }
 
-                    sscanf(line, " position %f %f %f", &xform[3][0], &xform[3][1], &xform[3][2]);
-                    sscanf(line, " scale %f %f %f", &xform[0][0], &xform[1][1], &xform[2][2]);
+            else
+            {
+                // A block without a header is one commented out by a # in front of it and skipped. Unknown blocks
+                // are skipped with a warning, so scene files with blocks this version doesn't know still load
+                bool commentedOut = header.Is("{");
+                if (header.Is("}"))
+                {
+                    tokens.Error(header, "} without a block");
+                    continue;
                 }
-                if (!filename.empty())
+                if (!commentedOut)
                 {
-                    int mesh_id = scene->AddMesh(filename);
-                    if (mesh_id != -1)
-                    {
-                        std::string instanceName;
+                    tokens.Warning(header, "Unknown block %s", header.Str().c_str());
+                    tokens.SkipLine();
+                }
 
-                        if (strcmp(meshName, "None") != 0)
-                        {
-                            instanceName = std::string(meshName);
-                        }
-                        else
-                        {
-                            std::size_t pos = filename.find_last_of("/\\");
-                            instanceName = filename.substr(pos + 1);
-                        }
-                        
-                        MeshInstance instance1(instanceName, mesh_id, xform, material_id);
-                        scene->AddMeshInstance(instance1);
-                    }
+                Token token;
+                if (commentedOut || tokens.NextIs("{"))
+                {
+                    tokens.SkipLine();
+                    while (tokens.NextLine(token) && !token.Is("}"))
+                        tokens.SkipLine();
                 }
             }
         }
 
-        fclose(file);
+        double parseTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - parseStart).count();
+
+        if (tokens.Errors() > 0)
+        {
+            Log("%s has %d error%s\n", filename.c_str(), tokens.Errors(), tokens.Errors() == 1 ? "" : "s");
+            return false;
+        }
+
+        Log("Parsed %s : %d lines, %zu materials, %zu instances in %.1f ms (%.1f MB/s)\n", filename.c_str(), tokens.Lines(),
+            materialMap.size(), scene->meshInstances.size(), parseTime * 1e3, parseTime > 0.0 ? file.Size() / parseTime / (1024.0 * 1024.0) : 0.0);
 
         if (!cameraAdded)
             scene->AddCamera(Vec3(0.0f, 0.0f, 10.0f), Vec3(0.0f, 0.0f, -10.0f), 35.0f);
 
+        // The acceleration structures depend on the build threads and BVH layout options
+        if (numThreads >= 0)
+            renderOptions.numThreads = numThreads;
+        scene->renderOptions = renderOptions;
         scene->CreateAccelerationStructures();
 
         return true;
     }
-}
\ No newline at end of file
+}
@@ -31,7 +31,8 @@ namespace GLSLPT
 {
     class Scene;
 
-    bool LoadSceneFromFile(const std::string &filename, Scene *scene, RenderOptions& renderOptions);
+    // numThreads >= 0 replaces the threads of the scene file, so loading and the BVH builds already use that many
+    bool LoadSceneFromFile(const std::string &filename, Scene *scene, RenderOptions& renderOptions, int numThreads = -1);
     // logger function. might be set at init time
     extern int(*Log)(const char* szFormat, ...);
 }
\ No newline at end of file
@@ -0,0 +1,475 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Vec2.h"
+#include "Vec3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace GLSLPT
+{
+    // Files below this size are parsed on the calling thread
+    static const size_t kParallelParseSize = 1 << 20;
+    // Chunks per pool thread, so threads that finish early pick up the remaining ones
+    static const int kChunksPerThread = 4;
+
+    namespace
+    {
+        enum ObjLineType
+        {
+            OtherLine,
+            PositionLine,
+            NormalLine,
+            TexcoordLine,
+            FaceLine
+        };
+
+        struct ObjCorner
+        {
+            int v, t, n; // 0 based, t and n are -1 if the face leaves them out
+        };
+
+        // A range of whole lines of the file. The counts of the first pass become the offsets of the chunk's
+        // elements in the output arrays after a prefix sum, so the second pass writes them in place
+        struct ObjChunk
+        {
+            const char* begin;
+            const char* end;
+            size_t lines;
+            size_t positions;
+            size_t normals;
+            size_t texcoords;
+            size_t triangles;
+            size_t badLine; // First line with an invalid face, counted from 1 within the chunk, 0 if none
+        };
+
+        inline bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+        inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+        inline const char* SkipSpaces(const char* p, const char* end)
+        {
+            while (p < end && IsSpace(*p))
+                p++;
+            return p;
+        }
+
+        inline const char* TokenEnd(const char* p, const char* end)
+        {
+            while (p < end && !IsSpace(*p))
+                p++;
+            return p;
+        }
+
+        // Line type and start of its arguments
+        ObjLineType Classify(const char*& p, const char* end)
+        {
+            p = SkipSpaces(p, end);
+            size_t len = end - p;
+            if (len >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p += 1;
+                return PositionLine;
+            }
+            if (len >= 3 && p[0] == 'v' && (p[1] == 'n' || p[1] == 't') && (p[2] == ' ' || p[2] == '\t'))
+            {
+                p += 2;
+                return p[-1] == 'n' ? NormalLine : TexcoordLine;
+            }
+            if (len >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                p += 1;
+                return FaceLine;
+            }
+            return OtherLine;
+        }
+
+        // Reads up to count whitespace separated numbers, missing ones stay as they are
+        void ParseFloats(const char* p, const char* end, float* values, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                p = SkipSpaces(p, end);
+                if (p == end)
+                    return;
+                values[i] = ParseFloat(p, end);
+                p = TokenEnd(p, end);
+            }
+        }
+
+        // One index of a face corner. Positive indices count from 1, negative ones back from the last element read
+        bool ParseIndex(const char*& p, const char* end, size_t numRead, size_t numTotal, int& index)
+        {
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negative = *p++ == '-';
+
+            const char* digits = p;
+            int64_t value = 0;
+            for (; p < end && IsDigit(*p); p++)
+                value = value * 10 + (*p - '0');
+
+            if (p == digits || p - digits > 10 || value == 0)
+                return false;
+
+            int64_t resolved = negative ? (int64_t)numRead - value : value - 1;
+            if (resolved < 0 || resolved >= (int64_t)numTotal)
+                return false;
+
+            index = (int)resolved;
+            return true;
+        }
+
+        // v, v/t, v//n or v/t/n up to the next whitespace
+        bool ParseCorner(const char*& p, const char* end, const size_t* numRead, const size_t* numTotal, ObjCorner& corner)
+        {
+            corner.t = corner.n = -1;
+            if (!ParseIndex(p, end, numRead[0], numTotal[0], corner.v))
+                return false;
+            if (p == end || IsSpace(*p))
+                return true;
+            if (*p++ != '/')
+                return false;
+
+            if (p < end && *p != '/' && !ParseIndex(p, end, numRead[1], numTotal[1], corner.t))
+                return false;
+            if (p == end || IsSpace(*p))
+                return true;
+            if (*p++ != '/')
+                return false;
+
+            return ParseIndex(p, end, numRead[2], numTotal[2], corner.n) && (p == end || IsSpace(*p));
+        }
+
+        const char* NextLine(const char* lineEnd, const char* end)
+        {
+            return lineEnd < end ? lineEnd + 1 : end;
+        }
+
+        const char* LineEnd(const char* p, const char* end)
+        {
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            return newline ? newline : end;
+        }
+
+        void CountChunk(ObjChunk& chunk)
+        {
+            chunk.lines = chunk.positions = chunk.normals = chunk.texcoords = chunk.triangles = 0;
+            chunk.badLine = 0;
+
+            for (const char* p = chunk.begin; p < chunk.end; )
+            {
+                const char* lineEnd = LineEnd(p, chunk.end);
+                chunk.lines++;
+
+                switch (Classify(p, lineEnd))
+                {
+                case PositionLine: chunk.positions++; break;
+                case NormalLine:   chunk.normals++;   break;
+                case TexcoordLine: chunk.texcoords++; break;
+                case FaceLine:
+                {
+                    size_t corners = 0;
+                    for (p = SkipSpaces(p, lineEnd); p < lineEnd; p = SkipSpaces(TokenEnd(p, lineEnd), lineEnd))
+                        corners++;
+                    chunk.triangles += corners > 2 ? corners - 2 : 0;
+                    break;
+                }
+                default: break;
+                }
+
+                p = NextLine(lineEnd, chunk.end);
+            }
+        }
+
+        // Second pass over a chunk whose counts were replaced by offsets. numTotal holds the number of positions,
+        // texcoords and normals in the whole file
+        void ParseChunk(ObjChunk& chunk, const size_t* numTotal, Vec3* positions, Vec2* texcoords, Vec3* normals, ObjCorner* corners)
+        {
+            // Elements read before the current line, in the order of ObjCorner
+            size_t numRead[3] = { chunk.positions, chunk.texcoords, chunk.normals };
+            size_t triangle = chunk.triangles;
+            size_t line = 0;
+
+            for (const char* p = chunk.begin; p < chunk.end; )
+            {
+                const char* lineEnd = LineEnd(p, chunk.end);
+                line++;
+
+                switch (Classify(p, lineEnd))
+                {
+                case PositionLine:
+                    ParseFloats(p, lineEnd, &positions[numRead[0]++].x, 3);
+                    break;
+                case TexcoordLine:
+                    ParseFloats(p, lineEnd, &texcoords[numRead[1]++].x, 2);
+                    break;
+                case NormalLine:
+                    ParseFloats(p, lineEnd, &normals[numRead[2]++].x, 3);
+                    break;
+                case FaceLine:
+                {
+                    // Triangle fan around the first corner, so every triangle counted by CountChunk() gets written
+                    ObjCorner first = {}, previous = {};
+                    int numCorners = 0;
+                    for (p = SkipSpaces(p, lineEnd); p < lineEnd; p = SkipSpaces(p, lineEnd))
+                    {
+                        ObjCorner corner;
+                        if (!ParseCorner(p, lineEnd, numRead, numTotal, corner))
+                        {
+                            corner = ObjCorner{ 0, -1, -1 };
+                            if (chunk.badLine == 0)
+                                chunk.badLine = line;
+                            p = TokenEnd(p, lineEnd);
+                        }
+
+                        if (numCorners == 0)
+                            first = corner;
+                        else if (numCorners >= 2)
+                        {
+                            corners[3 * triangle + 0] = first;
+                            corners[3 * triangle + 1] = previous;
+                            corners[3 * triangle + 2] = corner;
+                            triangle++;
+                        }
+                        previous = corner;
+                        numCorners++;
+                    }
+                    break;
+                }
+                default: break;
+                }
+
+                p = NextLine(lineEnd, chunk.end);
+            }
+        }
+    }
+
+    float ParseFloat(const char*& p, const char* end)
+    {
+        static const double kPow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool truncated = false;
+        bool any = false;
+
+        for (; p < end && IsDigit(*p); p++, any = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+            }
+            else
+            {
+                exponent++;
+                truncated = true;
+            }
+        }
+
+        if (p < end && *p == '.')
+        {
+            for (p++; p < end && IsDigit(*p); p++, any = true)
+            {
+                if (digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+                else
+                    truncated = true;
+            }
+        }
+
+        if (!any)
+            return 0.0f;
+
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char* q = p + 1;
+            bool negativeExp = false;
+            if (q < end && (*q == '-' || *q == '+'))
+                negativeExp = *q++ == '-';
+
+            int e = 0;
+            bool expDigits = false;
+            for (; q < end && IsDigit(*q); q++, expDigits = true)
+                e = std::min(e * 10 + (*q - '0'), 100000);
+
+            if (expDigits)
+            {
+                exponent += negativeExp ? -e : e;
+                p = q;
+            }
+        }
+
+        if (!truncated && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+        {
+            double value = exponent < 0 ? mantissa / kPow10[-exponent] : mantissa * kPow10[exponent];
+            return (float)(negative ? -value : value);
+        }
+
+        char buffer[128];
+        size_t len = std::min<size_t>(p - start, sizeof(buffer) - 1);
+        memcpy(buffer, start, len);
+        buffer[len] = '\0';
+        return (float)strtod(buffer, nullptr);
+    }
+
+    bool LoadObj(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY,
+        std::vector<int> &indices, ThreadPool *pool)
+    {
+        MappedFile file;
+        if (!file.Open(filename))
+        {
+            printf("Unable to load model %s\n", filename.c_str());
+            return false;
+        }
+
+        const char* data = file.Data();
+        const char* end = data + file.Size();
+
+        // Chunks end after a newline, so lines are never split
+        size_t numChunks = 1;
+        if (pool != nullptr && file.Size() >= kParallelParseSize)
+            numChunks = std::min<size_t>((size_t)pool->GetNumThreads() * kChunksPerThread, file.Size() / (kParallelParseSize / 4));
+
+        std::vector<ObjChunk> chunks;
+        const char* chunkBegin = data;
+        for (size_t i = 1; i <= numChunks && chunkBegin < end; i++)
+        {
+            const char* chunkEnd = i == numChunks ? end : std::max(chunkBegin, data + file.Size() / numChunks * i);
+            chunkEnd = NextLine(LineEnd(chunkEnd, end), end);
+            chunks.push_back(ObjChunk{ chunkBegin, chunkEnd, 0, 0, 0, 0, 0, 0 });
+            chunkBegin = chunkEnd;
+        }
+
+        ParallelFor(pool, 0, (int)chunks.size(), 1, [&](size_t i) { CountChunk(chunks[i]); });
+
+        size_t numTotal[3] = { 0, 0, 0 };
+        size_t numTriangles = 0, numLines = 0;
+        for (ObjChunk& chunk : chunks)
+        {
+            std::swap(numTotal[0], chunk.positions);
+            std::swap(numTotal[1], chunk.texcoords);
+            std::swap(numTotal[2], chunk.normals);
+            std::swap(numTriangles, chunk.triangles);
+            std::swap(numLines, chunk.lines);
+            numTotal[0] += chunk.positions;
+            numTotal[1] += chunk.texcoords;
+            numTotal[2] += chunk.normals;
+            numTriangles += chunk.triangles;
+            numLines += chunk.lines;
+        }
+
+        if (numTriangles == 0)
+        {
+            printf("No triangles in %s\n", filename.c_str());
+            return false;
+        }
+
+        if (numTriangles * 3 > INT32_MAX)
+        {
+            printf("Too many triangles in %s\n", filename.c_str());
+            return false;
+        }
+
+        std::vector<Vec3> positions(numTotal[0]);
+        std::vector<Vec2> texcoords(numTotal[1]);
+        std::vector<Vec3> normals(numTotal[2]);
+        std::vector<ObjCorner> corners(numTriangles * 3);
+
+        ParallelFor(pool, 0, (int)chunks.size(), 1, [&](size_t i) {
+            ParseChunk(chunks[i], numTotal, positions.data(), texcoords.data(), normals.data(), corners.data());
+        });
+
+        for (const ObjChunk& chunk : chunks)
+        {
+            if (chunk.badLine != 0)
+            {
+                printf("Invalid face in %s at line %zu\n", filename.c_str(), chunk.lines + chunk.badLine);
+                return false;
+            }
+        }
+
+        // Welding runs in file order, so vertices are numbered by their first use. Corners are looked up through
+        // a chain per position, most positions only have one or two normal and texcoord combinations
+        std::vector<int> head(positions.size(), -1);
+        std::vector<int> next;
+        std::vector<ObjCorner> vertices;
+        next.reserve(positions.size());
+        vertices.reserve(positions.size());
+        indices.resize(corners.size());
+
+        for (size_t i = 0; i < corners.size(); i++)
+        {
+            const ObjCorner& c = corners[i];
+            int vertex = head[c.v];
+            while (vertex >= 0 && (vertices[vertex].t != c.t || vertices[vertex].n != c.n))
+                vertex = next[vertex];
+
+            if (vertex < 0)
+            {
+                vertex = (int)vertices.size();
+                vertices.push_back(c);
+                next.push_back(head[c.v]);
+                head[c.v] = vertex;
+            }
+            indices[i] = vertex;
+        }
+
+        verticesUVX.resize(vertices.size());
+        normalsUVY.resize(vertices.size());
+        size_t numRanges = chunks.size();
+        ParallelFor(pool, 0, (int)numRanges, 1, [&](size_t r) {
+            size_t first = vertices.size() * r / numRanges;
+            size_t last = vertices.size() * (r + 1) / numRanges;
+            for (size_t i = first; i < last; i++)
+            {
+                const ObjCorner& c = vertices[i];
+                Vec2 uv = c.t >= 0 ? texcoords[c.t] : Vec2(0.0f, 0.0f);
+                Vec3 n = c.n >= 0 ? normals[c.n] : Vec3(0.0f, 0.0f, 0.0f);
+                verticesUVX[i] = Vec4(positions[c.v].x, positions[c.v].y, positions[c.v].z, uv.x);
+                normalsUVY[i] = Vec4(n.x, n.y, n.z, uv.y);
+            }
+        });
+
+        return true;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Vec4.h"
+
+namespace GLSLPT
+{
+    class ThreadPool;
+
+    // Reads the geometry of an OBJ file: v, vn, vt and f lines, everything else is skipped. Polygons are split
+    // into triangle fans and face corners sharing the same position, normal and texcoord indices are welded into
+    // one vertex. Large files are parsed in chunks on the pool. Prints the reason and returns false on failure
+    bool LoadObj(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY,
+        std::vector<int> &indices, ThreadPool *pool = nullptr);
+
+    // The OBJ path LoadObj() replaced, tinyobj followed by welding the corners in a hash map. Only kept as the
+    // baseline of the OBJ loading benchmark
+    bool LoadObjTinyObj(const std::string &filename, std::vector<Vec4> &verticesUVX, std::vector<Vec4> &normalsUVY,
+        std::vector<int> &indices);
+
+    // Decimal to float, stops after the number and returns 0 if there is none. Up to 19 significant
+    // digits with a power of ten of at most 22 are converted with a single rounding in double arithmetic, which covers
+    // what exporters write. Anything longer goes through strtod
+    float ParseFloat(const char*& p, const char* end);
+}
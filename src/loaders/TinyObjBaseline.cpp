@@ -0,0 +1,85 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ObjLoader.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace GLSLPT
+{
+    namespace
+    {
+        struct ObjCornerHash
+        {
+            size_t operator()(const tinyobj::index_t& idx) const
+            {
+                uint64_t h = (uint64_t)(uint32_t)idx.vertex_index * 0x9e3779b97f4a7c15ull;
+                h ^= (uint64_t)(uint32_t)idx.normal_index * 0xc2b2ae3d27d4eb4full;
+                h ^= (uint64_t)(uint32_t)idx.texcoord_index * 0x165667b19e3779f9ull;
+                return (size_t)(h ^ (h >> 29));
+            }
+        };
+
+        struct ObjCornerEqual
+        {
+            bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const
+            {
+                return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+            }
+        };
+    }
+
+    bool LoadObjTinyObj(const std::string& filename, std::vector<Vec4>& verticesUVX, std::vector<Vec4>& normalsUVY, std::vector<int>& indices)
+    {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str(), 0, true))
+            return false;
+
+        std::unordered_map<tinyobj::index_t, int, ObjCornerHash, ObjCornerEqual> cornerVertices;
+        for (const tinyobj::shape_t& shape : shapes)
+        {
+            for (const tinyobj::index_t& idx : shape.mesh.indices)
+            {
+                auto inserted = cornerVertices.emplace(idx, (int)verticesUVX.size());
+                indices.push_back(inserted.first->second);
+                if (!inserted.second)
+                    continue;
+
+                const float* v = &attrib.vertices[3 * idx.vertex_index];
+                const float* n = idx.normal_index >= 0 ? &attrib.normals[3 * idx.normal_index] : nullptr;
+                const float* t = idx.texcoord_index >= 0 ? &attrib.texcoords[2 * idx.texcoord_index] : nullptr;
+                verticesUVX.push_back(Vec4(v[0], v[1], v[2], t ? t[0] : 0.0f));
+                normalsUVY.push_back(n ? Vec4(n[0], n[1], n[2], t ? t[1] : 0.0f) : Vec4(0.0f, 0.0f, 0.0f, t ? t[1] : 0.0f));
+            }
+        }
+        return true;
+    }
+}
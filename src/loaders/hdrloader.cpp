@@ -12,6 +12,7 @@
 */
 
 #include "hdrloader.h"
+#include "ThreadPool.h"
 
 #include <math.h>
 #include <memory.h>
@@ -54,7 +55,7 @@ int LowerBound(const float* array, int lower, int upper, const float value)
     return lower;
 }
 
-void HDRLoader::buildDistributions(HDRData* res)
+void HDRLoader::buildDistributions(HDRData* res, ThreadPool* pool)
 {
     int width  = res->width;
     int height = res->height;
@@ -68,9 +69,8 @@ void HDRLoader::buildDistributions(HDRData* res)
     res->marginalDistData    = new Vec2[height];
     res->conditionalDistData = new Vec2[width*height];
 
-    float colWeightSum = 0.0f;
-
-    for (int j = 0; j < height; j++)
+    /* Rows are independent, only the marginal sums them up in order */
+    ParallelFor(pool, 0, height, 16, [&](int j)
     {
         float rowWeightSum = 0.0f;
 
@@ -91,9 +91,14 @@ void HDRLoader::buildDistributions(HDRData* res)
             cdf2D[j*width + i] /= rowWeightSum;
         }
 
-        colWeightSum += rowWeightSum;
-
         pdf1D[j] = rowWeightSum;
+    });
+
+    float colWeightSum = 0.0f;
+
+    for (int j = 0; j < height; j++)
+    {
+        colWeightSum += pdf1D[j];
         cdf1D[j] = colWeightSum;
     }
     
@@ -105,15 +110,15 @@ void HDRLoader::buildDistributions(HDRData* res)
     }
 
     /* Precalculate row and col to avoid binary search during lookup in the shader */
-    for (int i = 0; i < height; i++)
+    ParallelFor(pool, 0, height, 1024, [&](int i)
     {
         float invHeight = (float)(i+1) / height;
         int row = LowerBound(cdf1D, 0, height, invHeight);
         res->marginalDistData[i].x = row / (float)height;
         res->marginalDistData[i].y = pdf1D[i];
-    }
+    });
 
-    for (int j = 0; j < height; j++)
+    ParallelFor(pool, 0, height, 16, [&](int j)
     {
         for (int i = 0; i < width; i++)
         {
@@ -122,7 +127,7 @@ void HDRLoader::buildDistributions(HDRData* res)
             res->conditionalDistData[j*width + i].x = col / (float)width;
             res->conditionalDistData[j*width + i].y = pdf2D[j*width + i];
         }
-    }
+    });
 
     delete[] pdf2D;
     delete[] pdf1D;
@@ -130,7 +135,7 @@ void HDRLoader::buildDistributions(HDRData* res)
     delete[] cdf1D;
 }
 
-HDRData* HDRLoader::load(const char *fileName)
+HDRData* HDRLoader::load(const char *fileName, ThreadPool* pool)
 {
     int i;
     char str[200];
@@ -199,7 +204,7 @@ HDRData* HDRLoader::load(const char *fileName)
     delete [] scanline;
     fclose(file);
 
-    buildDistributions(res);
+    buildDistributions(res, pool);
     return res;
 }
 
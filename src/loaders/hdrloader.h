@@ -14,6 +14,11 @@
     This is a modified version of the original code. Addeed code to build marginal & conditional densities for IBL importance sampling
 */
 
+namespace GLSLPT
+{
+    class ThreadPool;
+}
+
 using namespace GLSLPT;
 
 class HDRData {
@@ -29,7 +34,8 @@ public:
 
 class HDRLoader {
 private:
-    static void buildDistributions(HDRData* res);
+    static void buildDistributions(HDRData* res, ThreadPool* pool);
 public:
-    static HDRData* load(const char *fileName);
+    // The sampling distributions are built on the pool if there is one
+    static HDRData* load(const char *fileName, ThreadPool* pool = nullptr);
 };
\ No newline at end of file
@@ -25,6 +25,7 @@
 #pragma once
 
 #include <Vec3.h>
+#include <Vec4.h>
 
 namespace GLSLPT
 {
@@ -39,6 +40,11 @@ namespace GLSLPT
 
         static Mat4 Translate(const Vec3& a);
         static Mat4 Scale(const Vec3& a);
+        // Scales by s, rotates by the quaternion q = (x, y, z, w) and translates by t. q is normalized first
+        static Mat4 TRS(const Vec3& t, const Vec4& q, const Vec3& s);
+
+        // General 4x4 inverse, returns a zero matrix for singular input
+        static Mat4 Inverse(const Mat4& m);
 
         float data[4][4];
     };
@@ -69,6 +75,57 @@ namespace GLSLPT
         return out;
     }
 
+    inline Mat4 Mat4::TRS(const Vec3& t, const Vec4& q, const Vec3& s)
+    {
+        float len2 = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+        float k = len2 > 0.0f ? 2.0f / len2 : 0.0f;
+
+        float xx = q.x * q.x * k, yy = q.y * q.y * k, zz = q.z * q.z * k;
+        float xy = q.x * q.y * k, xz = q.x * q.z * k, yz = q.y * q.z * k;
+        float wx = q.w * q.x * k, wy = q.w * q.y * k, wz = q.w * q.z * k;
+
+        // Rows are the transformed axes, as in Translate() and Scale()
+        Mat4 out;
+        out[0][0] = (1.0f - yy - zz) * s.x; out[0][1] = (xy + wz) * s.x;        out[0][2] = (xz - wy) * s.x;
+        out[1][0] = (xy - wz) * s.y;        out[1][1] = (1.0f - xx - zz) * s.y; out[1][2] = (yz + wx) * s.y;
+        out[2][0] = (xz + wy) * s.z;        out[2][1] = (yz - wx) * s.z;        out[2][2] = (1.0f - xx - yy) * s.z;
+        out[3][0] = t.x;                    out[3][1] = t.y;                    out[3][2] = t.z;
+        return out;
+    }
+
+    inline Mat4 Mat4::Inverse(const Mat4& mat)
+    {
+        const float* m = &mat.data[0][0];
+        float inv[16];
+
+        inv[0]  =  m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4]  = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8]  =  m[4] * m[9]  * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9]  * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1]  = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5]  =  m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9]  = -m[0] * m[9]  * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] =  m[0] * m[9]  * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2]  =  m[1] * m[6]  * m[15] - m[1] * m[7]  * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7]  - m[13] * m[3] * m[6];
+        inv[6]  = -m[0] * m[6]  * m[15] + m[0] * m[7]  * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7]  + m[12] * m[3] * m[6];
+        inv[10] =  m[0] * m[5]  * m[15] - m[0] * m[7]  * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7]  - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5]  * m[14] + m[0] * m[6]  * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6]  + m[12] * m[2] * m[5];
+        inv[3]  = -m[1] * m[6]  * m[11] + m[1] * m[7]  * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9]  * m[2] * m[7]  + m[9]  * m[3] * m[6];
+        inv[7]  =  m[0] * m[6]  * m[11] - m[0] * m[7]  * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8]  * m[2] * m[7]  - m[8]  * m[3] * m[6];
+        inv[11] = -m[0] * m[5]  * m[11] + m[0] * m[7]  * m[9]  + m[4] * m[1] * m[11] - m[4] * m[3] * m[9]  - m[8]  * m[1] * m[7]  + m[8]  * m[3] * m[5];
+        inv[15] =  m[0] * m[5]  * m[10] - m[0] * m[6]  * m[9]  - m[4] * m[1] * m[10] + m[4] * m[2] * m[9]  + m[8]  * m[1] * m[6]  - m[8]  * m[2] * m[5];
+
+        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+        Mat4 out;
+        float* o = &out.data[0][0];
+        for (int i = 0; i < 16; i++)
+            o[i] = inv[i] * invDet;
+
+        return out;
+    }
+
     inline Mat4 Mat4::operator*(const Mat4& b) const
     {
         Mat4 out;
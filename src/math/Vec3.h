@@ -40,6 +40,13 @@ namespace GLSLPT
         Vec3 operator+(const Vec3& b) const;
         Vec3 operator-(const Vec3& b) const;
         Vec3 operator*(float b) const;
+        Vec3 operator/(const Vec3& b) const;
+        Vec3 operator/(float b) const;
+        Vec3 operator-() const;
+
+        Vec3& operator+=(const Vec3& b);
+        Vec3& operator*=(const Vec3& b);
+        Vec3& operator*=(float b);
 
         float operator[](int i) const;
         float& operator[](int i);
@@ -95,6 +102,39 @@ namespace GLSLPT
         return Vec3(x * b, y * b, z * b);
     };
 
+    inline Vec3 Vec3::operator/(const Vec3& b) const
+    {
+        return Vec3(x / b.x, y / b.y, z / b.z);
+    };
+
+    inline Vec3 Vec3::operator/(float b) const
+    {
+        return Vec3(x / b, y / b, z / b);
+    };
+
+    inline Vec3 Vec3::operator-() const
+    {
+        return Vec3(-x, -y, -z);
+    };
+
+    inline Vec3& Vec3::operator+=(const Vec3& b)
+    {
+        x += b.x; y += b.y; z += b.z;
+        return *this;
+    };
+
+    inline Vec3& Vec3::operator*=(const Vec3& b)
+    {
+        x *= b.x; y *= b.y; z *= b.z;
+        return *this;
+    };
+
+    inline Vec3& Vec3::operator*=(float b)
+    {
+        x *= b; y *= b; z *= b;
+        return *this;
+    };
+
     inline float Vec3::operator[](int i) const
     {
         if (i == 0)
@@ -85,6 +85,13 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 #endif
 
     // Intersect BVH and tris
+#ifdef STACKLESS_BVH
+    // Nodes are visited in memory order. A node whose box is hit continues with its left child at index + 1,
+    // everything else with its miss link, see BvhTranslator::missLinks. Only the miss link of the TLAS leaf
+    // a BLAS was entered from has to be kept
+    int index = topBVHIndex;
+    int resumeIndex = -1;
+#else
     int stack[64];
     int ptr = 0;
     stack[ptr++] = -1;
@@ -93,32 +100,152 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
     float leftHit = 0.0;
     float rightHit = 0.0;
 
+#ifndef COMPRESSED_BVH
+    // Nodes are two texels with the bounds in xyz and the offset/count in w. The data of a child is read
+    // together with its bounds, so only nodes reached from the stack are fetched again
+    ivec4 node0 = texelFetch(BVH, index * 2 + 0);
+    ivec4 node1 = texelFetch(BVH, index * 2 + 1);
+    bool fetchNode = false;
+#endif
+#endif
+
     int currMatID = 0;
     bool BLAS = false;
 
     ivec3 triID = ivec3(-1);
-    mat4 transMat;
-    mat4 transform;
+    mat4 invTransMat;
+    mat4 invTransform;
     vec3 texCoords;
     vec3 bary;
 
     Ray rTrans;
     rTrans.origin = r.origin;
     rTrans.direction = r.direction;
+    vec3 invDir = 1.0 / r.direction;
+
+#ifdef STACKLESS_BVH
+    while (index != -1)
+    {
+#ifdef TRAVERSAL_STATS
+        statNodeVisits++;
+#endif
+        ivec4 node0 = texelFetch(BVH, index * 2 + 0);
+        ivec4 node1 = texelFetch(BVH, index * 2 + 1);
+
+        int offset = node0.w;
+        int count  = node1.w;
+
+        if (AABBIntersect(intBitsToFloat(node0.xyz), intBitsToFloat(node1.xyz), rTrans.origin, invDir, t) >= 0.0)
+        {
+            if (count == 0) // Internal node
+            {
+                index++;
+                continue;
+            }
+            else if (count < 0) // Leaf node of TLAS
+            {
+                vec4 r1 = texelFetch(transformsTex, (-count - 1) * 4 + 0).xyzw;
+                vec4 r2 = texelFetch(transformsTex, (-count - 1) * 4 + 1).xyzw;
+                vec4 r3 = texelFetch(transformsTex, (-count - 1) * 4 + 2).xyzw;
+                vec4 r4 = texelFetch(transformsTex, (-count - 1) * 4 + 3).xyzw;
+
+                invTransMat = mat4(r1, r2, r3, r4);
+
+                rTrans.origin    = vec3(invTransMat * vec4(r.origin, 1.0));
+                rTrans.direction = vec3(invTransMat * vec4(r.direction, 0.0));
+                invDir = 1.0 / rTrans.direction;
+
+                currMatID = texelFetch(BVH, (index + 1) * 2).w;
+                resumeIndex = texelFetch(missLinksTex, index).x;
+                index = offset;
+                BLAS = true;
+                continue;
+            }
+
+            // Leaf node of BLAS
+#ifdef TRAVERSAL_STATS
+            statTriTests += count;
+#endif
+            for (int i = 0; i < count; i++) // Loop through tris
+            {
+                ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, offset + i).xyz);
+
+                vec4 v0 = texelFetch(verticesTex, vertIndices.x);
+                vec4 v1 = texelFetch(verticesTex, vertIndices.y);
+                vec4 v2 = texelFetch(verticesTex, vertIndices.z);
+
+                vec3 e0 = v1.xyz - v0.xyz;
+                vec3 e1 = v2.xyz - v0.xyz;
+                vec3 pv = cross(rTrans.direction, e1);
+                float det = dot(e0, pv);
+
+                vec3 tv = rTrans.origin - v0.xyz;
+                vec3 qv = cross(tv, e0);
 
+                vec4 uvt;
+                uvt.x = dot(tv, pv);
+                uvt.y = dot(rTrans.direction, qv);
+                uvt.z = dot(e1, qv);
+                uvt.xyz = uvt.xyz / det;
+                uvt.w = 1.0 - uvt.x - uvt.y;
+
+                if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < t)
+                {
+                    t = uvt.z;
+                    triID = vertIndices;
+                    state.matID = currMatID;
+                    bary = uvt.wxy;
+                    texCoords = vec3(v0.w, v1.w, v2.w);
+                    invTransform = invTransMat;
+                }
+            }
+        }
+        index = texelFetch(missLinksTex, index).x;
+
+        // The last node of a BLAS links to -1, continue in the TLAS
+        if (BLAS && index == -1)
+        {
+            BLAS = false;
+
+            index = resumeIndex;
+
+            rTrans.origin = r.origin;
+            rTrans.direction = r.direction;
+            invDir = 1.0 / r.direction;
+        }
+    }
+#else
     while (index != -1)
     {
-        ivec3 LRLeaf = ivec3(texelFetch(BVH, index * 3 + 2).xyz);
+#ifdef TRAVERSAL_STATS
+        statNodeVisits++;
+#endif
+#ifdef COMPRESSED_BVH
+        // Leaves only need the first texel, see BvhTranslator::CompressedNode
+        ivec4 node0 = texelFetch(BVH, index * 2);
+
+        int offset = node0.w < 0 ? node0.x : node0.w;
+        int count  = node0.w < 0 ? node0.y : 0;
+#else
+        if (fetchNode)
+        {
+            node0 = texelFetch(BVH, index * 2 + 0);
+            node1 = texelFetch(BVH, index * 2 + 1);
+        }
+        fetchNode = true;
 
-        int leftIndex  = int(LRLeaf.x);
-        int rightIndex = int(LRLeaf.y);
-        int leaf       = int(LRLeaf.z);
+        int offset = node0.w;
+        int count  = node1.w;
+#endif
 
-        if (leaf > 0) // Leaf node of BLAS
+        if (count > 0) // Leaf node of BLAS
         {
-            for (int i = 0; i < rightIndex; i++) // Loop through tris
+#ifdef TRAVERSAL_STATS
+            statTriTests += count;
+#endif
+            for (int i = 0; i < count; i++) // Loop through tris
             {
-                ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, leftIndex + i).xyz);
+                ivec3 vertIndices = ivec3(texelFetch(vertexIndicesTex, offset + i).xyz);
 
                 vec4 v0 = texelFetch(verticesTex, vertIndices.x);
                 vec4 v1 = texelFetch(verticesTex, vertIndices.y);
@@ -146,35 +273,64 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
                     state.matID = currMatID;
                     bary = uvt.wxy;
                     texCoords = vec3(v0.w, v1.w, v2.w);
-                    transform = transMat;
+                    invTransform = invTransMat;
                 }
             }
         }
-        else if (leaf < 0) // Leaf node of TLAS
+        else if (count < 0) // Leaf node of TLAS
         {
-            vec4 r1 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 0, 0), 0).xyzw;
-            vec4 r2 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 1, 0), 0).xyzw;
-            vec4 r3 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 2, 0), 0).xyzw;
-            vec4 r4 = texelFetch(transformsTex, ivec2((-leaf - 1) * 4 + 3, 0), 0).xyzw;
+            // transformsTex holds only the inverse transforms, four texels per instance
+            vec4 r1 = texelFetch(transformsTex, (-count - 1) * 4 + 0).xyzw;
+            vec4 r2 = texelFetch(transformsTex, (-count - 1) * 4 + 1).xyzw;
+            vec4 r3 = texelFetch(transformsTex, (-count - 1) * 4 + 2).xyzw;
+            vec4 r4 = texelFetch(transformsTex, (-count - 1) * 4 + 3).xyzw;
 
-            transMat = mat4(r1, r2, r3, r4);
+            invTransMat = mat4(r1, r2, r3, r4);
 
-            rTrans.origin    = vec3(inverse(transMat) * vec4(r.origin, 1.0));
-            rTrans.direction = vec3(inverse(transMat) * vec4(r.direction, 0.0));
+            rTrans.origin    = vec3(invTransMat * vec4(r.origin, 1.0));
+            rTrans.direction = vec3(invTransMat * vec4(r.direction, 0.0));
+            invDir = 1.0 / rTrans.direction;
 
             // Add a marker. We'll return to this spot after we've traversed the entire BLAS
             stack[ptr++] = -1;
-            index = leftIndex;
+#ifdef COMPRESSED_BVH
+            currMatID = node0.z;
+#else
+            currMatID = texelFetch(BVH, (index + 1) * 2).w;
+#endif
+            index = offset;
             BLAS = true;
-            currMatID = rightIndex;
             continue;
         }
         else
         {
-            leftHit  = AABBIntersect(texelFetch(BVH, leftIndex  * 3 + 0).xyz, texelFetch(BVH, leftIndex  * 3 + 1).xyz, rTrans);
-            rightHit = AABBIntersect(texelFetch(BVH, rightIndex * 3 + 0).xyz, texelFetch(BVH, rightIndex * 3 + 1).xyz, rTrans);
+            int leftIndex  = index + 1;
+            int rightIndex = offset;
+
+#ifdef COMPRESSED_BVH
+            ivec4 childBounds = texelFetch(BVH, index * 2 + 1);
+            vec3 origin = intBitsToFloat(node0.xyz);
+            vec3 scale  = intBitsToFloat(((childBounds.xyz >> 24) & 0xFF) << 23);
+
+            leftHit  = AABBIntersect(origin + Dequantize(childBounds.x) * scale, origin + Dequantize(childBounds.y) * scale, rTrans.origin, invDir, t);
+            rightHit = AABBIntersect(origin + Dequantize(childBounds.z) * scale, origin + Dequantize(childBounds.w) * scale, rTrans.origin, invDir, t);
+#else
+            ivec4 left0  = texelFetch(BVH, leftIndex  * 2 + 0);
+            ivec4 left1  = texelFetch(BVH, leftIndex  * 2 + 1);
+            ivec4 right0 = texelFetch(BVH, rightIndex * 2 + 0);
+            ivec4 right1 = texelFetch(BVH, rightIndex * 2 + 1);
+
+            leftHit  = AABBIntersect(intBitsToFloat(left0.xyz),  intBitsToFloat(left1.xyz),  rTrans.origin, invDir, t);
+            rightHit = AABBIntersect(intBitsToFloat(right0.xyz), intBitsToFloat(right1.xyz), rTrans.origin, invDir, t);
+
+            // Keep the texels of the child we descend into
+            bool leftFirst = leftHit >= 0.0 && (rightHit < 0.0 || leftHit <= rightHit);
+            node0 = leftFirst ? left0 : right0;
+            node1 = leftFirst ? left1 : right1;
+            fetchNode = leftHit < 0.0 && rightHit < 0.0;
+#endif
 
-            if (leftHit > 0.0 && rightHit > 0.0)
+            if (leftHit >= 0.0 && rightHit >= 0.0)
             {
                 int deferred = -1;
                 if (leftHit > rightHit)
@@ -191,12 +347,12 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
                 stack[ptr++] = deferred;
                 continue;
             }
-            else if (leftHit > 0.)
+            else if (leftHit >= 0.0)
             {
                 index = leftIndex;
                 continue;
             }
-            else if (rightHit > 0.)
+            else if (rightHit >= 0.0)
             {
                 index = rightIndex;
                 continue;
@@ -213,8 +369,10 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 
             rTrans.origin = r.origin;
             rTrans.direction = r.direction;
+            invDir = 1.0 / r.direction;
         }
     }
+#endif
 
     // No intersections
     if (t == INFINITY)
@@ -242,7 +400,8 @@ bool ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 
         vec3 normal = normalize(n1.xyz * bary.x + n2.xyz * bary.y + n3.xyz * bary.z);
 
-        state.normal = normalize(transpose(inverse(mat3(transform))) * normal);
+        // Same as transpose(inverse(mat3(transform))) * normal
+        state.normal = normalize(normal * mat3(invTransform));
         state.ffnormal = dot(state.normal, r.direction) <= 0.0 ? state.normal : state.normal * -1.0;
 
         Onb(state.normal, state.tangent, state.bitangent);
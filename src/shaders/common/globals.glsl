@@ -31,6 +31,12 @@
 #define SPHERE_LIGHT 1
 #define DISTANT_LIGHT 2
 
+#ifdef TRAVERSAL_STATS
+// Node visits and triangle tests of the current pixel, written out instead of the radiance
+int statNodeVisits = 0;
+int statTriTests = 0;
+#endif
+
 struct Ray
 {
     vec3 origin;
@@ -69,19 +69,27 @@ float RectIntersect(in vec3 pos, in vec3 u, in vec3 v, in vec4 plane, in Ray r)
 }
 
 //----------------------------------------------------------------
-float AABBIntersect(vec3 minCorner, vec3 maxCorner, Ray r)
+float AABBIntersect(vec3 minCorner, vec3 maxCorner, vec3 origin, vec3 invDir, float tMax)
 //----------------------------------------------------------------
 {
-    vec3 invdir = 1.0 / r.direction;
-
-    vec3 f = (maxCorner - r.origin) * invdir;
-    vec3 n = (minCorner - r.origin) * invdir;
+    // Entry distance clamped to the ray start, -1 when the box is missed or entered beyond tMax
+    vec3 f = (maxCorner - origin) * invDir;
+    vec3 n = (minCorner - origin) * invDir;
 
     vec3 tmax = max(f, n);
     vec3 tmin = min(f, n);
 
-    float t1 = min(tmax.x, min(tmax.y, tmax.z));
-    float t0 = max(tmin.x, max(tmin.y, tmin.z));
+    float t1 = min(min(tmax.x, min(tmax.y, tmax.z)), tMax);
+    float t0 = max(max(tmin.x, max(tmin.y, tmin.z)), 0.0);
 
-    return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
-}
\ No newline at end of file
+    return (t1 >= t0) ? t0 : -1.0;
+}
+#ifdef COMPRESSED_BVH
+//----------------------------------------------------------------
+vec3 Dequantize(int q)
+//----------------------------------------------------------------
+{
+    // Quantized box bound of a compressed BVH node, 8 bits per axis in the low three bytes
+    return vec3(q & 0xFF, (q >> 8) & 0xFF, (q >> 16) & 0xFF);
+}
+#endif
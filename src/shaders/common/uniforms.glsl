@@ -31,12 +31,13 @@ uniform vec2 tileOffset;
 uniform vec2 invNumTiles;
 
 uniform sampler2D accumTexture;
-uniform samplerBuffer BVH;
+uniform isamplerBuffer BVH;
+uniform isamplerBuffer missLinksTex;
 uniform isamplerBuffer vertexIndicesTex;
 uniform samplerBuffer verticesTex;
 uniform samplerBuffer normalsTex;
 uniform sampler2D materialsTex;
-uniform sampler2D transformsTex;
+uniform samplerBuffer transformsTex;
 uniform sampler2D lightsTex;
 uniform sampler2DArray textureMapsArrayTex;
 
@@ -65,6 +65,9 @@ void main(void)
     Ray ray = Ray(camera.position + randomAperturePos, finalRayDir);
 
     vec3 pixelColor = PathTrace(ray);
+#ifdef TRAVERSAL_STATS
+    pixelColor = vec3(statNodeVisits, statTriTests, 0.0);
+#endif
 
     color = pixelColor;
 }
\ No newline at end of file
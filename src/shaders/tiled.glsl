@@ -69,6 +69,9 @@ void main(void)
     vec3 accumColor = texture(accumTexture, coordsTile).xyz;
 
     vec3 pixelColor = PathTrace(ray);
+#ifdef TRAVERSAL_STATS
+    pixelColor = vec3(statNodeVisits, statTriTests, 0.0);
+#endif
         
     color = accumColor + pixelColor;
 }
\ No newline at end of file
@@ -65,14 +65,10 @@ namespace GLSLPT
         xform  = Mat4::Scale(Vec3(0.25f, 0.25f, 0.25f));
         xform1 = Mat4::Scale(Vec3(0.25f, 0.25f, 0.25f)) * Mat4::Translate(Vec3(0.2f, 0.0f, 0.0f));
         xform2 = Mat4::Scale(Vec3(0.25f, 0.25f, 0.25f)) * Mat4::Translate(Vec3(-0.2f, 0.0f, 0.0f));
-        
-        MeshInstance instance("Ajax Black", mesh_id, xform,  black_mat_id);
-        MeshInstance instance1("Ajax Gold", mesh_id, xform1, gold_mat_id);
-        MeshInstance instance2("Ajax Red",  mesh_id, xform2, red_mat_id);
 
-        scene->AddMeshInstance(instance);
-        scene->AddMeshInstance(instance1);
-        scene->AddMeshInstance(instance2);
+        scene->AddMeshInstance("Ajax Black", mesh_id, xform,  black_mat_id);
+        scene->AddMeshInstance("Ajax Gold", mesh_id, xform1, gold_mat_id);
+        scene->AddMeshInstance("Ajax Red",  mesh_id, xform2, red_mat_id);
 
         scene->AddHDR("./assets/HDR/sunset.hdr");
 
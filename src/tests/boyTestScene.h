@@ -122,37 +122,19 @@ namespace GLSLPT
         //xform4 Mat4::Rotate(90.0f, Vec3(0.0, 0, 1));
         xform5 = Mat4::Translate(Vec3(-0.1, 0, 0.15));
 
-        MeshInstance instance1("background.obj",  mesh_id4, xform1, white_mat_id);
-
-        MeshInstance instance2("head1.obj", mesh_id1, xform_head * xform2, head_mat_id);
-        MeshInstance instance3("body1.obj", mesh_id2, xform_body * xform2, body_mat_id);
-        MeshInstance instance4("base1.obj", mesh_id3, xform_base * xform2, base_mat_id);
-        
-        MeshInstance instance5("head2.obj", mesh_id1, xform_head * xform3, head_mat_id);
-        MeshInstance instance6("body2.obj", mesh_id2, xform_body * xform3, body_mat_id);
-        MeshInstance instance7("base2.obj", mesh_id3, xform_base * xform3, base_mat_id);
-
-        MeshInstance instance8("head3.obj", mesh_id1, xform_head * xform4, head_mat_id);
-        MeshInstance instance9("body3.obj", mesh_id2, xform_body * xform4, body_mat_id);
-        MeshInstance instance10("base3.obj", mesh_id3, xform_base * xform4, base_mat_id);
-
-        MeshInstance instance11("head4.obj", mesh_id1, xform_head * xform5, head_mat_id);
-        MeshInstance instance12("body4.obj", mesh_id2, xform_body * xform5, body_mat_id);
-        MeshInstance instance13("base4.obj", mesh_id3, xform_base * xform5, base_mat_id);
-
-        scene->AddMeshInstance(instance1);
-        scene->AddMeshInstance(instance2);
-        scene->AddMeshInstance(instance3);
-        scene->AddMeshInstance(instance4);
-        scene->AddMeshInstance(instance5);
-        scene->AddMeshInstance(instance6);
-        scene->AddMeshInstance(instance7);
-        scene->AddMeshInstance(instance8);
-        scene->AddMeshInstance(instance9);
-        scene->AddMeshInstance(instance10);
-        scene->AddMeshInstance(instance11);
-        scene->AddMeshInstance(instance12);
-        scene->AddMeshInstance(instance13);
+        scene->AddMeshInstance("background.obj",  mesh_id4, xform1, white_mat_id);
+        scene->AddMeshInstance("head1.obj", mesh_id1, xform_head * xform2, head_mat_id);
+        scene->AddMeshInstance("body1.obj", mesh_id2, xform_body * xform2, body_mat_id);
+        scene->AddMeshInstance("base1.obj", mesh_id3, xform_base * xform2, base_mat_id);
+        scene->AddMeshInstance("head2.obj", mesh_id1, xform_head * xform3, head_mat_id);
+        scene->AddMeshInstance("body2.obj", mesh_id2, xform_body * xform3, body_mat_id);
+        scene->AddMeshInstance("base2.obj", mesh_id3, xform_base * xform3, base_mat_id);
+        scene->AddMeshInstance("head3.obj", mesh_id1, xform_head * xform4, head_mat_id);
+        scene->AddMeshInstance("body3.obj", mesh_id2, xform_body * xform4, body_mat_id);
+        scene->AddMeshInstance("base3.obj", mesh_id3, xform_base * xform4, base_mat_id);
+        scene->AddMeshInstance("head4.obj", mesh_id1, xform_head * xform5, head_mat_id);
+        scene->AddMeshInstance("body4.obj", mesh_id2, xform_body * xform5, body_mat_id);
+        scene->AddMeshInstance("base4.obj", mesh_id3, xform_base * xform5, base_mat_id);
 
         scene->CreateAccelerationStructures();
 
@@ -71,22 +71,14 @@ namespace GLSLPT
         int light_id = scene->AddLight(light);
 
         Mat4 xform = Mat4::Scale(Vec3(0.01f, 0.01f, 0.01f));
-        
-        MeshInstance instance1("Ceiling", ceiling_mesh_id, xform * Mat4::Translate(Vec3(0.278f, 0.5488f, .27955f)), white_mat_id);
-        MeshInstance instance2("Floor", floor_mesh_id, xform * Mat4::Translate(Vec3(0.2756f, 0.0f, 0.2796f)), white_mat_id);
-        MeshInstance instance3("Back Wall", back_mesh_id, xform * Mat4::Translate(Vec3(0.2764f, 0.2744f, 0.5592f)), white_mat_id);
-        MeshInstance instance4("Left Wall", greenwall_mesh_id, xform * Mat4::Translate(Vec3(0.0f, 0.2744f, 0.2796f)), green_mat_id);
-        MeshInstance instance5("Large Box", largebox_mesh_id, xform * Mat4::Translate(Vec3(0.3685f, 0.165f, 0.35125f)), white_mat_id);
-        MeshInstance instance6("Right Wall", redwall_mesh_id, xform * Mat4::Translate(Vec3(0.5536f, 0.2744f, 0.2796f)), red_mat_id);
-        MeshInstance instance7("Small Box", smallbox_mesh_id, xform * Mat4::Translate(Vec3(0.1855f, 0.0825f, 0.169f)), white_mat_id);
 
-        scene->AddMeshInstance(instance1);
-        scene->AddMeshInstance(instance2);
-        scene->AddMeshInstance(instance3);
-        scene->AddMeshInstance(instance4);
-        scene->AddMeshInstance(instance5);
-        scene->AddMeshInstance(instance6);
-        scene->AddMeshInstance(instance7);
+        scene->AddMeshInstance("Ceiling", ceiling_mesh_id, xform * Mat4::Translate(Vec3(0.278f, 0.5488f, .27955f)), white_mat_id);
+        scene->AddMeshInstance("Floor", floor_mesh_id, xform * Mat4::Translate(Vec3(0.2756f, 0.0f, 0.2796f)), white_mat_id);
+        scene->AddMeshInstance("Back Wall", back_mesh_id, xform * Mat4::Translate(Vec3(0.2764f, 0.2744f, 0.5592f)), white_mat_id);
+        scene->AddMeshInstance("Left Wall", greenwall_mesh_id, xform * Mat4::Translate(Vec3(0.0f, 0.2744f, 0.2796f)), green_mat_id);
+        scene->AddMeshInstance("Large Box", largebox_mesh_id, xform * Mat4::Translate(Vec3(0.3685f, 0.165f, 0.35125f)), white_mat_id);
+        scene->AddMeshInstance("Right Wall", redwall_mesh_id, xform * Mat4::Translate(Vec3(0.5536f, 0.2744f, 0.2796f)), red_mat_id);
+        scene->AddMeshInstance("Small Box", smallbox_mesh_id, xform * Mat4::Translate(Vec3(0.1855f, 0.0825f, 0.169f)), white_mat_id);
 
         scene->AddHDR("./assets/HDR/sunset.hdr");
 
@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace RadeonRays
+{
+    // Cache line size assumed for the layout of flattened BVH nodes
+    static std::size_t constexpr kCacheLineSize = 64;
+
+    // std::vector allocator returning storage aligned to Alignment bytes. malloc only guarantees 16 bytes,
+    // which lets nodes that are a multiple of the cache line size straddle one more line than they need
+    template <class T, std::size_t Alignment = kCacheLineSize>
+    class AlignedAllocator
+    {
+    public:
+        typedef T value_type;
+
+        template <class U>
+        struct rebind
+        {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() = default;
+
+        template <class U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(std::size_t n)
+        {
+            void* p = nullptr;
+#ifdef _WIN32
+            p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+                p = nullptr;
+#endif
+            if (p == nullptr)
+                throw std::bad_alloc();
+
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, std::size_t)
+        {
+#ifdef _WIN32
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+    };
+
+    template <class T, class U, std::size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+    template <class T, class U, std::size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+}
+
+#endif // ALIGNED_ALLOCATOR_H
@@ -20,6 +20,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 #include "bvh.h"
+#include "parallel_build.h"
+#include "sah_bins.h"
 
 #include <algorithm>
 #include <thread>
@@ -31,22 +33,236 @@ THE SOFTWARE.
 
 namespace RadeonRays
 {
-    static int constexpr kMaxPrimitivesPerLeaf = 1;
+    static_assert(sizeof(Bvh::PackedNode) == 32, "Packed nodes are stored as is");
 
     static bool is_nan(float v)
     {
         return v != v;
     }
 
-    void Bvh::Build(bbox const* bounds, int numbounds)
+    void Bvh::Build(bbox const* bounds, int numbounds, GLSLPT::ThreadPool* pool)
     {
+        // Start from scratch so the same object can be rebuilt
+        m_bounds = bbox();
+        m_height = 0;
+        m_packed_indices.clear();
+
         for (int i = 0; i < numbounds; ++i)
         {
             // Calc bbox
             m_bounds.grow(bounds[i]);
         }
 
+        m_pool = pool != nullptr && pool->GetNumThreads() > 1 ? pool : nullptr;
+        m_parallel_build = false;
+
         BuildImpl(bounds, numbounds);
+
+        m_pool = nullptr;
+    }
+
+    void Bvh::Refit(bbox const* bounds, int numbounds, GLSLPT::ThreadPool* pool)
+    {
+        m_pool = pool != nullptr && pool->GetNumThreads() > 1 ? pool : nullptr;
+
+        // Spawn a task per subtree for the first few levels, enough to keep every thread busy
+        int spawndepth = 0;
+        if (m_pool)
+            while ((1 << spawndepth) < 4 * m_pool->GetNumThreads())
+                ++spawndepth;
+
+        RefitNode(m_root, bounds, numbounds, spawndepth);
+        m_bounds = m_root->bounds;
+
+        m_pool = nullptr;
+    }
+
+    void Bvh::RefitNode(Node* node, bbox const* bounds, int numbounds, int spawndepth)
+    {
+        bbox nodebounds;
+
+        if (node->type == kLeaf)
+        {
+            for (int j = node->startidx; j < node->startidx + node->numprims; ++j)
+            {
+                assert(m_packed_indices[j] < numbounds);
+                nodebounds.grow(bounds[m_packed_indices[j]]);
+            }
+        }
+        else
+        {
+            if (spawndepth > 0)
+            {
+                GLSLPT::TaskGroup group(m_pool);
+                group.Run([&] { RefitNode(node->lc, bounds, numbounds, spawndepth - 1); });
+                RefitNode(node->rc, bounds, numbounds, spawndepth - 1);
+                group.Wait();
+            }
+            else
+            {
+                RefitNode(node->lc, bounds, numbounds, 0);
+                RefitNode(node->rc, bounds, numbounds, 0);
+            }
+
+            nodebounds.grow(node->lc->bounds);
+            nodebounds.grow(node->rc->bounds);
+        }
+
+        node->bounds = nodebounds;
+    }
+
+    float Bvh::SahCost() const
+    {
+        float rootarea = m_root->bounds.surface_area();
+        return rootarea > 0.f ? SahCost(m_root) / rootarea : 0.f;
+    }
+
+    float Bvh::SahCost(Node const* node) const
+    {
+        if (node->type == kLeaf)
+            return node->bounds.surface_area() * node->numprims;
+
+        return node->bounds.surface_area() * m_traversal_cost + SahCost(node->lc) + SahCost(node->rc);
+    }
+
+    void Bvh::Pack(std::vector<PackedNode>& nodes) const
+    {
+        nodes.reserve(nodes.size() + m_nodecnt);
+        PackNode(m_root, nodes, (int)nodes.size());
+    }
+
+    int Bvh::PackNode(Node const* node, std::vector<PackedNode>& nodes, int root) const
+    {
+        int index = (int)nodes.size();
+        nodes.emplace_back();
+
+        PackedNode packed;
+        packed.pmin = node->bounds.pmin;
+        packed.pmax = node->bounds.pmax;
+
+        if (node->type == kLeaf)
+        {
+            packed.first = node->startidx;
+            packed.second = -node->numprims;
+        }
+        else
+        {
+            packed.first = PackNode(node->lc, nodes, root);
+            packed.second = PackNode(node->rc, nodes, root);
+        }
+
+        // nodes may be reallocated by the recursion, so only index into it afterwards
+        nodes[index] = packed;
+        return index - root;
+    }
+
+    bool Bvh::Unpack(PackedNode const* nodes, int numnodes, int const* indices, int numindices, int numbounds)
+    {
+        InitNodeAllocator(std::max(numnodes, 1));
+        m_nodecnt = numnodes;
+        m_packed_indices.assign(indices, indices + numindices);
+        m_indices = m_packed_indices;
+        m_bounds = bbox();
+        m_height = 0;
+
+        // Depth first order puts children after their parent, so levels and node indices are known on the way down
+        bool valid = numnodes > 0;
+        m_nodes[0].index = 1;
+        std::vector<int> levels(numnodes, 0);
+
+        for (int i = 0; i < numnodes && valid; ++i)
+        {
+            Node& node = m_nodes[i];
+            node.bounds.pmin = nodes[i].pmin;
+            node.bounds.pmax = nodes[i].pmax;
+
+            if (nodes[i].second > 0)
+            {
+                int lc = nodes[i].first;
+                int rc = nodes[i].second;
+                valid = lc > i && lc < numnodes && rc > i && rc < numnodes;
+                if (!valid)
+                    break;
+
+                node.type = kInternal;
+                node.lc = &m_nodes[lc];
+                node.rc = &m_nodes[rc];
+                node.lc->index = node.index << 1;
+                node.rc->index = (node.index << 1) + 1;
+                levels[lc] = levels[rc] = levels[i] + 1;
+            }
+            else
+            {
+                node.type = kLeaf;
+                node.startidx = nodes[i].first;
+                node.numprims = -nodes[i].second;
+                valid = node.startidx >= 0 && node.startidx + node.numprims <= numindices;
+            }
+
+            m_height = std::max((int)m_height, levels[i]);
+        }
+
+        for (int i = 0; i < numindices && valid; ++i)
+            valid = indices[i] >= 0 && indices[i] < numbounds;
+
+        if (!valid)
+        {
+            m_nodecnt = 0;
+            m_packed_indices.clear();
+            m_indices.clear();
+            m_root = nullptr;
+            return false;
+        }
+
+        m_root = &m_nodes[0];
+        m_bounds = m_root->bounds;
+        return true;
+    }
+
+    void Bvh::UpdateHeight(int level)
+    {
+        int height = m_height;
+        while (level > height && !m_height.compare_exchange_weak(height, level))
+        {
+        }
+    }
+
+    void Bvh::RelayoutNodes(bool rightfirst)
+    {
+        std::vector<Node> nodes(std::max<size_t>(m_nodes.size(), m_nodecnt));
+        int count = 0;
+
+        // Node to copy and the pointer of its parent to redirect
+        std::vector<std::pair<Node const*, Node**>> stack;
+        stack.push_back({ m_root, nullptr });
+
+        while (!stack.empty())
+        {
+            auto item = stack.back();
+            stack.pop_back();
+
+            Node* node = &nodes[count++];
+            *node = *item.first;
+            if (item.second) *item.second = node;
+
+            if (node->type == kInternal)
+            {
+                // Pushed in reverse, the child built first is copied first
+                if (rightfirst)
+                {
+                    stack.push_back({ node->lc, &node->lc });
+                    stack.push_back({ node->rc, &node->rc });
+                }
+                else
+                {
+                    stack.push_back({ node->rc, &node->rc });
+                    stack.push_back({ node->lc, &node->lc });
+                }
+            }
+        }
+
+        m_nodes.swap(nodes);
+        m_root = &m_nodes[0];
     }
 
     bbox const& Bvh::Bounds() const
@@ -67,29 +283,34 @@ namespace RadeonRays
 
     void Bvh::BuildNode(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices)
     {
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         Node* node = AllocateNode();
         node->bounds = req.bounds;
         node->index = req.index;
 
-        // Create leaf node if we have enough prims
-        if (req.numprims < 2)
+        // Create leaf node if we have enough prims, with SAH termination only if no split is cheaper
+        SahSplit ss;
+        ss.split = std::numeric_limits<float>::quiet_NaN();
+        bool makeleaf = req.numprims < 2 || (req.numprims <= m_max_leaf_size && (!m_usesah || m_leaf_cost <= 0.f));
+
+        if (!makeleaf && m_usesah)
+        {
+            ss = FindSahSplit(req, bounds, centroids, primindices);
+            makeleaf = req.numprims <= m_max_leaf_size && (is_nan(ss.split) || req.numprims * m_leaf_cost < ss.sah);
+        }
+
+        // Leaves are met in the order of primindices, so a leaf packs its primitives at its own startidx
+        if (makeleaf)
         {
-#ifdef USE_TBB
-            primitive_mutex_.lock();
-#endif
             node->type = kLeaf;
-            node->startidx = static_cast<int>(m_packed_indices.size());
+            node->startidx = req.startidx;
             node->numprims = req.numprims;
 
             for (auto i = 0; i < req.numprims; ++i)
             {
-                m_packed_indices.push_back(primindices[req.startidx + i]);
+                m_packed_indices[req.startidx + i] = primindices[req.startidx + i];
             }
-#ifdef USE_TBB
-            primitive_mutex_.unlock();
-#endif
         }
         else
         {
@@ -97,30 +318,10 @@ namespace RadeonRays
             int axis = req.centroid_bounds.maxdim();
             float border = req.centroid_bounds.center()[axis];
 
-            if (m_usesah)
+            if (!is_nan(ss.split))
             {
-                SahSplit ss = FindSahSplit(req, bounds, centroids, primindices);
-
-                if (!is_nan(ss.split))
-                {
-                    axis = ss.dim;
-                    border = ss.split;
-
-                    if (req.numprims < ss.sah && req.numprims < kMaxPrimitivesPerLeaf)
-                    {
-                        node->type = kLeaf;
-                        node->startidx = static_cast<int>(m_packed_indices.size());
-                        node->numprims = req.numprims;
-
-                        for (auto i = 0; i < req.numprims; ++i)
-                        {
-                            m_packed_indices.push_back(primindices[req.startidx + i]);
-                        }
-
-                        if (req.ptr) *req.ptr = node;
-                        return;
-                    }
-                }
+                axis = ss.dim;
+                border = ss.split;
             }
 
             node->type = kInternal;
@@ -131,7 +332,15 @@ namespace RadeonRays
 
             bool near2far = (req.numprims + req.startidx) & 0x1;
 
-            if (req.centroid_bounds.extents()[axis] > 0.f)
+            if (req.centroid_bounds.extents()[axis] > 0.f && m_pool && req.numprims >= kParallelSweepThreshold)
+            {
+                splitidx = ParallelPartition(m_pool, primindices, req.startidx, req.startidx + req.numprims,
+                    [=](int idx) { return near2far ? centroids[idx][axis] < border : centroids[idx][axis] >= border; },
+                    [=](int idx) -> bbox const& { return bounds[idx]; },
+                    [=](int idx) -> Vec3 const& { return centroids[idx]; },
+                    leftbounds, rightbounds, leftcentroid_bounds, rightcentroid_bounds);
+            }
+            else if (req.centroid_bounds.extents()[axis] > 0.f)
             {
                 auto first = req.startidx;
                 auto last = req.startidx + req.numprims;
@@ -228,13 +437,25 @@ namespace RadeonRays
             // Right request
             SplitRequest rightrequest = { splitidx, req.numprims - (splitidx - req.startidx), &node->rc, rightbounds, rightcentroid_bounds, req.level + 1, (req.index << 1) + 1 };
 
+            if (m_pool && req.numprims >= kParallelTaskThreshold)
             {
-                // Put those to stack
-                BuildNode(leftrequest, bounds, centroids, primindices);
-            }
+                m_parallel_build = true;
 
-            {
+                GLSLPT::TaskGroup group(m_pool);
+                group.Run([&] { BuildNode(leftrequest, bounds, centroids, primindices); });
                 BuildNode(rightrequest, bounds, centroids, primindices);
+                group.Wait();
+            }
+            else
+            {
+                {
+                    // Put those to stack
+                    BuildNode(leftrequest, bounds, centroids, primindices);
+                }
+
+                {
+                    BuildNode(rightrequest, bounds, centroids, primindices);
+                }
             }
         }
 
@@ -242,13 +463,19 @@ namespace RadeonRays
         if (req.ptr) *req.ptr = node;
     }
 
+    Bvh::SahSplit Bvh::FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const
+    {
+        if (m_scalar_bins)
+            return FindSahSplit<ScalarSahBins>(req, bounds, centroids, primindices);
+        return FindSahSplit<SahBins>(req, bounds, centroids, primindices);
+    }
+
+    template <class Bins>
     Bvh::SahSplit Bvh::FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const
     {
         // SAH implementation
         // calc centroids histogram
         // int const kNumBins = 128;
-        // moving split bin index
-        int splitidx = -1;
         // Set SAH to maximum float value as a start
         float sah = std::numeric_limits<float>::max();
         SahSplit split;
@@ -265,91 +492,48 @@ namespace RadeonRays
             return split;
         }
 
-        // Bin has bbox and occurence count
-        struct Bin
-        {
-            bbox bounds;
-            int count;
-        };
-
-        // Keep bins for each dimension
-        std::vector<Bin> bins[3];
-        bins[0].resize(m_num_bins);
-        bins[1].resize(m_num_bins);
-        bins[2].resize(m_num_bins);
-
         // Precompute inverse parent area
         float invarea = 1.f / req.bounds.surface_area();
         // Precompute min point
         Vec3 rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
-        {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            float centroid_rng = centroid_extents[axis];
-            float invcentroid_rng = 1.f / centroid_rng;
-
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
-
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
-            {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
-            }
+        // Calc primitive refs histogram
+        Bins bins;
+        bins.Init(m_num_bins, req.centroid_bounds);
 
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+        if (m_pool && req.numprims >= kParallelSweepThreshold)
+        {
+            // Counts and bounds merge exactly, so the histogram is the same as a serial one
+            int numchunks = GetNumChunks(m_pool, req.numprims);
+            std::vector<Bins> chunkbins(numchunks);
+            ParallelChunks(m_pool, req.startidx, req.startidx + req.numprims, numchunks, [&](int chunk, int first, int last)
             {
-                int idx = primindices[i];
-                int binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((centroids[idx][axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
-
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(bounds[idx]);
-            }
-
-            std::vector<bbox> rightbounds(m_num_bins - 1);
+                chunkbins[chunk].Init(m_num_bins, req.centroid_bounds);
+                for (int i = first; i < last; ++i)
+                {
+                    chunkbins[chunk].Add(bounds[primindices[i]], centroids[primindices[i]]);
+                }
+            });
 
-            // Start with 1-bin right box
-            bbox rightbox = bbox();
-            for (int i = m_num_bins - 1; i > 0; --i)
+            for (int chunk = 0; chunk < numchunks; ++chunk)
             {
-                rightbox.grow(bins[axis][i].bounds);
-                rightbounds[i - 1] = rightbox;
+                bins.Merge(chunkbins[chunk]);
             }
-
-            bbox leftbox = bbox();
-            int  leftcount = 0;
-            int  rightcount = req.numprims;
-
-            // Start best SAH search
-            // i is current split candidate (split between i and i + 1)
-            float sahtmp = 0.f;
-            for (int i = 0; i < m_num_bins - 1; ++i)
+        }
+        else
+        {
+            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
             {
-                leftbox.grow(bins[axis][i].bounds);
-                leftcount += bins[axis][i].count;
-                rightcount -= bins[axis][i].count;
-
-                // Compute SAH
-                sahtmp = m_traversal_cost + (leftcount * leftbox.surface_area() + rightcount * rightbounds[i].surface_area()) * invarea;
-
-                // Check if it is better than what we found so far
-                if (sahtmp < sah)
-                {
-                    split.dim = axis;
-                    splitidx = i;
-                    split.sah = sah = sahtmp;
-                }
+                bins.Add(bounds[primindices[i]], centroids[primindices[i]]);
             }
         }
 
         // Choose split plane
-        if (splitidx != -1)
+        int axis, splitidx;
+        if (bins.FindBestSplit(m_traversal_cost, invarea, req.numprims, axis, splitidx, sah))
         {
+            split.dim = axis;
+            split.sah = sah;
             split.split = rootmin[split.dim] + (splitidx + 1) * (centroid_extents[split.dim] / m_num_bins);
         }
 
@@ -364,6 +548,7 @@ namespace RadeonRays
         // Cache some stuff to have faster partitioning
         std::vector<Vec3> centroids(numbounds);
         m_indices.resize(numbounds);
+        m_packed_indices.resize(numbounds);
         std::iota(m_indices.begin(), m_indices.end(), 0);
 
         // Calc bbox
@@ -489,6 +674,17 @@ namespace RadeonRays
 
         // Set root_ pointer
         m_root = &m_nodes[0];
+
+        if (m_parallel_build)
+        {
+            RelayoutNodes(false);
+        }
+    }
+
+    void Bvh::SetLeafParams(int max_leaf_size, float leaf_cost)
+    {
+        m_max_leaf_size = std::max(1, max_leaf_size);
+        m_leaf_cost = leaf_cost;
     }
 
     void Bvh::PrintStatistics(std::ostream& os) const
@@ -496,6 +692,7 @@ namespace RadeonRays
         os << "Class name: " << "Bvh\n";
         os << "SAH: " << (m_usesah ? "enabled\n" : "disabled\n");
         os << "SAH bins: " << m_num_bins << "\n";
+        os << "Max leaf size: " << m_max_leaf_size << "\n";
         os << "Number of triangles: " << m_indices.size() << "\n";
         os << "Number of nodes: " << m_nodecnt << "\n";
         os << "Tree height: " << GetHeight() << "\n";
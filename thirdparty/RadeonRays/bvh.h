@@ -31,9 +31,20 @@ THE SOFTWARE.
 #include <iostream>
 
 #include "bbox.h"
+#include "sah_bins.h"
+
+namespace GLSLPT
+{
+    class ThreadPool;
+}
 
 namespace RadeonRays
 {
+    template <int N> class WideBvhTranslator;
+
+    // Leaf size the mesh builders start with, the plain Bvh defaults to one primitive per leaf for the TLAS
+    static int constexpr kMeshMaxLeafSize = 3;
+
     ///< The class represents bounding volume hierarachy
     ///< intersection accelerator
     ///<
@@ -42,21 +53,65 @@ namespace RadeonRays
     public:
         Bvh(float traversal_cost, int num_bins = 64, bool usesah = false)
             : m_root(nullptr)
-            , m_num_bins(num_bins)
+            , m_num_bins(std::min(num_bins, kMaxSahBins))
             , m_usesah(usesah)
             , m_height(0)
             , m_traversal_cost(traversal_cost)
+            , m_max_leaf_size(1)
+            , m_leaf_cost(0.f)
+            , m_pool(nullptr)
+            , m_parallel_build(false)
+            , m_scalar_bins(false)
         {
         }
 
-        ~Bvh() = default;
+        virtual ~Bvh() = default;
 
         // World space bounding box
         bbox const& Bounds() const;
 
         // Build function
         // bounds is an array of bounding boxes
-        void Build(bbox const* bounds, int numbounds);
+        // With a thread pool the upper levels are built as parallel tasks,
+        // the resulting tree is identical to the one built on a single thread
+        void Build(bbox const* bounds, int numbounds, GLSLPT::ThreadPool* pool = nullptr);
+
+        // Recomputes the node bounds bottom up from new primitive bounds, indexed as in the last Build(),
+        // keeping the tree topology. With a thread pool the upper subtrees are refitted as parallel tasks.
+        // SplitBvh leaves grow to the whole boxes of their primitives, the spatial splits are not redone
+        void Refit(bbox const* bounds, int numbounds, GLSLPT::ThreadPool* pool = nullptr);
+
+        // Flat copy of a built tree, e.g. to store it on disk. Internal nodes hold the indices of their children,
+        // leaves their range of GetIndices()
+        struct PackedNode
+        {
+            Vec3 pmin;
+            int first;  // Left child, or first primitive of a leaf
+            Vec3 pmax;
+            int second; // Right child (> 0), or the number of primitives of a leaf negated (<= 0)
+        };
+
+        // Appends the nodes in depth first order, the root first. Child indices count from the root, so
+        // several trees can be packed into one vector
+        void Pack(std::vector<PackedNode>& nodes) const;
+        // Replaces the tree with nodes and indices from Pack() and GetIndices() of a BVH built from numbounds
+        // primitives. Returns false, leaving the BVH empty, if they do not form a valid tree
+        bool Unpack(PackedNode const* nodes, int numnodes, int const* indices, int numindices, int numbounds);
+
+        // Expected cost of a ray hitting the root: traversal cost per internal node and one per leaf primitive,
+        // weighted by surface area relative to the root. Grows as refitted nodes overlap
+        float SahCost() const;
+
+        // Leaves hold at most max_leaf_size primitives. A node that fits is still split if SAH is enabled
+        // and its best split is cheaper than leaf_cost per primitive, a leaf_cost <= 0 makes it a leaf right away.
+        // Takes effect on the next Build()
+        void SetLeafParams(int max_leaf_size, float leaf_cost);
+        int GetMaxLeafSize() const { return m_max_leaf_size; }
+        float GetLeafCost() const { return m_leaf_cost; }
+
+        // Bins SAH candidates with the portable ScalarSahBins even where SahBins is the SSE version, to measure
+        // one against the other. Both build the same tree. Takes effect on the next Build()
+        void SetScalarBinning(bool scalar) { m_scalar_bins = scalar; }
 
         // Get tree height
         int GetHeight() const;
@@ -109,6 +164,16 @@ namespace RadeonRays
         void BuildNode(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices);
 
         SahSplit FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const;
+        template <class Bins>
+        SahSplit FindSahSplit(SplitRequest const& req, bbox const* bounds, Vec3 const* centroids, int* primindices) const;
+
+        void UpdateHeight(int level);
+        // Refit() of one subtree, spawndepth levels below node still run as tasks
+        void RefitNode(Node* node, bbox const* bounds, int numbounds, int spawndepth);
+        float SahCost(Node const* node) const;
+        int PackNode(Node const* node, std::vector<PackedNode>& nodes, int root) const;
+        // Rewrites m_nodes in depth first order (the order of a single threaded build) after a parallel build
+        void RelayoutNodes(bool rightfirst);
 
         // Enum for node type
         enum NodeType
@@ -134,11 +199,21 @@ namespace RadeonRays
         // SAH flag
         bool m_usesah;
         // Tree height
-        int m_height;
+        std::atomic<int> m_height;
         // Node traversal cost
         float m_traversal_cost;
         // Number of spatial bins to use for SAH
         int m_num_bins;
+        // Maximum number of primitives in a leaf
+        int m_max_leaf_size;
+        // SAH cost of intersecting one leaf primitive, 0 disables SAH termination
+        float m_leaf_cost;
+        // Thread pool used during Build(), if any
+        GLSLPT::ThreadPool* m_pool;
+        // Set once a node spawned a task and the node order is no longer the serial one
+        std::atomic<bool> m_parallel_build;
+        // Binning with ScalarSahBins instead of SahBins
+        bool m_scalar_bins;
 
 
     private:
@@ -146,6 +221,7 @@ namespace RadeonRays
         Bvh& operator = (Bvh const&) = delete;
 
 		friend class BvhTranslator;
+        template <int N> friend class WideBvhTranslator;
     };
 
     struct Bvh::Node
@@ -26,64 +26,183 @@ THE SOFTWARE.
 
 #include "bvh_translator.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <stack>
 #include <iostream>
 
 namespace RadeonRays
 {
-	int BvhTranslator::ProcessBLASNodes(const Bvh::Node *node)
+	static_assert(sizeof(BvhTranslator::Node) == 32, "BVH nodes are uploaded as two RGBA32I texels");
+	static_assert(sizeof(BvhTranslator::CompressedNode) == 32, "Compressed BVH nodes are uploaded as two RGBA32I texels");
+
+	// Biased float exponent of the smallest power of two step for which 255 steps from lo reach hi
+	static unsigned int QuantizationExponent(float lo, float hi)
+	{
+		int exponent = -126;
+		if (hi - lo > 0.0f)
+		{
+			frexpf((hi - lo) / 255.0f, &exponent);
+			exponent = std::max(exponent, -126);
+		}
+
+		// Decoding rounds lo + 255 * step, so check the end actually reaches hi
+		while (exponent < 127 && lo + 255.0f * ldexpf(1.0f, exponent) < hi)
+			exponent++;
+
+		return exponent + 127;
+	}
+
+	// Quantize a box bound outwards. Decoding computes lo + q * step in float, so the result is
+	// checked with the same arithmetic
+	static unsigned int QuantizeMin(float lo, float step, float value)
+	{
+		int q = (int)std::min(std::max(0.0f, floorf((value - lo) / step)), 255.0f);
+		while (q > 0 && lo + q * step > value)
+			q--;
+		return q;
+	}
+
+	static unsigned int QuantizeMax(float lo, float step, float value)
+	{
+		int q = (int)std::min(std::max(0.0f, ceilf((value - lo) / step)), 255.0f);
+		while (q < 255 && lo + q * step < value)
+			q++;
+		return q;
+	}
+
+	// Writes a node and records it in dirtyRanges if it changed. Nodes are compared bitwise, they have no padding
+	template <class T>
+	void BvhTranslator::StoreNode(std::vector<T, AlignedAllocator<T>> &dst, int index, const T &node)
+	{
+		if (memcmp(&dst[index], &node, sizeof(T)) == 0)
+			return;
+
+		dst[index] = node;
+		if (!dirtyRanges.empty() && dirtyRanges.back().second == index)
+			dirtyRanges.back().second++;
+		else
+			dirtyRanges.push_back(std::make_pair(index, index + 1));
+	}
+
+	void BvhTranslator::CompressNodes(int index)
+	{
+		const Node &node = nodes[index];
+		CompressedNode cnode;
+
+		if (node.count != 0)
+		{
+			cnode.header[0] = node.offset;
+			cnode.header[1] = node.count;
+			cnode.header[2] = node.count < 0 ? nodes[index + 1].offset : 0;
+			cnode.header[3] = -1;
+			memset(cnode.childBounds, 0, sizeof(cnode.childBounds));
+			StoreNode(compressedNodes, index, cnode);
+			return;
+		}
+
+		const Node &left = nodes[index + 1];
+		const Node &right = nodes[node.offset];
+
+		// Quantize relative to the union of the children instead of the node box so they always fit
+		Vec3 lo = Vec3::Min(left.bboxmin, right.bboxmin);
+		Vec3 hi = Vec3::Max(left.bboxmax, right.bboxmax);
+
+		unsigned int bounds[4] = { 0, 0, 0, 0 };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			unsigned int exponent = QuantizationExponent(lo[axis], hi[axis]);
+			float step = ldexpf(1.0f, (int)exponent - 127);
+			int shift = axis * 8;
+
+			bounds[0] |= QuantizeMin(lo[axis], step, left.bboxmin[axis]) << shift;
+			bounds[1] |= QuantizeMax(lo[axis], step, left.bboxmax[axis]) << shift;
+			bounds[2] |= QuantizeMin(lo[axis], step, right.bboxmin[axis]) << shift;
+			bounds[3] |= QuantizeMax(lo[axis], step, right.bboxmax[axis]) << shift;
+			bounds[axis] |= exponent << 24;
+		}
+
+		memcpy(cnode.header, &lo, sizeof(lo));
+		cnode.header[3] = node.offset;
+		memcpy(cnode.childBounds, bounds, sizeof(bounds));
+		StoreNode(compressedNodes, index, cnode);
+
+		CompressNodes(index + 1);
+		CompressNodes(node.offset);
+	}
+
+	void BvhTranslator::LinkNodes(int index, int missLink)
 	{
-		RadeonRays::bbox bbox = node->bounds;
+		const Node &node = nodes[index];
+		missLinks[index] = missLink;
+
+		// Leaves of the TLAS stop here as well, BLAS nodes are linked once per mesh
+		if (node.count != 0)
+			return;
 
-		nodes[curNode].bboxmin = bbox.pmin;
-		nodes[curNode].bboxmax = bbox.pmax;
-		nodes[curNode].LRLeaf.z = 0;
+		LinkNodes(index + 1, node.offset);
+		LinkNodes(node.offset, missLink);
+	}
+
+	int BvhTranslator::ProcessBLASNodes(const Bvh::Node *node)
+	{
+		Node flat;
+		flat.bboxmin = node->bounds.pmin;
+		flat.bboxmax = node->bounds.pmax;
 
 		int index = curNode;
 
 		if (node->type == RadeonRays::Bvh::NodeType::kLeaf)
 		{
-			nodes[curNode].LRLeaf.x = curTriIndex + node->startidx;
-			nodes[curNode].LRLeaf.y = node->numprims;
-			nodes[curNode].LRLeaf.z = 1;
+			flat.offset = curTriIndex + node->startidx;
+			flat.count = node->numprims;
 		}
 		else
 		{
 			curNode++;
-			nodes[index].LRLeaf.x = ProcessBLASNodes(node->lc);
+			ProcessBLASNodes(node->lc);
 			curNode++;
-			nodes[index].LRLeaf.y = ProcessBLASNodes(node->rc);
+			flat.offset = ProcessBLASNodes(node->rc);
+			flat.count = 0;
 		}
+		StoreNode(nodes, index, flat);
 		return index;
 	}
 
 	int BvhTranslator::ProcessTLASNodes(const Bvh::Node *node)
 	{
-		RadeonRays::bbox bbox = node->bounds;
-
-		nodes[curNode].bboxmin = bbox.pmin;
-		nodes[curNode].bboxmax = bbox.pmax;
-		nodes[curNode].LRLeaf.z = 0;
+		Node flat;
+		flat.bboxmin = node->bounds.pmin;
+		flat.bboxmax = node->bounds.pmax;
 
 		int index = curNode;
 
 		if (node->type == RadeonRays::Bvh::NodeType::kLeaf)
 		{
 			int instanceIndex = TLBvh->m_packed_indices[node->startidx];
-			int meshIndex = meshInstances[instanceIndex].meshID;
-			int materialID = meshInstances[instanceIndex].materialID;
+			int meshIndex = (*meshInstances)[instanceIndex].meshID;
+			int materialID = (*meshInstances)[instanceIndex].materialID;
 
-			nodes[curNode].LRLeaf.x = bvhRootStartIndices[meshIndex];
-			nodes[curNode].LRLeaf.y = materialID;
-			nodes[curNode].LRLeaf.z = -instanceIndex - 1;
+			flat.offset = bvhRootStartIndices[meshIndex];
+			flat.count = -instanceIndex - 1;
+			StoreNode(nodes, index, flat);
+
+			// Payload node with the material
+			curNode++;
+			Node payload = Node();
+			payload.offset = materialID;
+			StoreNode(nodes, curNode, payload);
 		}
 		else
 		{
 			curNode++;
-			nodes[index].LRLeaf.x = ProcessTLASNodes(node->lc);
+			ProcessTLASNodes(node->lc);
 			curNode++;
-			nodes[index].LRLeaf.y = ProcessTLASNodes(node->rc);
+			flat.offset = ProcessTLASNodes(node->rc);
+			flat.count = 0;
+			StoreNode(nodes, index, flat);
 		}
 		return index;
 	}
@@ -92,27 +211,35 @@ namespace RadeonRays
 	{
 		int nodeCnt = 0;
 
-		for (int i = 0; i < meshes.size(); i++)
+		for (int i = 0; i < (int)meshes.size(); i++)
 			nodeCnt += meshes[i]->bvh->m_nodecnt;
 		topLevelIndex = nodeCnt;
 
-		// reserve space for top level nodes
-		nodeCnt += 2 * meshInstances.size();
+		// reserve space for top level nodes and the payload of their leaves
+		nodeCnt += 3 * meshInstances->size();
 		nodes.resize(nodeCnt);
+		compressedNodes.resize(compress ? nodeCnt : 0);
+		missLinks.assign(stackless ? nodeCnt : 0, -1);
 
 		int bvhRootIndex = 0;
 		curTriIndex = 0;
 
-		for (int i = 0; i < meshes.size(); i++)
+		for (int i = 0; i < (int)meshes.size(); i++)
 		{
 			GLSLPT::Mesh *mesh = meshes[i];
 			curNode = bvhRootIndex;
 
 			bvhRootStartIndices.push_back(bvhRootIndex);
+			bvhTriStartIndices.push_back(curTriIndex);
 			bvhRootIndex += mesh->bvh->m_nodecnt;
 			
 			ProcessBLASNodes(mesh->bvh->m_root);
 			curTriIndex += mesh->bvh->GetNumIndices();
+
+			if (compress)
+				CompressNodes(bvhRootStartIndices.back());
+			if (stackless)
+				LinkNodes(bvhRootStartIndices.back(), -1);
 		}
 	}
 
@@ -120,22 +247,87 @@ namespace RadeonRays
 	{
 		curNode = topLevelIndex;
 		ProcessTLASNodes(TLBvh->m_root);
+
+		if (compress)
+			CompressNodes(topLevelIndex);
+		if (stackless)
+			LinkNodes(topLevelIndex, -1);
+	}
+
+	void BvhTranslator::UpdateBLAS(int meshIndex)
+	{
+		curNode = bvhRootStartIndices[meshIndex];
+		curTriIndex = bvhTriStartIndices[meshIndex];
+		ProcessBLASNodes(meshes[meshIndex]->bvh->m_root);
+
+		if (compress)
+			CompressNodes(bvhRootStartIndices[meshIndex]);
+
+		MergeDirtyRanges();
 	}
 
 	void BvhTranslator::UpdateTLAS(const Bvh *topLevelBvh, const std::vector<GLSLPT::MeshInstance> &sceneInstances)
 	{
 		TLBvh = topLevelBvh;
-		meshInstances = sceneInstances;
+		meshInstances = &sceneInstances;
+
+		// Added or removed instances change the size of the TLAS, the BLAS nodes in front of it stay
+		size_t nodeCnt = topLevelIndex + 3 * meshInstances->size();
+		if (nodes.size() != nodeCnt)
+		{
+			nodes.resize(nodeCnt);
+			compressedNodes.resize(compress ? nodeCnt : 0);
+			missLinks.resize(stackless ? nodeCnt : 0, -1);
+		}
+
 		curNode = topLevelIndex;
 		ProcessTLASNodes(TLBvh->m_root);
+
+		if (compress)
+			CompressNodes(topLevelIndex);
+		if (stackless)
+			LinkNodes(topLevelIndex, -1);
+
+		MergeDirtyRanges();
+	}
+
+	void BvhTranslator::MergeDirtyRanges()
+	{
+		// Internal nodes are written after their subtree, sort the runs so neighbours merge
+		std::sort(dirtyRanges.begin(), dirtyRanges.end());
+		size_t merged = 0;
+		for (size_t i = 1; i < dirtyRanges.size(); i++)
+		{
+			if (dirtyRanges[i].first <= dirtyRanges[merged].second)
+				dirtyRanges[merged].second = std::max(dirtyRanges[merged].second, dirtyRanges[i].second);
+			else
+				dirtyRanges[++merged] = dirtyRanges[i];
+		}
+		if (!dirtyRanges.empty())
+			dirtyRanges.resize(merged + 1);
 	}
 
 	void BvhTranslator::Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &sceneMeshes,const std::vector<GLSLPT::MeshInstance> &sceneInstances)
 	{
 		TLBvh = topLevelBvh;
 		meshes = sceneMeshes;
-		meshInstances = sceneInstances;
+		meshInstances = &sceneInstances;
 		ProcessBLAS();
 		ProcessTLAS();
+
+		// Everything is new, the whole array gets uploaded
+		dirtyRanges.clear();
+		dirtyRanges.shrink_to_fit();
+	}
+
+	void BvhTranslator::Restore(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &sceneMeshes, const std::vector<GLSLPT::MeshInstance> &sceneInstances,
+		const std::vector<int> &blasRootIndices, const std::vector<int> &blasTriIndices)
+	{
+		TLBvh = topLevelBvh;
+		meshes = sceneMeshes;
+		meshInstances = &sceneInstances;
+		bvhRootStartIndices = blasRootIndices;
+		bvhTriStartIndices = blasTriIndices;
+		dirtyRanges.clear();
 	}
 }
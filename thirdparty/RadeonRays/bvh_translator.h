@@ -29,8 +29,11 @@ THE SOFTWARE.
 #ifndef BVH_TRANSLATOR_H
 #define BVH_TRANSLATOR_H
 
+#include <cstring>
 #include <map>
+#include <utility>
 
+#include "aligned_allocator.h"
 #include "bvh.h"
 #include "Mesh.h"
 
@@ -45,28 +48,102 @@ namespace RadeonRays
         // Constructor
         BvhTranslator() = default;
 
+		// 32 byte node, read by the shaders as two RGBA32I texels holding the bounds in xyz and an index in w.
+		// The left child of an internal node always directly follows it. Nodes are stored in depth first order
+		// and, on the CPU, aligned so every node sits in one cache line and shares it with its neighbour.
+		//   Internal node: offset = right child, count = 0
+		//   BLAS leaf:     offset = first triangle, count = number of triangles
+		//   TLAS leaf:     offset = BLAS root, count = -instance - 1. The next node only carries the
+		//                  instance material ID in its offset
 		struct Node
 		{
 			Vec3 bboxmin;
+			int offset;
 			Vec3 bboxmax;
-			Vec3 LRLeaf;
+			int count;
+		};
+
+		// Optional compressed layout with the same node indices as above. Internal nodes hold the boxes of
+		// both children as 8 bit offsets from their own box minimum, in power of two steps per axis, rounded
+		// outwards. A traversal step reads one node instead of both children.
+		//   Internal node: header = box minimum xyz as float bits, right child
+		//                  childBounds = left min, left max, right min, right max. Each holds the quantized
+		//                  xyz in its low three bytes and the biased step exponent of axis x, y, z, - in the top byte
+		//   Leaf node:     header = offset, count, material ID (TLAS leaves), -1
+		struct CompressedNode
+		{
+			int header[4];
+			unsigned int childBounds[4];
+
+			// Child boxes of an internal node, decoded the same way as in the shaders
+			void DecodeChildBounds(Vec3 &lmin, Vec3 &lmax, Vec3 &rmin, Vec3 &rmax) const
+			{
+				Vec3 origin, step;
+				memcpy(&origin, header, sizeof(origin));
+				for (int axis = 0; axis < 3; axis++)
+				{
+					unsigned int bits = (childBounds[axis] >> 24) << 23;
+					memcpy(&step[axis], &bits, sizeof(float));
+				}
+
+				lmin = origin + Dequantize(childBounds[0]) * step;
+				lmax = origin + Dequantize(childBounds[1]) * step;
+				rmin = origin + Dequantize(childBounds[2]) * step;
+				rmax = origin + Dequantize(childBounds[3]) * step;
+			}
+
+			static Vec3 Dequantize(unsigned int q)
+			{
+				return Vec3(float(q & 0xFF), float((q >> 8) & 0xFF), float((q >> 16) & 0xFF));
+			}
 		};
 
 		void ProcessBLAS();
 		void ProcessTLAS();
+		// Rewrites the nodes of one BLAS after its Bvh was refitted. The topology, and so the node range and
+		// miss links, stay the same
+		void UpdateBLAS(int meshIndex);
+		// Rewrites the TLAS nodes after the top level BVH was rebuilt or refitted. The instances are referenced,
+		// not copied, and must outlive the translator. The node arrays are resized when the number of instances
+		// changed, so the owner has to upload them as a whole instead of the dirty ranges
 		void UpdateTLAS(const Bvh *topLevelBvh, const std::vector<GLSLPT::MeshInstance> &instances);
 		void Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &meshes, const std::vector<GLSLPT::MeshInstance> &instances);
+		// Takes over nodes that Process() produced for the same scene earlier, e.g. read back from a file, so
+		// UpdateBLAS() and UpdateTLAS() work without processing the scene again. Set nodes, compressedNodes,
+		// missLinks, their flags and topLevelIndex first
+		void Restore(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &meshes, const std::vector<GLSLPT::MeshInstance> &instances,
+			const std::vector<int> &blasRootIndices, const std::vector<int> &blasTriIndices);
+		// First node and first triangle index of each mesh BLAS
+		const std::vector<int> &GetBLASRootIndices() const { return bvhRootStartIndices; }
+		const std::vector<int> &GetBLASTriIndices() const { return bvhTriStartIndices; }
 		int topLevelIndex = 0;
-		std::vector<Node> nodes;
+		std::vector<Node, AlignedAllocator<Node>> nodes;
+		bool compress = false; // Also fill compressedNodes
+		std::vector<CompressedNode, AlignedAllocator<CompressedNode>> compressedNodes;
+		// Optional skip links for stackless traversal, one per node. A node whose box is hit continues with its
+		// left child at index + 1, a missed node or a finished leaf continues with its miss link: the next node
+		// after its subtree in depth first order. Links end at -1 after the last node of a BLAS and of the TLAS,
+		// so a traversal only remembers the miss link of the TLAS leaf it entered a BLAS from
+		bool stackless = false; // Also fill missLinks
+		std::vector<int> missLinks;
 		int nodeTexWidth;
+		// Sorted runs of nodes [first, second) in nodes and compressedNodes changed by UpdateBLAS() and
+		// UpdateTLAS() since the owner last cleared it. A TLAS refit after moving one instance only changes
+		// the path from its leaf to the root
+		std::vector<std::pair<int, int>> dirtyRanges;
 
     private:
 		int curNode = 0;
 		int curTriIndex = 0;
 		std::vector<int> bvhRootStartIndices;
+		std::vector<int> bvhTriStartIndices;
 		int ProcessBLASNodes(const Bvh::Node *root);
 		int ProcessTLASNodes(const Bvh::Node *root);
-		std::vector<GLSLPT::MeshInstance> meshInstances;
+		void CompressNodes(int index);
+		void LinkNodes(int index, int missLink);
+		void MergeDirtyRanges();
+		template <class T> void StoreNode(std::vector<T, AlignedAllocator<T>> &dst, int index, const T &node);
+		const std::vector<GLSLPT::MeshInstance> *meshInstances = nullptr;
 		std::vector<GLSLPT::Mesh *> meshes;
 		const Bvh *TLBvh;
     };
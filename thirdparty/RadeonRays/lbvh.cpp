@@ -0,0 +1,373 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lbvh.h"
+#include "parallel_build.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+namespace RadeonRays
+{
+    // Bits per axis of the Morton codes, 3 * 10 bits fit an unsigned int
+    static int constexpr kMortonBits = 10;
+    // HLBVH clusters share the top bits of their codes, 4 per axis
+    static int constexpr kClusterBits = 12;
+    // Bins of the SAH split between clusters
+    static int constexpr kClusterBins = 16;
+
+    struct LinearBvh::Cluster
+    {
+        bbox bounds;
+        Vec3 centroid;
+        // Range of sorted primitives
+        int first;
+        int last;
+    };
+
+    static int NumChunks(GLSLPT::ThreadPool* pool, int count)
+    {
+        return pool ? GetNumChunks(pool, count) : 1;
+    }
+
+    // Inserts two zero bits above each of the low 10 bits of v
+    static unsigned int ExpandBits(unsigned int v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // Morton code of a point in the unit cube
+    static unsigned int MortonCode(Vec3 const& p)
+    {
+        float const scale = float(1 << kMortonBits);
+        unsigned int x = (unsigned int)std::min(std::max(p.x * scale, 0.f), scale - 1.f);
+        unsigned int y = (unsigned int)std::min(std::max(p.y * scale, 0.f), scale - 1.f);
+        unsigned int z = (unsigned int)std::min(std::max(p.z * scale, 0.f), scale - 1.f);
+        return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+    }
+
+    // Stable LSD radix sort of keys by their bits [firstbit, lastbit), 8 bits per pass. Each chunk counts
+    // its digits, then scatters them behind the same digits of the chunks before it
+    static void RadixSort(GLSLPT::ThreadPool* pool, std::vector<uint64_t>& keys, int firstbit, int lastbit)
+    {
+        int count = (int)keys.size();
+        int numChunks = NumChunks(pool, count);
+        std::vector<uint64_t> sorted(count);
+        std::vector<int> offsets(numChunks * 256);
+
+        for (int shift = firstbit; shift < lastbit; shift += 8)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            ParallelChunks(pool, 0, count, numChunks, [&](int chunk, int first, int last)
+            {
+                int* histogram = &offsets[chunk * 256];
+                for (int i = first; i < last; ++i)
+                    ++histogram[(keys[i] >> shift) & 0xFF];
+            });
+
+            int sum = 0;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                for (int chunk = 0; chunk < numChunks; ++chunk)
+                {
+                    int num = offsets[chunk * 256 + digit];
+                    offsets[chunk * 256 + digit] = sum;
+                    sum += num;
+                }
+            }
+
+            ParallelChunks(pool, 0, count, numChunks, [&](int chunk, int first, int last)
+            {
+                int* offset = &offsets[chunk * 256];
+                for (int i = first; i < last; ++i)
+                    sorted[offset[(keys[i] >> shift) & 0xFF]++] = keys[i];
+            });
+
+            keys.swap(sorted);
+        }
+    }
+
+    void LinearBvh::BuildImpl(bbox const* bounds, int numbounds)
+    {
+        InitNodeAllocator(2 * numbounds - 1);
+        m_indices.resize(numbounds);
+        m_packed_indices.resize(numbounds);
+
+        int numChunks = NumChunks(m_pool, numbounds);
+        std::vector<bbox> chunkbounds(numChunks);
+        ParallelChunks(m_pool, 0, numbounds, numChunks, [&](int chunk, int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+                chunkbounds[chunk].grow(bounds[i].center());
+        });
+
+        bbox centroid_bounds;
+        for (auto const& b : chunkbounds)
+            centroid_bounds.grow(b);
+
+        Vec3 origin = centroid_bounds.pmin;
+        Vec3 extents = centroid_bounds.extents();
+        Vec3 scale(extents.x > 0.f ? 1.f / extents.x : 0.f,
+                   extents.y > 0.f ? 1.f / extents.y : 0.f,
+                   extents.z > 0.f ? 1.f / extents.z : 0.f);
+
+        // Morton code in the high half of a key and the primitive in the low half, so the stable sort keeps
+        // primitives with equal codes in their original order
+        std::vector<uint64_t> keys(numbounds);
+        ParallelChunks(m_pool, 0, numbounds, numChunks, [&](int, int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+                keys[i] = ((uint64_t)MortonCode((bounds[i].center() - origin) * scale) << 32) | (uint32_t)i;
+        });
+
+        RadixSort(m_pool, keys, 32, 32 + 3 * kMortonBits);
+
+        m_codes.resize(numbounds);
+        ParallelChunks(m_pool, 0, numbounds, numChunks, [&](int, int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+            {
+                m_codes[i] = (unsigned int)(keys[i] >> 32);
+                m_indices[i] = m_packed_indices[i] = (int)(keys[i] & 0xFFFFFFFF);
+            }
+        });
+
+        if (m_hlbvh)
+        {
+            // Clusters are the runs of codes sharing their top bits, in Morton order
+            int shift = 3 * kMortonBits - kClusterBits;
+            std::vector<Cluster> clusters;
+            for (int i = 0; i < numbounds; ++i)
+            {
+                if (i == 0 || (m_codes[i] >> shift) != (m_codes[i - 1] >> shift))
+                {
+                    if (!clusters.empty())
+                        clusters.back().last = i;
+                    clusters.push_back(Cluster{ bbox(), Vec3(), i, numbounds });
+                }
+            }
+
+            ParallelChunks(m_pool, 0, (int)clusters.size(), NumChunks(m_pool, (int)clusters.size()), [&](int, int first, int last)
+            {
+                for (int c = first; c < last; ++c)
+                {
+                    for (int i = clusters[c].first; i < clusters[c].last; ++i)
+                        clusters[c].bounds.grow(bounds[m_packed_indices[i]]);
+                    clusters[c].centroid = clusters[c].bounds.center();
+                }
+            });
+
+            BuildClusters(bounds, &clusters[0], 0, (int)clusters.size(), 0, 1);
+        }
+        else
+        {
+            BuildLinear(bounds, 0, numbounds, 0, 1);
+        }
+
+        std::vector<unsigned int>().swap(m_codes);
+
+        // Nodes are allocated parent first, so this is the root
+        m_root = &m_nodes[0];
+
+        if (m_parallel_build)
+        {
+            RelayoutNodes(false);
+        }
+    }
+
+    Bvh::Node* LinearBvh::BuildLinear(bbox const* bounds, int first, int last, int level, int index)
+    {
+        UpdateHeight(level);
+
+        Node* node = AllocateNode();
+        node->index = index;
+
+        int numprims = last - first;
+        if (numprims <= m_max_leaf_size)
+        {
+            node->type = kLeaf;
+            node->startidx = first;
+            node->numprims = numprims;
+
+            bbox leafbounds;
+            for (int i = first; i < last; ++i)
+                leafbounds.grow(bounds[m_packed_indices[i]]);
+            node->bounds = leafbounds;
+            return node;
+        }
+
+        // The codes of a node share all bits above the highest one in which its first and last code differ.
+        // Sorted, they are 0 in that bit up to the split and 1 after it. Equal codes are split in the middle
+        int split = first + numprims / 2;
+        unsigned int diff = m_codes[first] ^ m_codes[last - 1];
+        if (diff != 0)
+        {
+            unsigned int bit = 1u << 31;
+            while ((diff & bit) == 0)
+                bit >>= 1;
+
+            split = (int)(std::partition_point(m_codes.begin() + first, m_codes.begin() + last,
+                [bit](unsigned int code) { return (code & bit) == 0; }) - m_codes.begin());
+        }
+
+        node->type = kInternal;
+
+        if (m_pool && numprims >= kParallelTaskThreshold)
+        {
+            m_parallel_build = true;
+
+            GLSLPT::TaskGroup group(m_pool);
+            group.Run([&] { node->lc = BuildLinear(bounds, first, split, level + 1, index << 1); });
+            node->rc = BuildLinear(bounds, split, last, level + 1, (index << 1) + 1);
+            group.Wait();
+        }
+        else
+        {
+            node->lc = BuildLinear(bounds, first, split, level + 1, index << 1);
+            node->rc = BuildLinear(bounds, split, last, level + 1, (index << 1) + 1);
+        }
+
+        bbox nodebounds;
+        nodebounds.grow(node->lc->bounds);
+        nodebounds.grow(node->rc->bounds);
+        node->bounds = nodebounds;
+        return node;
+    }
+
+    Bvh::Node* LinearBvh::BuildClusters(bbox const* bounds, Cluster* clusters, int begin, int end, int level, int index)
+    {
+        if (end - begin == 1)
+            return BuildLinear(bounds, clusters[begin].first, clusters[begin].last, level, index);
+
+        UpdateHeight(level);
+
+        Node* node = AllocateNode();
+        node->index = index;
+        node->type = kInternal;
+
+        // Bin the clusters by centroid along the widest axis and take the split with the lowest SAH,
+        // each cluster weighted by its number of primitives
+        bbox centroid_bounds;
+        int numprims = 0;
+        for (int c = begin; c < end; ++c)
+        {
+            centroid_bounds.grow(clusters[c].centroid);
+            numprims += clusters[c].last - clusters[c].first;
+        }
+
+        int axis = centroid_bounds.maxdim();
+        float lo = centroid_bounds.pmin[axis];
+        float extent = centroid_bounds.extents()[axis];
+        int mid = (begin + end) / 2;
+
+        if (extent > 0.f)
+        {
+            auto binof = [=](Cluster const& cluster)
+            {
+                return std::min((int)(kClusterBins * (cluster.centroid[axis] - lo) / extent), kClusterBins - 1);
+            };
+
+            bbox binbounds[kClusterBins];
+            int bincount[kClusterBins] = {};
+            for (int c = begin; c < end; ++c)
+            {
+                int bin = binof(clusters[c]);
+                binbounds[bin].grow(clusters[c].bounds);
+                bincount[bin] += clusters[c].last - clusters[c].first;
+            }
+
+            // Cost of everything right of each bin boundary, then sweep from the left
+            float rightcost[kClusterBins] = {};
+            bbox rightbounds;
+            int rightcount = 0;
+            for (int bin = kClusterBins - 1; bin > 0; --bin)
+            {
+                rightbounds.grow(binbounds[bin]);
+                rightcount += bincount[bin];
+                rightcost[bin] = rightcount > 0 ? rightcount * rightbounds.surface_area() : 0.f;
+            }
+
+            int bestbin = -1;
+            float bestcost = std::numeric_limits<float>::max();
+            bbox leftbounds;
+            int leftcount = 0;
+            for (int bin = 1; bin < kClusterBins; ++bin)
+            {
+                leftbounds.grow(binbounds[bin - 1]);
+                leftcount += bincount[bin - 1];
+                if (leftcount == 0 || leftcount == numprims)
+                    continue;
+
+                float cost = leftcount * leftbounds.surface_area() + rightcost[bin];
+                if (cost < bestcost)
+                {
+                    bestcost = cost;
+                    bestbin = bin;
+                }
+            }
+
+            if (bestbin != -1)
+            {
+                mid = (int)(std::partition(clusters + begin, clusters + end,
+                    [&](Cluster const& cluster) { return binof(cluster) < bestbin; }) - clusters);
+            }
+        }
+
+        if (m_pool && numprims >= kParallelTaskThreshold)
+        {
+            m_parallel_build = true;
+
+            GLSLPT::TaskGroup group(m_pool);
+            group.Run([&] { node->lc = BuildClusters(bounds, clusters, begin, mid, level + 1, index << 1); });
+            node->rc = BuildClusters(bounds, clusters, mid, end, level + 1, (index << 1) + 1);
+            group.Wait();
+        }
+        else
+        {
+            node->lc = BuildClusters(bounds, clusters, begin, mid, level + 1, index << 1);
+            node->rc = BuildClusters(bounds, clusters, mid, end, level + 1, (index << 1) + 1);
+        }
+
+        bbox nodebounds;
+        nodebounds.grow(node->lc->bounds);
+        nodebounds.grow(node->rc->bounds);
+        node->bounds = nodebounds;
+        return node;
+    }
+
+    void LinearBvh::PrintStatistics(std::ostream& os) const
+    {
+        os << "Class name: " << (m_hlbvh ? "HLBVH\n" : "LBVH\n");
+        os << "Max leaf size: " << m_max_leaf_size << "\n";
+        os << "Number of triangles: " << m_indices.size() << "\n";
+        os << "Number of nodes: " << m_nodecnt << "\n";
+        os << "Tree height: " << GetHeight() << "\n";
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef LBVH_H
+#define LBVH_H
+
+#include <vector>
+
+#include "bvh.h"
+
+namespace RadeonRays
+{
+    /// Linear BVH builder. Primitives are sorted along a 30 bit Morton curve of their centroids with a
+    /// parallel radix sort and the tree is read off the sorted codes, splitting every node at the highest
+    /// bit in which its codes differ. Builds an order of magnitude faster than Bvh and SplitBvh at the price
+    /// of worse trees, meant for geometry that changes often and for quick previews.
+    /// The HLBVH variant clusters primitives by the top bits of their codes, builds a linear BVH per cluster
+    /// and joins the clusters with a binned SAH build, which recovers most of the traversal cost.
+    //
+    class LinearBvh : public Bvh
+    {
+    public:
+        LinearBvh(float traversal_cost, bool hlbvh)
+        : Bvh(traversal_cost, 64, false)
+        , m_hlbvh(hlbvh)
+        {
+            m_max_leaf_size = kMeshMaxLeafSize;
+        }
+
+        ~LinearBvh() = default;
+
+    protected:
+        void BuildImpl(bbox const* bounds, int numbounds) override;
+
+        // Print BVH statistics
+        void PrintStatistics(std::ostream& os) const override;
+
+    private:
+        struct Cluster;
+
+        // Subtree over the sorted primitives [first, last)
+        Node* BuildLinear(bbox const* bounds, int first, int last, int level, int index);
+        // SAH tree over clusters [begin, end), each cluster ends in a BuildLinear() subtree
+        Node* BuildClusters(bbox const* bounds, Cluster* clusters, int begin, int end, int level, int index);
+
+        bool m_hlbvh;
+        // Sorted Morton codes during Build()
+        std::vector<unsigned int> m_codes;
+
+        LinearBvh(LinearBvh const&) = delete;
+        LinearBvh& operator = (LinearBvh const&) = delete;
+    };
+}
+
+#endif // LBVH_H
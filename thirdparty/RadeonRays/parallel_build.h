@@ -0,0 +1,175 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef PARALLEL_BUILD_H
+#define PARALLEL_BUILD_H
+
+#include <algorithm>
+#include <vector>
+
+#include "bbox.h"
+#include "ThreadPool.h"
+
+namespace RadeonRays
+{
+    // Nodes with at least this many primitives build their children as separate tasks
+    static int constexpr kParallelTaskThreshold = 4096;
+    // Nodes with at least this many primitives bin and partition on all pool threads
+    static int constexpr kParallelSweepThreshold = 1 << 17;
+
+    // Number of chunks a sweep over count elements is split into
+    inline int GetNumChunks(GLSLPT::ThreadPool* pool, int count)
+    {
+        int numChunks = pool->GetNumThreads() * 4;
+        return std::max(1, std::min(numChunks, count / 4096));
+    }
+
+    // Runs func(chunk, begin, end) for numChunks contiguous ranges covering [begin, end)
+    template <typename Func>
+    void ParallelChunks(GLSLPT::ThreadPool* pool, int begin, int end, int numChunks, Func func)
+    {
+        int count = end - begin;
+
+        GLSLPT::ParallelFor(pool, 0, numChunks, 1, [=, &func](int chunk)
+        {
+            int chunkBegin = begin + (int)((long long)count * chunk / numChunks);
+            int chunkEnd = begin + (int)((long long)count * (chunk + 1) / numChunks);
+            func(chunk, chunkBegin, chunkEnd);
+        });
+    }
+
+    /// Parallel version of the two sided partition loop in Bvh::BuildNode and SplitBvh::BuildNode.
+    /// Produces the very same permutation: that loop swaps the k-th element that belongs to the right
+    /// scanning from the front with the k-th element that belongs to the left scanning from the back,
+    /// so the misplaced elements of both sides are located and paired up independently here.
+    /// The child bounds only depend on which side an element goes to. Returns the split index.
+    //
+    template <typename T, typename IsLeft, typename Bounds, typename Center>
+    int ParallelPartition(GLSLPT::ThreadPool* pool, T* items, int begin, int end, IsLeft isleft, Bounds getbounds, Center getcenter,
+        bbox& leftbounds, bbox& rightbounds, bbox& leftcentroid_bounds, bbox& rightcentroid_bounds)
+    {
+        struct ChunkInfo
+        {
+            bbox leftbounds, rightbounds, leftcentroid_bounds, rightcentroid_bounds;
+            int numleft;
+            int misplacedleft;
+            int misplacedright;
+        };
+
+        int numChunks = GetNumChunks(pool, end - begin);
+        std::vector<ChunkInfo> chunks(numChunks);
+
+        // Classify and gather the child bounds
+        ParallelChunks(pool, begin, end, numChunks, [&](int chunk, int first, int last)
+        {
+            ChunkInfo& info = chunks[chunk];
+            info.numleft = 0;
+            for (int i = first; i < last; ++i)
+            {
+                if (isleft(items[i]))
+                {
+                    info.leftbounds.grow(getbounds(items[i]));
+                    info.leftcentroid_bounds.grow(getcenter(items[i]));
+                    ++info.numleft;
+                }
+                else
+                {
+                    info.rightbounds.grow(getbounds(items[i]));
+                    info.rightcentroid_bounds.grow(getcenter(items[i]));
+                }
+            }
+        });
+
+        int splitidx = begin;
+        for (auto const& info : chunks)
+        {
+            leftbounds.grow(info.leftbounds);
+            rightbounds.grow(info.rightbounds);
+            leftcentroid_bounds.grow(info.leftcentroid_bounds);
+            rightcentroid_bounds.grow(info.rightcentroid_bounds);
+            splitidx += info.numleft;
+        }
+
+        // Count elements on the wrong side of splitidx
+        ParallelChunks(pool, begin, end, numChunks, [&](int chunk, int first, int last)
+        {
+            ChunkInfo& info = chunks[chunk];
+            info.misplacedleft = info.misplacedright = 0;
+            for (int i = first; i < last; ++i)
+            {
+                bool left = isleft(items[i]);
+                if (i < splitidx && !left)
+                    ++info.misplacedleft;
+                else if (i >= splitidx && left)
+                    ++info.misplacedright;
+            }
+        });
+
+        // Rank of the first misplaced element of each chunk, counting from the front on the left side
+        // and from the back on the right side
+        std::vector<int> leftrank(numChunks), rightrank(numChunks);
+        int numswaps = 0;
+        for (int chunk = 0; chunk < numChunks; ++chunk)
+        {
+            leftrank[chunk] = numswaps;
+            numswaps += chunks[chunk].misplacedleft;
+        }
+
+        int rank = 0;
+        for (int chunk = numChunks - 1; chunk >= 0; --chunk)
+        {
+            rightrank[chunk] = rank;
+            rank += chunks[chunk].misplacedright;
+        }
+
+        if (numswaps == 0)
+            return splitidx;
+
+        std::vector<int> leftpos(numswaps), rightpos(numswaps);
+        ParallelChunks(pool, begin, end, numChunks, [&](int chunk, int first, int last)
+        {
+            int l = leftrank[chunk];
+            for (int i = first; i < last; ++i)
+                if (i < splitidx && !isleft(items[i]))
+                    leftpos[l++] = i;
+
+            int r = rightrank[chunk];
+            for (int i = last - 1; i >= first; --i)
+                if (i >= splitidx && isleft(items[i]))
+                    rightpos[r++] = i;
+        });
+
+        ParallelChunks(pool, 0, numswaps, GetNumChunks(pool, numswaps), [&](int, int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+                std::swap(items[leftpos[i]], items[rightpos[i]]);
+        });
+
+        return splitidx;
+    }
+}
+
+#endif // PARALLEL_BUILD_H
@@ -0,0 +1,394 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef SAH_BINS_H
+#define SAH_BINS_H
+
+#include <limits>
+
+#include "bbox.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SAH_BINS_SSE
+#include <immintrin.h>
+#endif
+
+namespace RadeonRays
+{
+    // Upper limit for the number of bins per axis, larger requests are clamped
+    static int constexpr kMaxSahBins = 128;
+
+    // Centroid histogram of a node along all three axes. Storage has a fixed size so evaluating a node
+    // never touches the heap, each building thread keeps its histogram on its own stack.
+    // This is the portable version, SahBins picks the SSE one where it is available
+    class ScalarSahBins
+    {
+    public:
+        // Empties numbins bins per axis spanning the centroid bounds
+        void Init(int numbins, bbox const& centroid_bounds);
+        // Adds a primitive to its bin on every axis
+        void Add(bbox const& bounds, Vec3 const& center);
+        // Adds another histogram initialized with the same parameters
+        void Merge(ScalarSahBins const& other);
+
+        // Finds the border with the lowest SAH over all non degenerate axes, the split is between bin and bin + 1.
+        // Returns false if no candidate beats the maximum float value
+        bool FindBestSplit(float traversal_cost, float invarea, int numprims, int& axis, int& bin, float& sah) const;
+        // Union of the bins [first, last) along axis
+        bbox Bounds(int axis, int first, int last) const;
+
+    private:
+        bbox m_bounds[3][kMaxSahBins];
+        Vec3 m_origin;
+        Vec3 m_scale;
+        int m_count[3][kMaxSahBins];
+        bool m_degenerate[3];
+        int m_num_bins;
+    };
+
+    // Lowest cost of costs[axis][0, numbins - 1) over the non degenerate axes, the first minimum in axis order
+    inline bool FindLowestSahCost(float const costs[3][kMaxSahBins], bool const degenerate[3], int numbins, int& axis, int& bin, float& sah)
+    {
+        bool found = false;
+        sah = std::numeric_limits<float>::max();
+
+        for (int a = 0; a < 3; ++a)
+        {
+            if (degenerate[a]) continue;
+
+            for (int i = 0; i < numbins - 1; ++i)
+            {
+                if (costs[a][i] < sah)
+                {
+                    sah = costs[a][i];
+                    axis = a;
+                    bin = i;
+                    found = true;
+                }
+            }
+        }
+
+        return found;
+    }
+
+    inline void ScalarSahBins::Init(int numbins, bbox const& centroid_bounds)
+    {
+        m_num_bins = numbins;
+        Vec3 extents = centroid_bounds.extents();
+
+        // Degenerate axes get a zero scale and end up in the first bin, callers skip them anyway
+        m_origin = centroid_bounds.pmin;
+        m_scale = Vec3(extents.x > 0.f ? 1.f / extents.x : 0.f,
+                       extents.y > 0.f ? 1.f / extents.y : 0.f,
+                       extents.z > 0.f ? 1.f / extents.z : 0.f);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_degenerate[axis] = !(extents[axis] > 0.f);
+
+            for (int i = 0; i < numbins; ++i)
+            {
+                m_bounds[axis][i] = bbox();
+                m_count[axis][i] = 0;
+            }
+        }
+    }
+
+    inline void ScalarSahBins::Add(bbox const& bounds, Vec3 const& center)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int i = (int)std::min<float>(static_cast<float>(m_num_bins) * ((center[axis] - m_origin[axis]) * m_scale[axis]), static_cast<float>(m_num_bins - 1));
+            m_bounds[axis][i].grow(bounds);
+            ++m_count[axis][i];
+        }
+    }
+
+    inline void ScalarSahBins::Merge(ScalarSahBins const& other)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int i = 0; i < m_num_bins; ++i)
+            {
+                m_bounds[axis][i].grow(other.m_bounds[axis][i]);
+                m_count[axis][i] += other.m_count[axis][i];
+            }
+        }
+    }
+
+    inline bool ScalarSahBins::FindBestSplit(float traversal_cost, float invarea, int numprims, int& axis, int& bin, float& sah) const
+    {
+        // Cost of the split between i and i + 1 for every axis
+        float costs[3][kMaxSahBins];
+        bbox rightbounds[kMaxSahBins - 1];
+
+        for (int a = 0; a < 3; ++a)
+        {
+            if (m_degenerate[a]) continue;
+
+            // Start with 1-bin right box
+            bbox rightbox = bbox();
+            for (int i = m_num_bins - 1; i > 0; --i)
+            {
+                rightbox.grow(m_bounds[a][i]);
+                rightbounds[i - 1] = rightbox;
+            }
+
+            bbox leftbox = bbox();
+            int  leftcount = 0;
+            int  rightcount = numprims;
+
+            for (int i = 0; i < m_num_bins - 1; ++i)
+            {
+                leftbox.grow(m_bounds[a][i]);
+                leftcount += m_count[a][i];
+                rightcount -= m_count[a][i];
+
+                costs[a][i] = traversal_cost + (leftcount * leftbox.surface_area() + rightcount * rightbounds[i].surface_area()) * invarea;
+            }
+        }
+
+        return FindLowestSahCost(costs, m_degenerate, m_num_bins, axis, bin, sah);
+    }
+
+    inline bbox ScalarSahBins::Bounds(int axis, int first, int last) const
+    {
+        bbox result;
+
+        for (int i = first; i < last; ++i)
+        {
+            result.grow(m_bounds[axis][i]);
+        }
+
+        return result;
+    }
+
+#ifdef SAH_BINS_SSE
+    // SSE version of ScalarSahBins producing bit-identical splits. Bin indices of the three axes are computed
+    // at once and the SAH sweep evaluates one axis per lane
+    class SseSahBins
+    {
+    public:
+        void Init(int numbins, bbox const& centroid_bounds);
+        void Add(bbox const& bounds, Vec3 const& center);
+        void Merge(SseSahBins const& other);
+        bool FindBestSplit(float traversal_cost, float invarea, int numprims, int& axis, int& bin, float& sah) const;
+        bbox Bounds(int axis, int first, int last) const;
+
+    private:
+        __m128 m_pmin[3][kMaxSahBins];
+        __m128 m_pmax[3][kMaxSahBins];
+        __m128 m_origin;
+        __m128 m_scale;
+        __m128 m_lastbin;
+        int m_count[3][kMaxSahBins];
+        bool m_degenerate[3];
+        int m_num_bins;
+    };
+
+    inline void SseSahBins::Init(int numbins, bbox const& centroid_bounds)
+    {
+        m_num_bins = numbins;
+        Vec3 extents = centroid_bounds.extents();
+
+        // Degenerate axes get a zero scale and end up in the first bin, callers skip them anyway
+        Vec3 invextents(extents.x > 0.f ? 1.f / extents.x : 0.f,
+                        extents.y > 0.f ? 1.f / extents.y : 0.f,
+                        extents.z > 0.f ? 1.f / extents.z : 0.f);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_degenerate[axis] = !(extents[axis] > 0.f);
+        }
+
+        m_origin = _mm_setr_ps(centroid_bounds.pmin.x, centroid_bounds.pmin.y, centroid_bounds.pmin.z, 0.f);
+        m_scale = _mm_setr_ps(invextents.x, invextents.y, invextents.z, 0.f);
+        m_lastbin = _mm_set1_ps(static_cast<float>(numbins - 1));
+
+        __m128 empty_min = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 empty_max = _mm_set1_ps(-std::numeric_limits<float>::max());
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int i = 0; i < numbins; ++i)
+            {
+                m_pmin[axis][i] = empty_min;
+                m_pmax[axis][i] = empty_max;
+                m_count[axis][i] = 0;
+            }
+        }
+    }
+
+    inline void SseSahBins::Add(bbox const& bounds, Vec3 const& center)
+    {
+        // Bin index of all three axes at once, computed in the same order as the scalar path
+        __m128 c = _mm_setr_ps(center.x, center.y, center.z, 0.f);
+        __m128 numbins = _mm_set1_ps(static_cast<float>(m_num_bins));
+        __m128 binf = _mm_min_ps(_mm_mul_ps(numbins, _mm_mul_ps(_mm_sub_ps(c, m_origin), m_scale)), m_lastbin);
+
+        alignas(16) int binidx[4];
+        _mm_store_si128((__m128i*)binidx, _mm_cvttps_epi32(binf));
+
+        // pmin and pmax are six consecutive floats, the second load starts at pmin.z to stay inside the box
+        __m128 bmin = _mm_loadu_ps(&bounds.pmin.x);
+        __m128 bmax = _mm_loadu_ps(&bounds.pmin.z);
+        bmax = _mm_shuffle_ps(bmax, bmax, _MM_SHUFFLE(3, 3, 2, 1));
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int i = binidx[axis];
+            m_pmin[axis][i] = _mm_min_ps(m_pmin[axis][i], bmin);
+            m_pmax[axis][i] = _mm_max_ps(m_pmax[axis][i], bmax);
+            ++m_count[axis][i];
+        }
+    }
+
+    inline void SseSahBins::Merge(SseSahBins const& other)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int i = 0; i < m_num_bins; ++i)
+            {
+                m_pmin[axis][i] = _mm_min_ps(m_pmin[axis][i], other.m_pmin[axis][i]);
+                m_pmax[axis][i] = _mm_max_ps(m_pmax[axis][i], other.m_pmax[axis][i]);
+                m_count[axis][i] += other.m_count[axis][i];
+            }
+        }
+    }
+
+    inline bool SseSahBins::FindBestSplit(float traversal_cost, float invarea, int numprims, int& axis, int& bin, float& sah) const
+    {
+        // Cost of the split between i and i + 1 for every axis
+        float costs[3][kMaxSahBins];
+
+        // Sweep the three axes at once. Lanes hold the axes and there is one register per box coordinate,
+        // the arithmetic follows bbox::surface_area so the costs match the scalar path
+        auto surface_area = [](__m128 const* pmin, __m128 const* pmax)
+        {
+            __m128 ex = _mm_sub_ps(pmax[0], pmin[0]);
+            __m128 ey = _mm_sub_ps(pmax[1], pmin[1]);
+            __m128 ez = _mm_sub_ps(pmax[2], pmin[2]);
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ey), _mm_mul_ps(ex, ez)), _mm_mul_ps(ey, ez));
+            return _mm_mul_ps(_mm_set1_ps(2.f), sum);
+        };
+
+        // Transposes bin i of the three axes into x, y, z registers
+        auto load_bin = [this](int i, __m128* pmin, __m128* pmax)
+        {
+            __m128 zero = _mm_setzero_ps();
+            pmin[0] = m_pmin[0][i]; pmin[1] = m_pmin[1][i]; pmin[2] = m_pmin[2][i];
+            pmax[0] = m_pmax[0][i]; pmax[1] = m_pmax[1][i]; pmax[2] = m_pmax[2][i];
+            pmin[3] = pmax[3] = zero;
+            _MM_TRANSPOSE4_PS(pmin[0], pmin[1], pmin[2], pmin[3]);
+            _MM_TRANSPOSE4_PS(pmax[0], pmax[1], pmax[2], pmax[3]);
+        };
+
+        __m128 binmin[4], binmax[4];
+        __m128 boxmin[3], boxmax[3];
+        __m128 rightarea[kMaxSahBins];
+
+        // Start with 1-bin right box
+        for (int k = 0; k < 3; ++k)
+        {
+            boxmin[k] = _mm_set1_ps(std::numeric_limits<float>::max());
+            boxmax[k] = _mm_set1_ps(-std::numeric_limits<float>::max());
+        }
+
+        for (int i = m_num_bins - 1; i > 0; --i)
+        {
+            load_bin(i, binmin, binmax);
+            for (int k = 0; k < 3; ++k)
+            {
+                boxmin[k] = _mm_min_ps(boxmin[k], binmin[k]);
+                boxmax[k] = _mm_max_ps(boxmax[k], binmax[k]);
+            }
+            rightarea[i - 1] = surface_area(boxmin, boxmax);
+        }
+
+        for (int k = 0; k < 3; ++k)
+        {
+            boxmin[k] = _mm_set1_ps(std::numeric_limits<float>::max());
+            boxmax[k] = _mm_set1_ps(-std::numeric_limits<float>::max());
+        }
+
+        __m128i leftcount = _mm_setzero_si128();
+        __m128i totalcount = _mm_set1_epi32(numprims);
+        __m128 cost = _mm_set1_ps(traversal_cost);
+        __m128 invareav = _mm_set1_ps(invarea);
+
+        for (int i = 0; i < m_num_bins - 1; ++i)
+        {
+            load_bin(i, binmin, binmax);
+            for (int k = 0; k < 3; ++k)
+            {
+                boxmin[k] = _mm_min_ps(boxmin[k], binmin[k]);
+                boxmax[k] = _mm_max_ps(boxmax[k], binmax[k]);
+            }
+
+            leftcount = _mm_add_epi32(leftcount, _mm_setr_epi32(m_count[0][i], m_count[1][i], m_count[2][i], 0));
+            __m128 leftcountf = _mm_cvtepi32_ps(leftcount);
+            __m128 rightcountf = _mm_cvtepi32_ps(_mm_sub_epi32(totalcount, leftcount));
+
+            __m128 areas = _mm_add_ps(_mm_mul_ps(leftcountf, surface_area(boxmin, boxmax)), _mm_mul_ps(rightcountf, rightarea[i]));
+
+            alignas(16) float result[4];
+            _mm_store_ps(result, _mm_add_ps(cost, _mm_mul_ps(areas, invareav)));
+            costs[0][i] = result[0];
+            costs[1][i] = result[1];
+            costs[2][i] = result[2];
+        }
+
+        return FindLowestSahCost(costs, m_degenerate, m_num_bins, axis, bin, sah);
+    }
+
+    inline bbox SseSahBins::Bounds(int axis, int first, int last) const
+    {
+        bbox result;
+
+        for (int i = first; i < last; ++i)
+        {
+            alignas(16) float pmin[4];
+            alignas(16) float pmax[4];
+            _mm_store_ps(pmin, m_pmin[axis][i]);
+            _mm_store_ps(pmax, m_pmax[axis][i]);
+
+            // Set the corners directly, the two point constructor would turn an empty box inside out
+            bbox binbounds;
+            binbounds.pmin = Vec3(pmin[0], pmin[1], pmin[2]);
+            binbounds.pmax = Vec3(pmax[0], pmax[1], pmax[2]);
+            result.grow(binbounds);
+        }
+
+        return result;
+    }
+
+    typedef SseSahBins SahBins;
+#else
+    typedef ScalarSahBins SahBins;
+#endif
+}
+
+#endif // SAH_BINS_H
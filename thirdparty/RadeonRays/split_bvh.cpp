@@ -1,4 +1,6 @@
 #include "split_bvh.h"
+#include "parallel_build.h"
+#include "sah_bins.h"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
@@ -34,27 +36,57 @@ namespace RadeonRays
 
         // Start from the top
         BuildNode(init, primrefs);
+
+        if (m_parallel_build)
+        {
+            RelayoutNodes(true);
+            m_node_archive.clear();
+            m_num_nodes_archived = 0;
+        }
     }
 
-    void SplitBvh::BuildNode(SplitRequest& req, PrimRefArray& primrefs)
+    void SplitBvh::BuildNode(SplitRequest& req, PrimRefArray& primrefs, int packedbase, int rangeend)
     {
         // Update current height
-        m_height = std::max(m_height, req.level);
+        UpdateHeight(req.level);
 
         // Allocate new node
         Node* node = AllocateNode();
         node->bounds = req.bounds;
 
-        // Create leaf node if we have enough prims
-        if (req.numprims < 4)
+        // Create leaf node if we have enough prims, with SAH termination only if no split is cheaper
+        SahSplit os;
+        bool makeleaf = req.numprims < 2 || (req.numprims <= m_max_leaf_size && m_leaf_cost <= 0.f);
+
+        if (!makeleaf)
+        {
+            os = FindObjectSahSplit(req, primrefs);
+            makeleaf = req.numprims <= m_max_leaf_size && (isnan(os.split) || req.numprims * m_leaf_cost < os.sah);
+        }
+
+        if (makeleaf)
         {
             node->type = kLeaf;
-            node->startidx = (int)m_packed_indices.size();
             node->numprims = req.numprims;
 
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+            if (packedbase >= 0)
+            {
+                // Right children are built first, so everything between this leaf and the end of the range comes before it
+                node->startidx = packedbase + rangeend - (req.startidx + req.numprims);
+
+                for (int i = 0; i < req.numprims; ++i)
+                {
+                    m_packed_indices[node->startidx + i] = primrefs[req.startidx + i].idx;
+                }
+            }
+            else
             {
-                m_packed_indices.push_back(primrefs[i].idx);
+                node->startidx = (int)m_packed_indices.size();
+
+                for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+                {
+                    m_packed_indices.push_back(primrefs[i].idx);
+                }
             }
         }
         else
@@ -65,7 +97,6 @@ namespace RadeonRays
             int axis = req.centroid_bounds.maxdim();
             float border = req.centroid_bounds.center()[axis];
 
-            SahSplit os = FindObjectSahSplit(req, primrefs);
             SahSplit ss;
             auto split_type = SplitType::kObject;
 
@@ -119,7 +150,15 @@ namespace RadeonRays
             auto cmp1 = near2far ? cmpl : cmpge;
             auto cmp2 = near2far ? cmpge : cmpl;
 
-            if (req.centroid_bounds.extents()[axis] > 0.f)
+            if (req.centroid_bounds.extents()[axis] > 0.f && m_pool && req.numprims >= kParallelSweepThreshold)
+            {
+                splitidx = ParallelPartition(m_pool, primrefs.data(), req.startidx, req.startidx + req.numprims,
+                    [=](PrimRef const& ref) { return cmp1(ref.center[axis], border); },
+                    [](PrimRef const& ref) -> bbox const& { return ref.bounds; },
+                    [](PrimRef const& ref) -> Vec3 const& { return ref.center; },
+                    leftbounds, rightbounds, leftcentroid_bounds, rightcentroid_bounds);
+            }
+            else if (req.centroid_bounds.extents()[axis] > 0.f)
             {
                 auto first = req.startidx;
                 auto last = req.startidx + req.numprims;
@@ -181,14 +220,35 @@ namespace RadeonRays
             SplitRequest rightrequest = { splitidx, req.numprims - (splitidx - req.startidx), &node->rc, rightbounds, rightcentroid_bounds, req.level + 1 };
 
 
-            // The order is very important here since right node uses the space at the end of the array to partition
+            if (m_pool && req.level >= m_max_split_depth && req.numprims >= kParallelTaskThreshold)
             {
-                BuildNode(rightrequest, primrefs);
-            }
+                if (packedbase < 0)
+                {
+                    // Root of a parallel subtree, its nodes and packed indices are laid out up front
+                    ReserveNodes(2 * req.numprims);
+                    packedbase = (int)m_packed_indices.size();
+                    rangeend = req.startidx + req.numprims;
+                    m_packed_indices.resize(packedbase + req.numprims);
+                }
+
+                m_parallel_build = true;
 
+                GLSLPT::TaskGroup group(m_pool);
+                group.Run([&] { BuildNode(rightrequest, primrefs, packedbase, rangeend); });
+                BuildNode(leftrequest, primrefs, packedbase, rangeend);
+                group.Wait();
+            }
+            else
             {
-                // Put those to stack
-                BuildNode(leftrequest, primrefs);
+                // The order is very important here since right node uses the space at the end of the array to partition
+                {
+                    BuildNode(rightrequest, primrefs, packedbase, rangeend);
+                }
+
+                {
+                    // Put those to stack
+                    BuildNode(leftrequest, primrefs, packedbase, rangeend);
+                }
             }
         }
 
@@ -196,12 +256,18 @@ namespace RadeonRays
         if (req.ptr) *req.ptr = node;
     }
 
+    SplitBvh::SahSplit SplitBvh::FindObjectSahSplit(SplitRequest const& req, PrimRefArray const& refs) const
+    {
+        if (m_scalar_bins)
+            return FindObjectSahSplit<ScalarSahBins>(req, refs);
+        return FindObjectSahSplit<SahBins>(req, refs);
+    }
+
+    template <class Bins>
     SplitBvh::SahSplit SplitBvh::FindObjectSahSplit(SplitRequest const& req, PrimRefArray const& refs) const
     {
         // SAH implementation
         // calc centroids histogram
-        // moving split bin index
-        int splitidx = -1;
         // Set SAH to maximum float value as a start
         auto sah = std::numeric_limits<float>::max();
         SahSplit split;
@@ -219,97 +285,52 @@ namespace RadeonRays
             return split;
         }
 
-        // Bin has bbox and occurence count
-        struct Bin
-        {
-            bbox bounds;
-            int count;
-        };
-
-        // Keep bins for each dimension
-        std::vector<Bin> bins[3];
-        bins[0].resize(m_num_bins);
-        bins[1].resize(m_num_bins);
-        bins[2].resize(m_num_bins);
-
         // Precompute inverse parent area
         auto invarea = 1.f / req.bounds.surface_area();
         // Precompute min point
         auto rootmin = req.centroid_bounds.pmin;
 
-        // Evaluate all dimensions
-        for (int axis = 0; axis < 3; ++axis)
-        {
-            float rootminc = rootmin[axis];
-            // Range for histogram
-            auto centroid_rng = centroid_extents[axis];
-            auto invcentroid_rng = 1.f / centroid_rng;
-
-            // If the box is degenerate in that dimension skip it
-            if (centroid_rng == 0.f) continue;
-
-            // Initialize bins
-            for (int i = 0; i < m_num_bins; ++i)
-            {
-                bins[axis][i].count = 0;
-                bins[axis][i].bounds = bbox();
-            }
+        // Calc primitive refs histogram
+        Bins bins;
+        bins.Init(m_num_bins, req.centroid_bounds);
 
-            // Calc primitive refs histogram
-            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
+        if (m_pool && req.numprims >= kParallelSweepThreshold)
+        {
+            // Counts and bounds merge exactly, so the histogram is the same as a serial one
+            int numchunks = GetNumChunks(m_pool, req.numprims);
+            std::vector<Bins> chunkbins(numchunks);
+            ParallelChunks(m_pool, req.startidx, req.startidx + req.numprims, numchunks, [&](int chunk, int first, int last)
             {
-                auto idx = i;
-                auto binidx = (int)std::min<float>(static_cast<float>(m_num_bins) * ((refs[idx].center[axis] - rootminc) * invcentroid_rng), static_cast<float>(m_num_bins - 1));
-
-                ++bins[axis][binidx].count;
-                bins[axis][binidx].bounds.grow(refs[idx].bounds);
-            }
-
-            std::vector<bbox> rightbounds(m_num_bins - 1);
+                chunkbins[chunk].Init(m_num_bins, req.centroid_bounds);
+                for (int i = first; i < last; ++i)
+                {
+                    chunkbins[chunk].Add(refs[i].bounds, refs[i].center);
+                }
+            });
 
-            // Start with 1-bin right box
-            bbox rightbox = bbox();
-            for (int i = m_num_bins - 1; i > 0; --i)
+            for (int chunk = 0; chunk < numchunks; ++chunk)
             {
-                rightbox.grow(bins[axis][i].bounds);
-                rightbounds[i - 1] = rightbox;
+                bins.Merge(chunkbins[chunk]);
             }
-
-            bbox leftbox = bbox();
-            int  leftcount = 0;
-            int  rightcount = req.numprims;
-
-            // Start best SAH search
-            // i is current split candidate (split between i and i + 1)
-            float sahtmp = 0.f;
-            for (int i = 0; i < m_num_bins - 1; ++i)
+        }
+        else
+        {
+            for (int i = req.startidx; i < req.startidx + req.numprims; ++i)
             {
-                leftbox.grow(bins[axis][i].bounds);
-                leftcount += bins[axis][i].count;
-                rightcount -= bins[axis][i].count;
-
-                // Compute SAH
-                sahtmp = m_traversal_cost + (leftcount * leftbox.surface_area() + rightcount * rightbounds[i].surface_area()) * invarea;
-
-                // Check if it is better than what we found so far
-                if (sahtmp < sah)
-                {
-                    split.dim = axis;
-                    splitidx = i;
-                    sah = sahtmp;
-
-                    // Calculate percentage of overlap 
-                    split.overlap = intersection(leftbox, rightbounds[i]).surface_area() * invarea;
-                }
+                bins.Add(refs[i].bounds, refs[i].center);
             }
         }
 
         // Choose split plane
-        if (splitidx != -1)
+        int axis, splitidx;
+        if (bins.FindBestSplit(m_traversal_cost, invarea, req.numprims, axis, splitidx, sah))
         {
+            split.dim = axis;
             split.split = rootmin[split.dim] + (splitidx + 1) * (centroid_extents[split.dim] / m_num_bins);
             split.sah = sah;
 
+            // Calculate percentage of overlap
+            split.overlap = intersection(bins.Bounds(axis, 0, splitidx + 1), bins.Bounds(axis, splitidx + 1, m_num_bins)).surface_area() * invarea;
         }
 
         return split;
@@ -498,19 +519,30 @@ namespace RadeonRays
 
     SplitBvh::Node* SplitBvh::AllocateNode()
     {
-        if (m_nodecnt - m_num_nodes_archived >= m_num_nodes_for_regular)
+        if (m_nodecnt - m_num_nodes_archived >= (int)m_nodes.size())
         {
             m_node_archive.push_back(std::move(m_nodes));
-            m_num_nodes_archived += m_num_nodes_for_regular;
+            m_num_nodes_archived = m_nodecnt;
             m_nodes = std::vector<Node>(m_num_nodes_for_regular);
         }
 
         return &m_nodes[m_nodecnt++ - m_num_nodes_archived];
     }
 
+    void SplitBvh::ReserveNodes(int count)
+    {
+        if (m_nodecnt - m_num_nodes_archived + count > (int)m_nodes.size())
+        {
+            m_node_archive.push_back(std::move(m_nodes));
+            m_num_nodes_archived = m_nodecnt;
+            m_nodes = std::vector<Node>(std::max(m_num_nodes_for_regular, count));
+        }
+    }
+
     void SplitBvh::InitNodeAllocator(size_t maxnum)
     {
         m_node_archive.clear();
+        m_num_nodes_archived = 0;
         m_nodecnt = 0;
         m_nodes.resize(maxnum);
 
@@ -526,6 +558,7 @@ namespace RadeonRays
         os << "SAH: " << "enabled (forced)\n";
         os << "SAH bins: " << m_num_bins << "\n";
         os << "Max split depth: " << m_max_split_depth << "\n";
+        os << "Max leaf size: " << m_max_leaf_size << "\n";
         os << "Min node overlap: " << m_min_overlap << "\n";
         os << "Number of triangles: " << num_triangles << "\n";
         os << "Number of triangle refs: " << num_refs << "\n";
@@ -41,6 +41,7 @@ namespace RadeonRays
         , m_num_nodes_for_regular(0)
         , m_num_nodes_archived(0)
         {
+            m_max_leaf_size = kMeshMaxLeafSize;
         }
 
         ~SplitBvh() = default;
@@ -57,8 +58,13 @@ namespace RadeonRays
 
         // Build function
         void BuildImpl(bbox const* bounds, int numbounds) override;
-        void BuildNode(SplitRequest& req, PrimRefArray& primrefs);
+        // Subtrees below m_max_split_depth never grow their primitive refs and can be built in parallel.
+        // Inside such a subtree packedbase is where its refs start in m_packed_indices and rangeend is the
+        // end of its range of primrefs
+        void BuildNode(SplitRequest& req, PrimRefArray& primrefs, int packedbase = -1, int rangeend = 0);
         
+        SahSplit FindObjectSahSplit(SplitRequest const& req, PrimRefArray const& refs) const;
+        template <class Bins>
         SahSplit FindObjectSahSplit(SplitRequest const& req, PrimRefArray const& refs) const;
         SahSplit FindSpatialSahSplit(SplitRequest const& req, PrimRefArray const& refs) const;
         
@@ -71,6 +77,8 @@ namespace RadeonRays
     protected:
         Node* AllocateNode() override;
         void  InitNodeAllocator(size_t maxnum) override;
+        // Makes sure the next count nodes fit into m_nodes, so they can be allocated from several threads
+        void  ReserveNodes(int count);
 
     private:
 
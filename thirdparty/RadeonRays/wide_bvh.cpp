@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace RadeonRays
+{
+    // Unused child slots get a degenerate box far outside of any scene. Traversal clamps the ray
+    // interval to the closest hit (at most 1e6), so these never pass the slab test
+    static const float kEmptySlot = 1e30f;
+
+    template <int N>
+    void WideBvhTranslator<N>::SetChild(int nodeIndex, int slot, const Bvh::Node *node, int child, int count)
+    {
+        Node& wide = nodes[nodeIndex];
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            wide.bmin[axis][slot] = node->bounds.pmin[axis];
+            wide.bmax[axis][slot] = node->bounds.pmax[axis];
+        }
+
+        wide.child[slot] = child;
+        wide.count[slot] = count;
+    }
+
+    template <int N>
+    int WideBvhTranslator<N>::CollapseNode(const Bvh::Node *node, bool topLevel, int triOffset)
+    {
+        int index = (int)nodes.size();
+        nodes.emplace_back();
+
+        for (int slot = 0; slot < N; slot++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                nodes[index].bmin[axis][slot] = kEmptySlot;
+                nodes[index].bmax[axis][slot] = kEmptySlot;
+            }
+            nodes[index].child[slot] = -1;
+            nodes[index].count[slot] = 0;
+        }
+
+        // Gather up to N descendants by repeatedly opening the internal child with the largest surface area
+        const Bvh::Node *children[N];
+        int numChildren = 0;
+
+        if (node->type == Bvh::NodeType::kLeaf)
+        {
+            children[numChildren++] = node;
+        }
+        else
+        {
+            children[numChildren++] = node->lc;
+            children[numChildren++] = node->rc;
+
+            while (numChildren < N)
+            {
+                int best = -1;
+                float bestArea = -1.0f;
+                for (int i = 0; i < numChildren; i++)
+                {
+                    if (children[i]->type == Bvh::NodeType::kLeaf)
+                        continue;
+
+                    float area = children[i]->bounds.surface_area();
+                    if (area > bestArea)
+                    {
+                        best = i;
+                        bestArea = area;
+                    }
+                }
+
+                if (best == -1)
+                    break;
+
+                const Bvh::Node *opened = children[best];
+                children[best] = opened->lc;
+                children[numChildren++] = opened->rc;
+            }
+        }
+
+        for (int i = 0; i < numChildren; i++)
+        {
+            const Bvh::Node *child = children[i];
+
+            if (child->type == Bvh::NodeType::kLeaf)
+            {
+                if (topLevel)
+                {
+                    int instanceIndex = TLBvh->m_packed_indices[child->startidx];
+                    int meshIndex = (*meshInstances)[instanceIndex].meshID;
+                    SetChild(index, i, child, blasRootIndices[meshIndex], -instanceIndex - 1);
+                }
+                else
+                {
+                    SetChild(index, i, child, triOffset + child->startidx, child->numprims);
+                }
+            }
+            else
+            {
+                // nodes may be reallocated by the recursion, so only index into it afterwards
+                int childIndex = CollapseNode(child, topLevel, triOffset);
+                SetChild(index, i, child, childIndex, 0);
+            }
+        }
+
+        return index;
+    }
+
+    // Treelets fill a 4 KB page, so a ray walking down one touches a single TLB entry
+    static const int kTreeletBytes = 4096;
+
+    template <int N>
+    void WideBvhTranslator<N>::ReorderTree(int first, int end)
+    {
+        // Treelets are grown from their root by taking the child with the largest surface area, the one a ray
+        // most likely enters next, and are stored as one block. The subtrees left at the border of a treelet
+        // follow depth first, largest first, so a subtree stays close to the treelet it hangs off. The root
+        // stays at first and child indices only point within [first, end), TLAS leaves refer to BLAS roots
+        const int treeletSize = std::max(kTreeletBytes / (int)sizeof(Node), 1);
+        const int numNodes = end - first;
+
+        struct Candidate
+        {
+            float area;
+            int index;
+            bool operator<(const Candidate &b) const { return area < b.area; }
+        };
+
+        std::vector<int> order;
+        order.reserve(numNodes);
+        std::vector<int> treeletRoots(1, first);
+        std::vector<Candidate> candidates;
+
+        while (!treeletRoots.empty())
+        {
+            candidates.clear();
+            candidates.push_back({ std::numeric_limits<float>::max(), treeletRoots.back() });
+            treeletRoots.pop_back();
+
+            for (int taken = 0; taken < treeletSize && !candidates.empty(); taken++)
+            {
+                std::pop_heap(candidates.begin(), candidates.end());
+                int index = candidates.back().index;
+                candidates.pop_back();
+                order.push_back(index);
+
+                const Node &node = nodes[index];
+                for (int slot = 0; slot < N; slot++)
+                {
+                    if (node.count[slot] != 0 || node.child[slot] < 0)
+                        continue;
+
+                    bbox box(Vec3(node.bmin[0][slot], node.bmin[1][slot], node.bmin[2][slot]),
+                        Vec3(node.bmax[0][slot], node.bmax[1][slot], node.bmax[2][slot]));
+                    candidates.push_back({ box.surface_area(), node.child[slot] });
+                    std::push_heap(candidates.begin(), candidates.end());
+                }
+            }
+
+            // Popped last to first, so the largest subtree comes right after this treelet
+            std::sort(candidates.begin(), candidates.end());
+            for (const Candidate &c : candidates)
+                treeletRoots.push_back(c.index);
+        }
+
+        std::vector<int> newIndex(numNodes);
+        for (int i = 0; i < numNodes; i++)
+            newIndex[order[i] - first] = first + i;
+
+        std::vector<Node> reordered(numNodes);
+        for (int i = 0; i < numNodes; i++)
+        {
+            Node node = nodes[order[i]];
+            for (int slot = 0; slot < N; slot++)
+            {
+                if (node.count[slot] == 0 && node.child[slot] >= 0)
+                    node.child[slot] = newIndex[node.child[slot] - first];
+            }
+            reordered[i] = node;
+        }
+        std::copy(reordered.begin(), reordered.end(), nodes.begin() + first);
+    }
+
+    template <int N>
+    void WideBvhTranslator<N>::UpdateTLAS(const Bvh *topLevelBvh, const std::vector<GLSLPT::MeshInstance> &sceneInstances)
+    {
+        TLBvh = topLevelBvh;
+        meshInstances = &sceneInstances;
+
+        nodes.resize(topLevelIndex);
+        CollapseNode(TLBvh->m_root, true, 0);
+
+        if (treeletLayout)
+            ReorderTree(topLevelIndex, (int)nodes.size());
+    }
+
+    template <int N>
+    void WideBvhTranslator<N>::Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &sceneMeshes, const std::vector<GLSLPT::MeshInstance> &sceneInstances)
+    {
+        nodes.clear();
+        blasRootIndices.clear();
+
+        // Triangles of each mesh follow the previous meshes in vertIndices, see Scene::CreateAccelerationStructures()
+        int triOffset = 0;
+        for (int i = 0; i < (int)sceneMeshes.size(); i++)
+        {
+            const Bvh *bvh = sceneMeshes[i]->bvh;
+            blasRootIndices.push_back(CollapseNode(bvh->m_root, false, triOffset));
+            triOffset += (int)bvh->GetNumIndices();
+        }
+
+        topLevelIndex = (int)nodes.size();
+        if (treeletLayout)
+        {
+            for (size_t i = 0; i < blasRootIndices.size(); i++)
+                ReorderTree(blasRootIndices[i], i + 1 < blasRootIndices.size() ? blasRootIndices[i + 1] : topLevelIndex);
+        }
+
+        UpdateTLAS(topLevelBvh, sceneInstances);
+    }
+
+    template class WideBvhTranslator<4>;
+    template class WideBvhTranslator<8>;
+}
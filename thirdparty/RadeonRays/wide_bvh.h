@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2019-2021 Asif Ali
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "bvh.h"
+#include "Mesh.h"
+
+namespace RadeonRays
+{
+    /// Collapses the binary trees built by Bvh/SplitBvh into N-wide trees (N = 4 or 8)
+    /// for SIMD traversal on the CPU. Child bounds are stored SoA so that all children of
+    /// a node are tested against a ray at once. Leaves follow the BvhTranslator layout:
+    /// BLAS leaves point into the scene's vertIndices, TLAS leaves hold an instance and
+    /// the root node of its BLAS.
+    //
+    template <int N>
+    class WideBvhTranslator
+    {
+    public:
+        struct Node
+        {
+            // Per child bounds, bmin[axis][child]
+            float bmin[3][N];
+            float bmax[3][N];
+            // Internal child : index of the child node, count == 0
+            // BLAS leaf      : first triangle in vertIndices, count > 0 triangles
+            // TLAS leaf      : root of the BLAS, instance = -count - 1
+            // Empty slot     : child == -1, count == 0
+            int child[N];
+            int count[N];
+        };
+
+        void Process(const Bvh *topLevelBvh, const std::vector<GLSLPT::Mesh*> &meshes, const std::vector<GLSLPT::MeshInstance> &instances);
+        void UpdateTLAS(const Bvh *topLevelBvh, const std::vector<GLSLPT::MeshInstance> &instances);
+
+        int topLevelIndex = 0;
+        std::vector<Node, AlignedAllocator<Node>> nodes; // Nodes are whole cache lines, keep them aligned to one
+        // Store every tree as treelets of the nodes most likely visited together, see ReorderTree(), instead
+        // of in depth first order. Set before Process()
+        bool treeletLayout = false;
+
+    private:
+        int CollapseNode(const Bvh::Node *root, bool topLevel, int triOffset);
+        void SetChild(int nodeIndex, int slot, const Bvh::Node *node, int child, int count);
+        void ReorderTree(int first, int end);
+
+        std::vector<int> blasRootIndices;
+        const std::vector<GLSLPT::MeshInstance> *meshInstances = nullptr; // Owned by the scene
+        const Bvh *TLBvh;
+    };
+}
+
+#endif // WIDE_BVH_H